@@ -17,10 +17,13 @@
  *
  */
 
+#include <algorithm>
+#include <array>
 #include <cstring>
 #include <fstream>
 #include <iomanip>
 #include <iostream>
+#include <sstream>
 #include <string>
 #include <vector>
 
@@ -32,9 +35,12 @@
 #include "src/capabilities/confstat.h"
 #include "src/capabilities/persistentdiagram.h"
 #include "src/capabilities/rmsd.h"
+#include "src/capabilities/rmsdbatch.h"
 
 #include "src/core/fileiterator.h"
+#include "src/core/outputbuffer.h"
 
+#include "src/core/binarytrajectory.h"
 #include "src/core/energycalculator.h"
 
 #include "src/tools/general.h"
@@ -119,12 +125,15 @@ int ConfScanThread::execute()
 
 int ConfScanThreadNoReorder::execute()
 {
-    m_driver->setReference(m_reference);
-    m_driver->setTarget(m_target);
     m_keep_molecule = true;
-
-    m_driver->start();
-    m_rmsd = m_driver->RMSD();
+    const bool given = m_rmsd_given;
+    m_rmsd_given = false;
+    if (!given) {
+        m_driver->setReference(m_reference);
+        m_driver->setTarget(m_target);
+        m_driver->start();
+        m_rmsd = m_driver->RMSD();
+    }
     m_input.rmsd = m_rmsd;
 
     double Ia = abs(m_reference.Ia() - m_target.Ia());
@@ -144,7 +153,139 @@ int ConfScanThreadNoReorder::execute()
         m_break_pool = true;
     }
 
-    m_driver->clear();
+    if (!given)
+        m_driver->clear();
+    return 0;
+}
+
+int ConfScanCompareWorker::execute()
+{
+    for (int i = m_next->fetch_add(1); i < m_jobs->size() && i < m_first->load(); i = m_next->fetch_add(1)) {
+        ConfScanThreadNoReorder* job = (*m_jobs)[i];
+        job->setTarget(m_target);
+        if (m_rmsd)
+            job->setRMSD((*m_rmsd)[i]);
+        job->execute();
+        (*m_done)[i] = 1;
+        if (job->KeepMolecule() == false) {
+            int first = m_first->load();
+            while (i < first && !m_first->compare_exchange_weak(first, i)) {
+            }
+        }
+    }
+    return 0;
+}
+
+ConfScanIndex::ConfScanIndex(double dLE, double dLI, double dLH, int looseThresh)
+    : m_dLE(dLE)
+    , m_dLI(dLI)
+    , m_dLH(dLH)
+    , m_rotation((looseThresh & 1) == 1)
+    , m_ripser((looseThresh & 2) == 2)
+    , m_energy((looseThresh & 4) == 4)
+{
+    m_cell = std::max(3 * dLI, 1e-6);
+}
+
+ConfScanIndex::Entry ConfScanIndex::MakeEntry(const Molecule* molecule, int index) const
+{
+    Entry entry;
+    entry.energy = molecule->Energy() * 2625.5;
+    entry.Ia = molecule->Ia();
+    entry.Ib = molecule->Ib();
+    entry.Ic = molecule->Ic();
+    entry.image = m_ripser ? molecule->getPersisentImage().sum() : 0;
+    entry.index = index;
+    return entry;
+}
+
+ConfScanIndex::Cell ConfScanIndex::CellOf(const Entry& entry) const
+{
+    return Cell(std::floor(entry.Ia / m_cell), std::floor(entry.Ib / m_cell), std::floor(entry.Ic / m_cell));
+}
+
+bool ConfScanIndex::Within(const Entry& a, const Entry& b) const
+{
+    if (m_energy && std::abs(a.energy - b.energy) >= m_dLE)
+        return false;
+    if (m_ripser && std::abs(a.image - b.image) >= m_dLH * (1 + 1e-12))
+        return false;
+    if (m_rotation && (std::abs(a.Ia - b.Ia) >= 3 * m_dLI || std::abs(a.Ib - b.Ib) >= 3 * m_dLI || std::abs(a.Ic - b.Ic) >= 3 * m_dLI))
+        return false;
+    return true;
+}
+
+void ConfScanIndex::addMolecule(const Molecule* molecule, int index)
+{
+    const Entry entry = MakeEntry(molecule, index);
+    m_entries.push_back(entry);
+    if (m_rotation)
+        m_grid[CellOf(entry)].push_back(m_entries.size() - 1);
+    else if (m_energy)
+        m_energies.insert(std::pair<double, int>(entry.energy, m_entries.size() - 1));
+}
+
+std::vector<int> ConfScanIndex::Candidates(const Molecule* molecule) const
+{
+    const Entry entry = MakeEntry(molecule, -1);
+    std::vector<int> result;
+    auto test = [&](int i) {
+        if (Within(entry, m_entries[i]))
+            result.push_back(m_entries[i].index);
+    };
+    if (m_rotation) {
+        const Cell cell = CellOf(entry);
+        for (int64_t a = -1; a <= 1; ++a)
+            for (int64_t b = -1; b <= 1; ++b)
+                for (int64_t c = -1; c <= 1; ++c) {
+                    auto bucket = m_grid.find(Cell(std::get<0>(cell) + a, std::get<1>(cell) + b, std::get<2>(cell) + c));
+                    if (bucket != m_grid.end())
+                        for (int i : bucket->second)
+                            test(i);
+                }
+    } else if (m_energy) {
+        for (auto i = m_energies.lower_bound(entry.energy - m_dLE); i != m_energies.end() && i->first <= entry.energy + m_dLE; ++i)
+            test(i->second);
+    } else {
+        for (int i = 0; i < m_entries.size(); ++i)
+            test(i);
+    }
+    std::sort(result.begin(), result.end());
+    return result;
+}
+
+int ConfScanDescriptorThread::execute()
+{
+    PersistentDiagram diagram(m_ripser);
+    EnergyCalculator* calculator = nullptr;
+    std::vector<int> elements;
+    int charge = 0, spin = 0;
+    for (int index = m_next->fetch_add(1); index < m_molecules->size(); index = m_next->fetch_add(1)) {
+        Molecule* mol = (*m_molecules)[index];
+        if (std::abs((*m_energies)[index]) < 1e-5 || m_recalculate) {
+            if (calculator == nullptr || mol->Atoms() != elements || mol->Charge() != charge || mol->Spin() != spin) {
+                delete calculator;
+                calculator = new EnergyCalculator(m_method, m_controller);
+                elements = mol->Atoms();
+                charge = mol->Charge();
+                spin = mol->Spin();
+            }
+            calculator->setMolecule(mol->getMolInfo());
+            (*m_energies)[index] = calculator->CalculateEnergy(false);
+        }
+
+        auto rot = std::chrono::system_clock::now();
+        if ((m_looseThresh & 1) == 1)
+            mol->CalculateRotationalConstants();
+        auto ripser = std::chrono::system_clock::now();
+        if ((m_looseThresh & 2) == 2) {
+            diagram.setDistanceMatrix(mol->LowerDistanceVector());
+            mol->setPersisentImage(diagram.generateImage(diagram.generatePairs()));
+        }
+        m_time_ripser += std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now() - ripser).count();
+        m_time_rot += std::chrono::duration_cast<std::chrono::milliseconds>(ripser - rot).count();
+    }
+    delete calculator;
     return 0;
 }
 
@@ -228,6 +369,8 @@ void ConfScan::LoadControlJson()
     m_useorders = Json2KeyWord<int>(m_defaults, "UseOrders");
     m_MaxHTopoDiff = Json2KeyWord<int>(m_defaults, "MaxHTopoDiff");
     m_threads = m_defaults["threads"].get<int>();
+    m_descriptor_cache = Json2KeyWord<bool>(m_defaults, "descriptor_cache");
+    m_trajectory_format = Json2KeyWord<std::string>(m_defaults, "trajectory_format");
     m_RMSDmethod = Json2KeyWord<std::string>(m_defaults, "method");
     fmt::print(fg(fmt::color::green) | fmt::emphasis::bold, "\nPermutation of atomic indices performed according to {0} \n\n", m_RMSDmethod);
 
@@ -275,13 +418,10 @@ void ConfScan::LoadControlJson()
 
 bool ConfScan::openFile()
 {
-    bool xyzfile = std::string(m_filename).find(".xyz") != std::string::npos || std::string(m_filename).find(".trj") != std::string::npos;
+    bool xyzfile = std::string(m_filename).find(".xyz") != std::string::npos || std::string(m_filename).find(".trj") != std::string::npos || BinaryTrajectory::isBinary(m_filename);
     if (xyzfile == false)
         throw 1;
 
-    int molecule = 0;
-    PersistentDiagram diagram(m_defaults);
-    FileIterator file(m_filename);
     int calcH = 0;
     int calcI = 0;
     // std::cout << m_looseThresh <<" "<<int((m_looseThresh & 1) == 1) << " " << int((m_looseThresh & 2) == 2) << std::endl;
@@ -292,34 +432,14 @@ bool ConfScan::openFile()
     if ((m_looseThresh & 2) == 2)
         std::cout << "ripser barcodes" << std::endl;
     std::cout << " required" << std::endl;
-    while (!file.AtEnd()) {
-        Molecule* mol = new Molecule(file.Next());
-        double energy = mol->Energy();
-        if (std::abs(energy) < 1e-5 || m_method.compare("") != 0) {
-            // XTBInterface interface; // As long as xtb leaks, we have to put it heare
-            if (m_method == "")
-                m_method = "gfn2";
-            EnergyCalculator interface(m_method, m_controller);
-            // I might not leak really, but was unable to clear everything
-
-            interface.setMolecule(mol->getMolInfo());
-            energy = interface.CalculateEnergy(false);
-        }
-        m_ordered_list.insert(std::pair<double, int>(energy, molecule));
-        molecule++;
-        if (m_noname)
-            mol->setName(NamePattern(molecule));
 
-        auto rot = std::chrono::system_clock::now();
-        if ((m_looseThresh & 1) == 1)
-            mol->CalculateRotationalConstants();
-        auto ripser = std::chrono::system_clock::now();
-        if ((m_looseThresh & 2) == 2) {
-            diagram.setDistanceMatrix(mol->LowerDistanceVector());
-            mol->setPersisentImage(diagram.generateImage(diagram.generatePairs()));
-        }
-        calcH += std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now() - ripser).count();
-        calcI += std::chrono::duration_cast<std::chrono::milliseconds>(ripser - rot).count();
+    std::vector<double> energies;
+    std::vector<Molecule*> molecules = LoadStructures(m_filename, energies, calcI, calcH);
+    for (int molecule = 0; molecule < molecules.size(); ++molecule) {
+        Molecule* mol = molecules[molecule];
+        m_ordered_list.insert(std::pair<double, int>(energies[molecule], molecule));
+        if (m_noname)
+            mol->setName(NamePattern(molecule + 1));
 
         std::pair<std::string, Molecule*> pair(mol->Name(), mol);
         m_molecules.push_back(pair);
@@ -327,43 +447,15 @@ bool ConfScan::openFile()
 
     if (m_prev_accepted != "") {
         double min_energy = 0;
-        bool xyzfile = std::string(m_prev_accepted).find(".xyz") != std::string::npos || std::string(m_prev_accepted).find(".trj") != std::string::npos;
+        bool xyzfile = std::string(m_prev_accepted).find(".xyz") != std::string::npos || std::string(m_prev_accepted).find(".trj") != std::string::npos || BinaryTrajectory::isBinary(m_prev_accepted);
 
         if (xyzfile == false)
             throw 1;
 
-        int molecule = 0;
-
-        FileIterator file(m_prev_accepted);
-        while (!file.AtEnd()) {
-            Molecule* mol = new Molecule(file.Next());
-            double energy = mol->Energy();
-            if (std::abs(energy) < 1e-5 || m_method.compare("") != 0) {
-                // XTBInterface interface; // As long as xtb leaks, we have to put it heare
-                if (m_method == "")
-                    m_method = "gfn2";
-                EnergyCalculator interface(m_method, m_controller);
-                // I might not leak really, but was unable to clear everything
-
-                interface.setMolecule(mol->getMolInfo());
-                energy = interface.CalculateEnergy(false);
-            }
+        std::vector<double> energies;
+        m_previously_accepted = LoadStructures(m_prev_accepted, energies, calcI, calcH);
+        for (double energy : energies)
             min_energy = std::min(min_energy, energy);
-            auto rot = std::chrono::system_clock::now();
-            if ((m_looseThresh & 1) == 1)
-                mol->CalculateRotationalConstants();
-            auto ripser = std::chrono::system_clock::now();
-
-            // diagram.setDimension(2);
-            if ((m_looseThresh & 2) == 2) {
-                diagram.setDistanceMatrix(mol->LowerDistanceVector());
-                mol->setPersisentImage(diagram.generateImage(diagram.generatePairs()));
-            }
-            calcH += std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now() - ripser).count();
-            calcI += std::chrono::duration_cast<std::chrono::milliseconds>(ripser - rot).count();
-
-            m_previously_accepted.push_back(mol);
-        }
         m_lowest_energy = min_energy;
         m_result = m_previously_accepted;
     }
@@ -377,6 +469,166 @@ bool ConfScan::openFile()
     return true;
 }
 
+/* Structures are parsed and their descriptors calculated on m_threads threads,
+ * the returned structures and energies keep the order of the file. */
+std::vector<Molecule*> ConfScan::LoadStructures(const std::string& filename, std::vector<double>& energies, int& rotational, int& ripser)
+{
+    FileIterator file(filename);
+    std::vector<Molecule> frames = file.Frames(0, -1, 1, m_threads);
+
+    std::vector<Molecule*> molecules(frames.size());
+    energies.resize(frames.size());
+    bool missing = false;
+    for (int i = 0; i < frames.size(); ++i) {
+        molecules[i] = new Molecule(std::move(frames[i]));
+        energies[i] = molecules[i]->Energy();
+        missing = missing || std::abs(energies[i]) < 1e-5;
+    }
+    frames.clear();
+
+    const bool recalculate = m_method.compare("") != 0;
+    if (missing && m_method == "")
+        m_method = "gfn2";
+
+    uint64_t key = 0;
+    if (m_descriptor_cache) {
+        key = DescriptorKey(filename, recalculate || missing);
+        if (LoadDescriptorCache(filename + ".cdesc", key, molecules, energies)) {
+            fmt::print("Descriptors of {} structures taken from {}.cdesc\n", molecules.size(), filename);
+            return molecules;
+        }
+    }
+
+    std::atomic<int> next(0);
+    std::vector<ConfScanDescriptorThread*> threads;
+    CxxThreadPool* pool = new CxxThreadPool;
+    pool->setProgressBar(CxxThreadPool::ProgressBarType::None);
+    /* gfnff (xtb) is not thread safe */
+    const int thread_count = m_method.compare("gfnff") == 0 ? 1 : m_threads;
+    pool->setActiveThreadCount(thread_count);
+    for (int i = 0; i < std::max(1, std::min(thread_count, int(molecules.size()))); ++i) {
+        ConfScanDescriptorThread* thread = new ConfScanDescriptorThread(&molecules, &energies, &next, m_controller, m_defaults, m_method, recalculate, m_looseThresh);
+        threads.push_back(thread);
+        pool->addThread(thread);
+    }
+    pool->StartAndWait();
+    delete pool;
+    for (auto* thread : threads) {
+        rotational += thread->RotationalTime();
+        ripser += thread->RipserTime();
+        delete thread;
+    }
+    if (m_descriptor_cache)
+        WriteDescriptorCache(filename + ".cdesc", key, molecules, energies);
+    return molecules;
+}
+
+/* FNV-1a over the content of the file, the descriptor settings and, if energies are calculated, the method and controller */
+uint64_t ConfScan::DescriptorKey(const std::string& filename, bool calculated) const
+{
+    uint64_t hash = 14695981039346656037ULL;
+    auto add = [&hash](const char* data, std::size_t size) {
+        for (std::size_t i = 0; i < size; ++i) {
+            hash ^= uint8_t(data[i]);
+            hash *= 1099511628211ULL;
+        }
+    };
+    std::ifstream input(filename, std::ios::binary);
+    std::vector<char> buffer(1 << 20);
+    while (input.read(buffer.data(), buffer.size()) || input.gcount())
+        add(buffer.data(), input.gcount());
+
+    /* calculated energies depend on all settings of the calculator (solvent, Tele, param_file ...) */
+    std::string settings = std::to_string(m_looseThresh & 3) + (calculated ? m_method + m_controller.dump() : std::string());
+    for (const auto& ripser : RipserJson.items())
+        if (m_defaults.contains(ripser.key()))
+            settings += ripser.key() + m_defaults[ripser.key()].dump();
+    add(settings.data(), settings.size());
+    return hash;
+}
+
+namespace {
+const char DescriptorMagic[4] = { 'C', 'D', 'S', 'C' };
+
+template <typename T>
+inline void StoreValue(std::vector<char>& buffer, T value)
+{
+    const char* bytes = reinterpret_cast<const char*>(&value);
+    buffer.insert(buffer.end(), bytes, bytes + sizeof(T));
+}
+
+template <typename T>
+inline T LoadValue(const char*& data)
+{
+    T value;
+    memcpy(&value, data, sizeof(T));
+    data += sizeof(T);
+    return value;
+}
+}
+
+/* Layout: "CDSC", key, number of structures, then energy, Ia, Ib, Ic, rows, cols and the persistent image of every structure */
+bool ConfScan::LoadDescriptorCache(const std::string& filename, uint64_t key, const std::vector<Molecule*>& molecules, std::vector<double>& energies) const
+{
+    std::ifstream input(filename, std::ios::binary);
+    if (!input.is_open())
+        return false;
+    std::vector<char> data((std::istreambuf_iterator<char>(input)), std::istreambuf_iterator<char>());
+    const std::size_t head = 4 + 2 * sizeof(uint64_t);
+    if (data.size() < head || memcmp(data.data(), DescriptorMagic, 4) != 0)
+        return false;
+    const char* pos = data.data() + 4;
+    const char* end = data.data() + data.size();
+    if (LoadValue<uint64_t>(pos) != key || LoadValue<uint64_t>(pos) != molecules.size())
+        return false;
+
+    const std::size_t record = 4 * sizeof(double) + 2 * sizeof(uint32_t);
+    std::vector<double> cached(molecules.size());
+    std::vector<Eigen::MatrixXd> images(molecules.size());
+    std::vector<std::array<double, 3>> constants(molecules.size());
+    for (std::size_t i = 0; i < molecules.size(); ++i) {
+        if (end - pos < record)
+            return false;
+        cached[i] = LoadValue<double>(pos);
+        for (int j = 0; j < 3; ++j)
+            constants[i][j] = LoadValue<double>(pos);
+        const uint32_t rows = LoadValue<uint32_t>(pos);
+        const uint32_t cols = LoadValue<uint32_t>(pos);
+        if (std::size_t(end - pos) < std::size_t(rows) * cols * sizeof(double))
+            return false;
+        images[i] = Eigen::MatrixXd(rows, cols);
+        memcpy(images[i].data(), pos, std::size_t(rows) * cols * sizeof(double));
+        pos += std::size_t(rows) * cols * sizeof(double);
+    }
+    for (std::size_t i = 0; i < molecules.size(); ++i) {
+        energies[i] = cached[i];
+        molecules[i]->setRotationalConstants(constants[i][0], constants[i][1], constants[i][2]);
+        if (images[i].size())
+            molecules[i]->setPersisentImage(images[i]);
+    }
+    return true;
+}
+
+void ConfScan::WriteDescriptorCache(const std::string& filename, uint64_t key, const std::vector<Molecule*>& molecules, const std::vector<double>& energies) const
+{
+    std::vector<char> buffer(DescriptorMagic, DescriptorMagic + 4);
+    StoreValue<uint64_t>(buffer, key);
+    StoreValue<uint64_t>(buffer, molecules.size());
+    for (std::size_t i = 0; i < molecules.size(); ++i) {
+        StoreValue<double>(buffer, energies[i]);
+        StoreValue<double>(buffer, molecules[i]->Ia());
+        StoreValue<double>(buffer, molecules[i]->Ib());
+        StoreValue<double>(buffer, molecules[i]->Ic());
+        Eigen::MatrixXd image = (m_looseThresh & 2) == 2 ? molecules[i]->getPersisentImage() : Eigen::MatrixXd();
+        StoreValue<uint32_t>(buffer, image.rows());
+        StoreValue<uint32_t>(buffer, image.cols());
+        const char* bytes = reinterpret_cast<const char*>(image.data());
+        buffer.insert(buffer.end(), bytes, bytes + image.size() * sizeof(double));
+    }
+    std::ofstream output(filename, std::ios::binary | std::ios::trunc);
+    output.write(buffer.data(), buffer.size());
+}
+
 void ConfScan::ReadControlFile()
 {
     json control;
@@ -487,7 +739,9 @@ void ConfScan::SetUp()
     m_end = m_ordered_list.size();
 
     m_result_basename = m_filename;
-    m_result_basename.erase(m_result_basename.end() - 4, m_result_basename.end());
+    const std::size_t dot = m_result_basename.find_last_of('.');
+    if (dot != std::string::npos && (m_result_basename.find_last_of('/') == std::string::npos || dot > m_result_basename.find_last_of('/')))
+        m_result_basename.erase(dot);
 
     m_accepted_filename = m_result_basename + ".accepted.xyz";
     m_1st_filename = m_result_basename + ".initial.xyz";
@@ -504,8 +758,7 @@ void ConfScan::SetUp()
     m_limit_file = m_result_basename + ".param.limit.dat";
 
     auto createFile = [](const std::string& filename) {
-        std::ofstream file(filename);
-        file.close();
+        OutputBuffer::Truncate(filename);
     };
 
     if (m_writeFiles) {
@@ -597,11 +850,8 @@ void ConfScan::start()
     if (!m_skipinit) {
         fmt::print("\n\nInitial Pass\nPerforming RMSD calculation without reordering now!\n\n");
         m_current_filename = m_1st_filename;
-        if (m_writeFiles && !m_reduced_file) {
-            result_file.open(m_statistic_filename, std::ios_base::app);
-            result_file << "Results of 1st Pass" << std::endl;
-            result_file.close();
-        }
+        if (m_writeFiles && !m_reduced_file)
+            OutputBuffer::Append(m_statistic_filename, "Results of 1st Pass\n");
         CheckOnly(m_sLE[0], m_sLI[0], m_sLH[0]);
         PrintStatus("Result initial pass:");
         if (m_analyse) {
@@ -656,11 +906,8 @@ void ConfScan::start()
         for (int run = 0; run < m_sLE.size(); ++run) {
             m_current_filename = m_2nd_filename + "." + std::to_string(run + 1) + ".xyz";
 
-            std::ofstream nd_file;
-            if (m_writeFiles && !m_reduced_file) {
-                nd_file.open(m_current_filename);
-                nd_file.close();
-            }
+            if (m_writeFiles && !m_reduced_file)
+                OutputBuffer::Truncate(m_current_filename);
             double dLI = m_dLI;
             double dLH = m_dLH;
             double dLE = m_dLE;
@@ -685,11 +932,8 @@ void ConfScan::start()
             if (!CheckStop()) {
                 timer.Reset();
                 fmt::print("\n\nReorder Pass\nPerforming RMSD calculation with reordering now!\n\n");
-                if (m_writeFiles && !m_reduced_file) {
-                    result_file.open(m_statistic_filename, std::ios_base::app);
-                    result_file << "Results of Reorder Pass #" << run + 1 << std::endl;
-                    result_file.close();
-                }
+                if (m_writeFiles && !m_reduced_file)
+                    OutputBuffer::Append(m_statistic_filename, "Results of Reorder Pass #" + std::to_string(run + 1) + "\n");
                 if (m_analyse) {
                     std::ofstream parameters_success;
                     parameters_success.open(m_success_file, std::ios_base::app);
@@ -860,10 +1104,20 @@ void ConfScan::CheckOnly(double sLE, double sLI, double sLH)
     rmsd["heavy"] = m_heavy;
     rmsd["noreorder"] = true;
 
-    std::vector<ConfScanThreadNoReorder*> threads;
+    /* without reordering, fragments and hydrogen bond topology the driver only calculates
+     * the best fit rmsd, all accepted structures are then compared in one batch call */
+    const json merged = MergeJson(RMSDJson, rmsd);
+    bool use_batch = !m_heavy && m_MaxHTopoDiff == -1 && Json2KeyWord<int>(merged, "fragment") == -1
+        && Json2KeyWord<int>(merged, "fragment_reference") == -1 && Json2KeyWord<int>(merged, "fragment_target") == -1;
+    RMSDBatch batch;
+    batch.setThreads(m_threads);
+    std::vector<double> batch_rmsd, ordered_rmsd;
+
+    m_comparisons = 0;
+    std::vector<ConfScanThreadNoReorder*> threads, ordered;
+    std::vector<std::pair<double, int>> likelihood;
+    std::vector<char> done;
     std::vector<std::vector<int>> rules;
-    CxxThreadPool* p = new CxxThreadPool;
-    p->setActiveThreadCount(m_threads);
 
     for (auto& i : m_ordered_list) {
         if (m_skip) {
@@ -886,7 +1140,7 @@ void ConfScan::CheckOnly(double sLE, double sLI, double sLH)
             m_first_node = mol1->Name();
             ConfScanThreadNoReorder* thread = addThreadNoreorder(mol1, rmsd);
             threads.push_back(thread);
-            p->addThread(thread);
+            batch.addGeometry(mol1->getGeometry());
             m_all_structures.push_back(mol1);
 
             m_lowest_energy = mol1->Energy();
@@ -899,18 +1153,62 @@ void ConfScan::CheckOnly(double sLE, double sLI, double sLH)
             }
             continue;
         }
-        p->Reset();
         m_current_energy = mol1->Energy();
         m_dE = (m_current_energy - m_lowest_energy) * 2625.5;
 
-        bool keep_molecule = true;
+        /* references with similar energy and rotational constants are the most likely duplicates, they are compared first */
+        likelihood.resize(threads.size());
         for (int i = 0; i < threads.size(); ++i) {
-            threads[i]->setTarget(mol1);
+            const Molecule* reference = threads[i]->Reference();
+            double score = std::abs(reference->Energy() - mol1->Energy()) * 2625.5;
+            if ((m_looseThresh & 1) == 1)
+                score += (std::abs(reference->Ia() - mol1->Ia()) + std::abs(reference->Ib() - mol1->Ib()) + std::abs(reference->Ic() - mol1->Ic())) * third;
+            likelihood[i] = std::pair<double, int>(score, i);
+        }
+        std::sort(likelihood.begin(), likelihood.end());
+        ordered.resize(threads.size());
+        for (int i = 0; i < likelihood.size(); ++i)
+            ordered[i] = threads[likelihood[i].second];
+        done.assign(ordered.size(), 0);
+
+        const std::vector<double>* precalculated = nullptr;
+        if (use_batch && mol1->Atoms() == threads[0]->Reference()->Atoms()) {
+            batch.Calculate(mol1->getGeometry(), batch_rmsd);
+            ordered_rmsd.resize(ordered.size());
+            /* values close to one of the thresholds are taken from the rotated structures */
+            const double scaling[] = { 1, sLE, sLI, sLH, m_sTE, m_sTI, m_sTH };
+            for (int i = 0; i < likelihood.size(); ++i) {
+                ordered_rmsd[i] = batch_rmsd[likelihood[i].second];
+                for (double scale : scaling) {
+                    if (std::abs(ordered_rmsd[i] - scale * m_rmsd_threshold) < RMSDBatch::Accuracy) {
+                        ordered_rmsd[i] = batch.RMSD(mol1->getGeometry(), likelihood[i].second);
+                        break;
+                    }
+                }
+            }
+            precalculated = &ordered_rmsd;
         }
-        p->StaticPool();
-        p->StartAndWait();
 
-        for (auto* t : threads) {
+        std::atomic<int> next(0);
+        std::atomic<int> first(ordered.size());
+        if (m_threads > 1 && ordered.size() > 1) {
+            CxxThreadPool* pool = new CxxThreadPool;
+            pool->setProgressBar(CxxThreadPool::ProgressBarType::None);
+            pool->setActiveThreadCount(m_threads);
+            for (int i = 0; i < std::min(m_threads, int(ordered.size())); ++i)
+                pool->addThread(new ConfScanCompareWorker(&ordered, mol1, &done, &next, &first, precalculated));
+            pool->StartAndWait();
+            delete pool;
+        } else {
+            ConfScanCompareWorker worker(&ordered, mol1, &done, &next, &first, precalculated);
+            worker.execute();
+        }
+
+        /* every comparison up to the first rejecting one is done, independent of the timing of the workers */
+        bool keep_molecule = true;
+        for (int i = 0; i < ordered.size(); ++i) {
+            ConfScanThreadNoReorder* t = ordered[i];
+            m_comparisons++;
             if (!m_mapped) {
                 m_dLI = std::max(m_dLI, t->DI() * (t->RMSD() <= (sLI * m_rmsd_threshold)));
                 m_dLH = std::max(m_dLH, t->DH() * (t->RMSD() <= (sLH * m_rmsd_threshold)));
@@ -947,7 +1245,8 @@ void ConfScan::CheckOnly(double sLE, double sLI, double sLH)
         if (keep_molecule) {
             ConfScanThreadNoReorder* thread = addThreadNoreorder(mol1, rmsd);
             threads.push_back(thread);
-            p->addThread(thread);
+            use_batch = use_batch && mol1->Atoms() == threads[0]->Reference()->Atoms();
+            batch.addGeometry(mol1->getGeometry());
             AcceptMolecule(mol1);
         } else {
             RejectMolecule(mol1);
@@ -955,8 +1254,9 @@ void ConfScan::CheckOnly(double sLE, double sLI, double sLH)
         PrintStatus();
         m_all_structures.push_back(mol1);
     }
-    p->clear();
-    delete p;
+    for (auto* thread : threads)
+        delete thread;
+    fmt::print("{} RMSD calculations performed for {} structures.\n", m_comparisons, m_all_structures.size());
 }
 
 void ConfScan::PrintSetUp(double dLE, double dLI, double dLH)
@@ -1035,10 +1335,19 @@ void ConfScan::Reorder(double dLE, double dLI, double dLH, bool reuse_only, bool
         parameters_success.open(m_success_file, std::ios_base::app);
     }
 
+    /* Accepted structures outside the loose windows are not even compared, unless
+     * the skipped pairs are needed for the analysis. Threads are disabled between
+     * two structures and only the candidates are enabled. */
+    const bool use_index = !m_analyse && !(dLI <= 1e-8 && dLH <= 1e-8 && dLE <= 1e-8);
+    ConfScanIndex index(dLE, dLI, dLH, m_looseThresh);
+    std::vector<int> candidates;
+
     for (Molecule* mol1 : cached) {
         if (m_result.size() == 0) {
             AcceptMolecule(mol1);
             ConfScanThread* thread = addThread(mol1, rmsd, reuse_only);
+            thread->setEnabled(false);
+            index.addMolecule(mol1, threads.size());
             threads.push_back(thread);
             p->addThread(thread);
             m_lowest_energy = mol1->Energy();
@@ -1048,9 +1357,18 @@ void ConfScan::Reorder(double dLE, double dLI, double dLH, bool reuse_only, bool
         m_current_energy = mol1->Energy();
         m_dE = (m_current_energy - m_lowest_energy) * 2625.5;
 
+        if (use_index)
+            candidates = index.Candidates(mol1);
+        else {
+            candidates.resize(threads.size());
+            for (int t = 0; t < threads.size(); ++t)
+                candidates[t] = t;
+        }
+        m_skiped += threads.size() - candidates.size();
+
         bool keep_molecule = true;
         bool reorder = false;
-        for (int t = 0; t < threads.size(); ++t) {
+        for (int t : candidates) {
             if (CheckStop()) {
                 fmt::print("\n\n** Found stop file, will end now! **\n\n");
                 // TriggerWriteRestart();
@@ -1070,7 +1388,7 @@ void ConfScan::Reorder(double dLE, double dLI, double dLH, bool reuse_only, bool
              * energy     = 4 */
             int looseThresh = 1 * (dI < dLI) + 2 * (dH < dLH) + 4 * (std::abs(mol1->Energy() - mol2->Energy()) * 2625.5 < dLE);
             if ((looseThresh & m_looseThresh) == m_looseThresh || (dLI <= 1e-8 && dLH <= 1e-8 && dLE <= 1e-8)) {
-                if (std::find(m_exclude_list.begin(), m_exclude_list.end(), names) != m_exclude_list.end()) {
+                if (m_exclude_list.count(names)) {
                     m_duplicated++;
                     m_list_performed.push_back({ std::abs(mol1->Energy() - mol2->Energy()) * 2625.5, dH, dI });
                     continue;
@@ -1091,7 +1409,7 @@ void ConfScan::Reorder(double dLE, double dLI, double dLH, bool reuse_only, bool
                     break;
                 }
                 m_list_performed.push_back({ std::abs(mol1->Energy() - mol2->Energy()) * 2625.5, dH, dI });
-                m_exclude_list.push_back(std::pair<std::string, std::string>(mol1->Name(), mol2->Name()));
+                m_exclude_list.insert(std::pair<std::string, std::string>(mol1->Name(), mol2->Name()));
             } else {
                 threads[t]->setEnabled(false);
                 m_list_skipped.push_back({ std::abs(mol1->Energy() - mol2->Energy()) * 2625.5, dH, dI });
@@ -1105,7 +1423,9 @@ void ConfScan::Reorder(double dLE, double dLI, double dLH, bool reuse_only, bool
 
             if (free_threads < 1)
                 free_threads = 1;
-            for (int i = 0; i < threads.size(); ++i) {
+            for (int i : candidates) {
+                if (!threads[i]->isEnabled())
+                    continue;
                 threads[i]->setTarget(mol1);
                 threads[i]->setReorderRules(m_reorder_rules);
                 threads[i]->setThreads(free_threads);
@@ -1118,16 +1438,18 @@ void ConfScan::Reorder(double dLE, double dLI, double dLH, bool reuse_only, bool
                     p->StaticPool();
                 p->StartAndWait();
             } else {
-                for (auto* t : threads) {
-                    t->execute();
-                    if (t->KeepMolecule() == false)
+                for (int i : candidates) {
+                    if (!threads[i]->isEnabled())
+                        continue;
+                    threads[i]->execute();
+                    if (threads[i]->KeepMolecule() == false)
                         break;
                 }
             }
 
-            for (auto* t : threads) {
+            for (int i : candidates) {
+                ConfScanThread* t = threads[i];
                 if (!t->isEnabled()) {
-                    t->setEnabled(true);
                     m_skiped++;
                     continue;
                 }
@@ -1195,11 +1517,15 @@ void ConfScan::Reorder(double dLE, double dLI, double dLH, bool reuse_only, bool
                 }
             }
         } else
-            m_skiped += threads.size();
+            m_skiped += candidates.size();
+        for (int i : candidates)
+            threads[i]->setEnabled(false);
 
         if (keep_molecule) {
             AcceptMolecule(mol1);
             ConfScanThread* thread = addThread(mol1, rmsd, reuse_only);
+            thread->setEnabled(false);
+            index.addMolecule(mol1, threads.size());
             p->addThread(thread);
             threads.push_back(thread);
         } else {
@@ -1246,6 +1572,9 @@ void ConfScan::Finalise()
     int i = 0;
     m_collective_content += "subgraph cluster_bevor {\nrank = same;\nstyle= invis;\n";
     std::string content_after;
+    BinaryTrajectoryWriter* accepted = nullptr;
+    if (m_trajectory_format.compare("xyz") != 0)
+        accepted = new BinaryTrajectoryWriter(m_result_basename + ".accepted.ctrj", m_trajectory_format);
     for (const auto molecule : m_stored_structures) {
         double difference = abs(molecule->Energy() - m_lowest_energy) * 2625.5;
         if (i >= m_maxrank && m_maxrank != -1) {
@@ -1258,6 +1587,8 @@ void ConfScan::Finalise()
             continue;
         }
         molecule->appendXYZFile(m_accepted_filename);
+        if (accepted)
+            accepted->Write(*molecule, accepted->Frames());
         if (m_analyse) {
             std::string content = "\"" + molecule->Name() + "\" [shape=box, label=\"" + molecule->Name() + "\", fontcolor=\"orange\", fontname=\"times-bold\"];\n";
             content_after += content;
@@ -1275,6 +1606,8 @@ void ConfScan::Finalise()
         i++;
     }
 
+    delete accepted;
+
     for (const auto molecule : m_previously_accepted) {
         molecule->appendXYZFile(m_joined_filename);
     }
@@ -1327,8 +1660,7 @@ void ConfScan::writeStatisticFile(const Molecule* mol1, const Molecule* mol2, do
 {
     if (!(m_writeFiles && !m_reduced_file))
         return;
-    std::ofstream result_file;
-    result_file.open(m_statistic_filename, std::ios_base::app);
+    std::ostringstream result_file;
     if (reason)
         result_file << "Molecule got rejected due to small rmsd " << rmsd << " with and energy difference of " << std::abs(mol1->Energy() - mol2->Energy()) * 2625.5 << " kJ/mol." << std::endl;
     else
@@ -1340,7 +1672,7 @@ void ConfScan::writeStatisticFile(const Molecule* mol1, const Molecule* mol2, do
     result_file << mol1->XYZString();
     result_file << mol2->XYZString();
     result_file << std::endl;
-    result_file.close();
+    OutputBuffer::Append(m_statistic_filename, result_file.str());
 
     if (m_write && rule.size()) {
         mol1->writeXYZFile("A" + std::to_string(m_rejected) + ".xyz");
@@ -19,11 +19,15 @@
 
 #pragma once
 
+#include <atomic>
+#include <cstdint>
 #include <cstring>
 #include <fstream>
 #include <iostream>
 #include <map>
+#include <set>
 #include <string>
+#include <tuple>
 #include <vector>
 
 #include "src/capabilities/rmsd.h"
@@ -100,7 +104,9 @@ static const json ConfScanJson = {
     { "molaligntol", 10 },
     { "mapped", false },
     { "analyse", false },
-    { "cycles", -1 }
+    { "cycles", -1 },
+    { "descriptor_cache", true }, // store energies and descriptors next to the input file (.cdesc) and reuse them
+    { "trajectory_format", "xyz" } // float32, float64 or compressed write the accepted structures also as .accepted.ctrj
 };
 
 class ConfScanThread : public CxxThread {
@@ -220,6 +226,13 @@ public:
         m_target.setEnergy(molecule->Energy());
     }
 
+    /*! \brief RMSD calculated beforehand (RMSDBatch), the next execute uses it instead of running the driver */
+    void setRMSD(double rmsd)
+    {
+        m_rmsd = rmsd;
+        m_rmsd_given = true;
+    }
+
     bool KeepMolecule() const { return m_keep_molecule; }
     dnn_input getDNNInput() const
     {
@@ -227,7 +240,7 @@ public:
     }
 
 private:
-    bool m_keep_molecule = true, m_break_pool = false;
+    bool m_keep_molecule = true, m_break_pool = false, m_rmsd_given = false;
     double m_DI = 0, m_DH = 0;
     Molecule m_reference, m_target;
 
@@ -238,6 +251,109 @@ private:
     dnn_input m_input;
 };
 
+/*! \brief Compares a structure with the references of a list, most likely duplicates first
+ *
+ * Several workers share the list through next. first holds the lowest index of a
+ * rejecting comparison (initially the size of the list), only jobs behind it are
+ * skipped, so all comparisons before the first rejection are always done.
+ * done marks the finished ones.
+ * If rmsd is given, it holds the already calculated RMSD of every job.
+ */
+class ConfScanCompareWorker : public CxxThread {
+public:
+    ConfScanCompareWorker(const std::vector<ConfScanThreadNoReorder*>* jobs, const Molecule* target, std::vector<char>* done, std::atomic<int>* next, std::atomic<int>* first, const std::vector<double>* rmsd = nullptr)
+        : m_jobs(jobs)
+        , m_target(target)
+        , m_done(done)
+        , m_next(next)
+        , m_first(first)
+        , m_rmsd(rmsd)
+    {
+        setAutoDelete(true);
+    }
+    ~ConfScanCompareWorker() = default;
+
+    virtual int execute() override;
+
+private:
+    const std::vector<ConfScanThreadNoReorder*>* m_jobs;
+    const Molecule* m_target;
+    std::vector<char>* m_done;
+    std::atomic<int>* m_next;
+    std::atomic<int>* m_first;
+    const std::vector<double>* m_rmsd;
+};
+
+/*! \brief Preselection of accepted structures that may lie within the loose windows of a new one
+ *
+ * Only necessary conditions are tested: each rotational constant differs by less
+ * than 3 dLI (grid with cells of that size), the energies by less than dLE and the
+ * sums of the persistence images by less than dLH (the difference of the sums is
+ * a lower bound of the L1 difference of the images). The exact windows are still
+ * applied by the caller, the candidates are returned in the order they were added.
+ */
+class ConfScanIndex {
+public:
+    ConfScanIndex(double dLE, double dLI, double dLH, int looseThresh);
+
+    void addMolecule(const Molecule* molecule, int index);
+    std::vector<int> Candidates(const Molecule* molecule) const;
+
+private:
+    struct Entry {
+        double energy, Ia, Ib, Ic, image;
+        int index;
+    };
+    typedef std::tuple<int64_t, int64_t, int64_t> Cell;
+
+    Entry MakeEntry(const Molecule* molecule, int index) const;
+    Cell CellOf(const Entry& entry) const;
+    bool Within(const Entry& a, const Entry& b) const;
+
+    std::vector<Entry> m_entries;
+    std::map<Cell, std::vector<int>> m_grid;
+    std::multimap<double, int> m_energies;
+    double m_dLE = 0, m_dLI = 0, m_dLH = 0, m_cell = 1;
+    bool m_rotation = false, m_ripser = false, m_energy = false;
+};
+
+/*! \brief Energies and descriptors of the structures taken from a shared counter
+ *
+ * Missing energies (or all if recalculate is set) are calculated with one
+ * calculator per thread, it is only recreated if the composition changes.
+ */
+class ConfScanDescriptorThread : public CxxThread {
+public:
+    ConfScanDescriptorThread(const std::vector<Molecule*>* molecules, std::vector<double>* energies, std::atomic<int>* next, const json& controller, const json& ripser, const std::string& method, bool recalculate, int looseThresh)
+        : m_molecules(molecules)
+        , m_energies(energies)
+        , m_next(next)
+        , m_controller(controller)
+        , m_ripser(ripser)
+        , m_method(method)
+        , m_recalculate(recalculate)
+        , m_looseThresh(looseThresh)
+    {
+        setAutoDelete(false);
+    }
+    ~ConfScanDescriptorThread() = default;
+
+    virtual int execute() override;
+
+    /*! \brief Time in milliseconds spent for rotational constants and ripser images */
+    int RotationalTime() const { return m_time_rot; }
+    int RipserTime() const { return m_time_ripser; }
+
+private:
+    const std::vector<Molecule*>* m_molecules;
+    std::vector<double>* m_energies;
+    std::atomic<int>* m_next;
+    json m_controller, m_ripser;
+    std::string m_method;
+    bool m_recalculate = false;
+    int m_looseThresh = 0, m_time_rot = 0, m_time_ripser = 0;
+};
+
 class ConfScan : public CurcumaMethod {
 public:
     ConfScan(const json& controller = ConfScanJson, bool silent = true);
@@ -306,6 +422,10 @@ private:
     bool AddRules(const std::vector<int>& rules);
 
     bool openFile();
+    std::vector<Molecule*> LoadStructures(const std::string& filename, std::vector<double>& energies, int& rotational, int& ripser);
+    uint64_t DescriptorKey(const std::string& filename, bool calculated) const;
+    bool LoadDescriptorCache(const std::string& filename, uint64_t key, const std::vector<Molecule*>& molecules, std::vector<double>& energies) const;
+    void WriteDescriptorCache(const std::string& filename, uint64_t key, const std::vector<Molecule*>& molecules, const std::vector<double>& energies) const;
 
     std::vector<std::vector<int>> m_reorder_rules;
 
@@ -333,7 +453,7 @@ private:
     std::vector<Molecule*> m_result, m_rejected_structures, m_stored_structures, m_previously_accepted, m_all_structures;
     std::vector<const Molecule*> m_threshold;
     std::vector<int> m_element_templates;
-    std::vector<std::pair<std::string, std::string>> m_exclude_list;
+    std::set<std::pair<std::string, std::string>> m_exclude_list;
     StringList m_nodes_list;
     std::string m_first_node;
 #ifdef WriteMoreInfo
@@ -356,14 +476,17 @@ private:
     int m_useorders = 10;
     int m_looseThresh = 7, m_tightThresh = 3;
     std::string m_RMSDmethod = "hybrid";
+    std::string m_trajectory_format = "xyz";
     int m_MaxHTopoDiff = -1;
     int m_threads = 1;
     int m_RMSDElement = 7;
     int m_molaligntol = 10;
     int m_timing_rot = 0, m_timing_ripser = 0;
+    std::size_t m_comparisons = 0;
     int m_cycles = -1;
     int m_reorder_count = 0, m_reorder_successfull_count = 0, m_skipped_count = 0;
     bool m_writeXYZ = false;
+    bool m_descriptor_cache = true;
     bool m_check_connections = false;
     bool m_force_reorder = false, m_prevent_reorder = false;
     bool m_heavy = false;
@@ -25,6 +25,7 @@
 
 #include "src/core/fileiterator.h"
 #include "src/core/molecule.h"
+#include "src/core/outputbuffer.h"
 
 #include "src/tools/general.h"
 
@@ -139,9 +140,7 @@ std::string ConfSearch::PerformMolecularDynamics(const std::vector<Molecule*>& m
     pool->StartAndWait();
 
     std::string file = "confsearch.unique.xyz";
-    std::ofstream result_file;
-    result_file.open(file);
-    result_file.close();
+    OutputBuffer::Truncate(file);
 
     for (const auto& thread : pool->Finished()) {
         auto structures = static_cast<MDThread*>(thread)->MDDriver()->UniqueMolecules();
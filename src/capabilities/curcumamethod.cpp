@@ -19,6 +19,8 @@
 
 #include "src/global_config.h"
 
+#include "src/core/outputbuffer.h"
+
 #include "src/tools/general.h"
 
 #include <fstream>
@@ -47,6 +49,7 @@ CurcumaMethod::~CurcumaMethod()
 
 void CurcumaMethod::TriggerWriteRestart()
 {
+    OutputBuffer::FlushAll();
     std::ofstream restart_file("curcuma_restart.json");
     nlohmann::json restart;
     try {
@@ -115,24 +118,28 @@ bool CurcumaMethod::CheckStop() const
 {
 #ifdef C17
 #ifndef _WIN32
-    return std::filesystem::exists("stop");
-#endif
+    const bool result = std::filesystem::exists("stop");
+#else
     std::ifstream test_file("stop");
-    bool result = test_file.is_open();
+    const bool result = test_file.is_open();
     test_file.close();
-    return result;
+#endif
 #else
     std::ifstream test_file("stop");
-    bool result = test_file.is_open();
+    const bool result = test_file.is_open();
     test_file.close();
-    return result;
 #endif
+    if (result)
+        OutputBuffer::FlushAll();
+    return result;
 }
 
 void CurcumaMethod::getBasename(const std::string& filename)
 {
+    /* extensions differ in length (.xyz, .ctrj) */
     std::string name = std::string(filename);
-    for (int i = 0; i < 4; ++i)
-        name.pop_back();
+    const std::size_t dot = name.find_last_of('.');
+    if (dot != std::string::npos && (name.find_last_of('/') == std::string::npos || dot > name.find_last_of('/')))
+        name.erase(dot);
     m_basename = name;
 }
@@ -81,7 +81,7 @@ int SPThread::execute()
 {
     auto start = std::chrono::system_clock::now();
     Vector charges;
-    double energy = m_curcumaOpt->SinglePoint(&m_molecule, m_result, charges);
+    double energy = m_curcumaOpt->SinglePoint(&m_molecule, m_result, charges, m_calculator);
 
     m_final = m_molecule;
     m_final.setEnergy(energy);
@@ -97,9 +97,9 @@ int OptThread::execute()
 {
     Vector charges;
     if (m_optimethod == 0)
-        m_final = m_curcumaOpt->LBFGSOptimise(&m_molecule, m_result, &m_intermediate, charges, ThreadId(), Basename() + ".opt.trj");
+        m_final = m_curcumaOpt->LBFGSOptimise(&m_molecule, m_result, &m_intermediate, charges, ThreadId(), Basename() + ".opt.trj", m_calculator, &m_parameter);
     else
-        m_final = m_curcumaOpt->GPTLBFGS(&m_molecule, m_result, &m_intermediate, charges, ThreadId(), Basename() + ".opt.trj");
+        m_final = m_curcumaOpt->GPTLBFGS(&m_molecule, m_result, &m_intermediate, charges, ThreadId(), Basename() + ".opt.trj", m_calculator, &m_parameter);
 
     m_scf["e0"] = m_final.Energy();
     if (charges.size())
@@ -120,6 +120,125 @@ int OptMThread::execute()
     return 0;
 }
 
+OptWorker::OptWorker(const std::string& method, const json& controller, const std::vector<SPThread*>* jobs, std::atomic<int>* next, int id)
+    : OptWorker(
+        method, controller, [jobs, next]() -> SPThread* {
+            const int index = next->fetch_add(1);
+            return index < jobs->size() ? (*jobs)[index] : nullptr;
+        },
+        [](SPThread*) {}, id)
+{
+}
+
+OptWorker::OptWorker(const std::string& method, const json& controller, const std::function<SPThread*()>& take, const std::function<void(SPThread*)>& finish, int id)
+    : m_method(method)
+    , m_controller(controller)
+    , m_take(take)
+    , m_finish(finish)
+    , m_id(id)
+{
+    setAutoDelete(true);
+}
+
+int OptWorker::execute()
+{
+    EnergyCalculator* calculator = nullptr;
+    std::vector<int> elements;
+    int charge = 0, spin = 0;
+    for (SPThread* job = m_take(); job != nullptr; job = m_take()) {
+        const Molecule& molecule = job->Input();
+        if (calculator == nullptr || molecule.Atoms() != elements || molecule.Charge() != charge || molecule.Spin() != spin) {
+            delete calculator;
+            calculator = new EnergyCalculator(m_method, m_controller);
+            elements = molecule.Atoms();
+            charge = molecule.Charge();
+            spin = molecule.Spin();
+        }
+        job->setThreadId(m_id);
+        job->setCalculator(calculator);
+        job->execute();
+        job->setCalculator(nullptr);
+        m_finish(job);
+    }
+    delete calculator;
+    return 0;
+}
+
+SPThread* OptStream::Take()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    changed.wait(lock, [this]() { return !pending.empty() || end; });
+    if (pending.empty())
+        return nullptr;
+    SPThread* job = pending.front();
+    pending.pop_front();
+    return job;
+}
+
+void OptStream::Finish(SPThread* job)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    done[job->Index()] = job;
+    changed.notify_all();
+}
+
+OptStreamThread::OptStreamThread(CurcumaOpt* curcumaOpt, FileIterator* file, OptStream* stream, int charge, int spin)
+    : m_curcumaOpt(curcumaOpt)
+    , m_file(file)
+    , m_stream(stream)
+    , m_charge(charge)
+    , m_spin(spin)
+{
+    setAutoDelete(true);
+}
+
+int OptStreamThread::execute()
+{
+    while (true) {
+        SPThread* result = nullptr;
+        {
+            std::unique_lock<std::mutex> lock(m_stream->mutex);
+            m_stream->changed.wait(lock, [this]() {
+                return m_stream->done.count(m_stream->written) || (!m_stream->end && m_stream->read - m_stream->written < m_stream->capacity) || (m_stream->end && m_stream->written == m_stream->read);
+            });
+            auto next = m_stream->done.find(m_stream->written);
+            if (next != m_stream->done.end()) {
+                result = next->second;
+                m_stream->done.erase(next);
+            } else if (m_stream->end)
+                break;
+        }
+
+        if (result) {
+            /* written outside of the lock, the workers go on in the meantime */
+            m_curcumaOpt->WriteResult(result);
+            delete result;
+            std::lock_guard<std::mutex> lock(m_stream->mutex);
+            m_stream->written++;
+            continue;
+        }
+
+        SPThread* job = nullptr;
+        while (job == nullptr && !m_file->AtEnd()) {
+            Molecule molecule = m_file->Next();
+            if (molecule.AtomCount() == 0)
+                continue;
+            molecule.setCharge(m_charge);
+            molecule.setSpin(m_spin);
+            job = m_curcumaOpt->CreateJob(molecule);
+        }
+
+        std::lock_guard<std::mutex> lock(m_stream->mutex);
+        if (job) {
+            job->setIndex(m_stream->read++);
+            m_stream->pending.push_back(job);
+        } else
+            m_stream->end = true;
+        m_stream->changed.notify_all();
+    }
+    return 0;
+}
+
 CurcumaOpt::CurcumaOpt(const json& controller, bool silent)
     : CurcumaMethod(CurcumaOptJson, controller, silent)
 {
@@ -141,6 +260,9 @@ void CurcumaOpt::LoadControlJson()
     m_spin = Json2KeyWord<double>(m_defaults, "Spin");
     m_singlepoint = Json2KeyWord<bool>(m_defaults, "SinglePoint");
     m_serial = Json2KeyWord<bool>(m_defaults, "serial");
+    m_persistent_calculator = Json2KeyWord<bool>(m_defaults, "persistent_calculator");
+    m_streaming = Json2KeyWord<bool>(m_defaults, "streaming");
+    m_stream_window = Json2KeyWord<int>(m_defaults, "stream_window");
     m_hessian = Json2KeyWord<int>(m_defaults, "hessian");
     m_optH = Json2KeyWord<bool>(m_defaults, "optH");
     m_maxiter = Json2KeyWord<int>(m_defaults, "maxiter");
@@ -168,6 +290,11 @@ void CurcumaOpt::LoadControlJson()
 
 void CurcumaOpt::start()
 {
+    if (m_file_set && !m_serial && m_streaming && m_persistent_calculator) {
+        getBasename(m_filename);
+        ProcessFileStreaming();
+        return;
+    }
     if (m_file_set) {
         getBasename(m_filename);
         FileIterator file(m_filename);
@@ -246,7 +373,7 @@ void CurcumaOpt::ProcessMolecules(const std::vector<Molecule>& molecules)
     int threads = m_threads;
 
     CxxThreadPool* pool = new CxxThreadPool;
-    pool->setProgressBar(CxxThreadPool::ProgressBarType::Continously);
+    pool->setProgressBar(m_persistent_calculator ? CxxThreadPool::ProgressBarType::None : CxxThreadPool::ProgressBarType::Continously);
     pool->setActiveThreadCount(threads);
     pool->StaticPool();
     std::vector<SPThread*> thread_block;
@@ -258,70 +385,125 @@ void CurcumaOpt::ProcessMolecules(const std::vector<Molecule>& molecules)
             if (iter->AtomCount() == 0)
                 continue;
 
-            SPThread* th;
-            if (!m_singlepoint) {
-                th = new OptThread(this);
-                th->setOptiMethod(m_optimethod);
-            } else
-                th = new SPThread(this);
-
-            th->setBaseName(Basename());
-
-            th->setMolecule(*iter);
+            SPThread* th = CreateJob(*iter);
+            th->setIndex(thread_block.size());
             th->setThreadId(i);
             thread_block.push_back(th);
-            pool->addThread(th);
+            if (!m_persistent_calculator)
+                pool->addThread(th);
 
             ++iter;
         }
     }
+
+    /* the jobs are only containers here, they are run by the workers, each with its own calculator */
+    std::atomic<int> next(0);
+    if (m_persistent_calculator) {
+        for (int i = 0; i < std::min(threads, int(thread_block.size())); ++i)
+            pool->addThread(new OptWorker(m_method, m_controller, &thread_block, &next, i));
+    }
     pool->StartAndWait();
-    m_molecules.clear();
-    for (auto t : pool->OrderedList()) {
-        const SPThread* thread = static_cast<const SPThread*>(t.second);
-        if (!thread->Finished()) {
-            std::cout << " not finished " << thread->getMolecule().Energy() << std::endl;
-            continue;
+
+    std::vector<const SPThread*> finished;
+    if (m_persistent_calculator) {
+        for (const SPThread* thread : thread_block)
+            finished.push_back(thread);
+    } else {
+        for (auto t : pool->OrderedList()) {
+            const SPThread* thread = static_cast<const SPThread*>(t.second);
+            if (!thread->Finished()) {
+                std::cout << " not finished " << thread->getMolecule().Energy() << std::endl;
+                continue;
+            }
+            finished.push_back(thread);
         }
-        // if (m_threads > 1)
-        std::cout << thread->Output();
+    }
 
-        Molecule* mol2 = new Molecule(thread->getMolecule());
-        if (m_hessian) {
-            std::cout << m_defaults << std::endl;
-            Hessian hess(m_method, m_defaults, false);
-            hess.setParameter(m_parameters);
-            hess.setMolecule(mol2);
-            hess.CalculateHessian(m_hessian);
-            auto hessian = hess.getHessian();
-            std::string hessian_string = Tools::Matrix2String(hessian);
+    m_molecules.clear();
+    for (const SPThread* thread : finished)
+        WriteResult(thread);
+    delete pool;
+    if (m_persistent_calculator) {
+        for (SPThread* thread : thread_block)
+            delete thread;
+    }
+}
 
-            json hjson;
-            hjson["atoms"] = hessian.cols() / 3;
-            hjson["hessian"] = hessian_string;
-            std::ofstream hess_file("hessian.json");
-            hess_file << hjson;
+void CurcumaOpt::ProcessFileStreaming()
+{
+    const int threads = std::max(1, m_threads);
 
-            std::ofstream scffile("scf.json");
-            scffile << thread->SCF();
-        }
-        if (!m_singlepoint)
-            mol2->appendXYZFile(Optfile());
-        m_molecules.push_back(Molecule(mol2));
-        if (m_writeXYZ) {
-            for (const auto& m : *(thread->Intermediates()))
-                m.appendXYZFile(Trjfile());
-        }
-    }
+    FileIterator file(m_filename);
+    m_molecules.clear();
+    OptStream stream;
+    stream.capacity = m_stream_window > 0 ? m_stream_window : 4 * threads;
+
+    /* the reader/writer thread has to run at the same time as all workers */
+    CxxThreadPool* pool = new CxxThreadPool;
+    pool->setProgressBar(CxxThreadPool::ProgressBarType::None);
+    pool->setActiveThreadCount(threads + 1);
+    pool->StaticPool();
+    pool->addThread(new OptStreamThread(this, &file, &stream, m_charge, m_spin));
+    for (int i = 0; i < threads; ++i)
+        pool->addThread(new OptWorker(
+            m_method, m_controller, [&stream]() { return stream.Take(); }, [&stream](SPThread* job) { stream.Finish(job); }, i));
+    pool->StartAndWait();
     delete pool;
 }
 
+SPThread* CurcumaOpt::CreateJob(const Molecule& molecule)
+{
+    SPThread* job;
+    if (!m_singlepoint) {
+        job = new OptThread(this);
+        job->setOptiMethod(m_optimethod);
+    } else
+        job = new SPThread(this);
+
+    job->setBaseName(Basename());
+    job->setMolecule(molecule);
+    return job;
+}
+
+void CurcumaOpt::WriteResult(const SPThread* thread)
+{
+    // if (m_threads > 1)
+    std::cout << thread->Output();
+
+    Molecule mol2(thread->getMolecule());
+    if (m_hessian) {
+        std::cout << m_defaults << std::endl;
+        Hessian hess(m_method, m_defaults, false);
+        hess.setParameter(thread->Parameter());
+        hess.setMolecule(mol2);
+        hess.CalculateHessian(m_hessian);
+        auto hessian = hess.getHessian();
+        std::string hessian_string = Tools::Matrix2String(hessian);
+
+        json hjson;
+        hjson["atoms"] = hessian.cols() / 3;
+        hjson["hessian"] = hessian_string;
+        std::ofstream hess_file("hessian.json");
+        hess_file << hjson;
+
+        std::ofstream scffile("scf.json");
+        scffile << thread->SCF();
+    }
+    if (!m_singlepoint)
+        mol2.appendXYZFile(Optfile());
+    m_molecules.push_back(mol2);
+    if (m_writeXYZ) {
+        for (const auto& m : *(thread->Intermediates()))
+            m.appendXYZFile(Trjfile());
+    }
+}
+
 void CurcumaOpt::clear()
 {
     m_molecules.clear();
 }
 
-double CurcumaOpt::SinglePoint(const Molecule* initial, std::string& output, Vector& charges)
+double CurcumaOpt::SinglePoint(const Molecule* initial, std::string& output, Vector& charges, EnergyCalculator* calculator)
 {
     std::string method = m_method; // Json2KeyWord<std::string>(m_controller, "method");
 
@@ -336,7 +518,8 @@ double CurcumaOpt::SinglePoint(const Molecule* initial, std::string& output, Vec
         parameter(3 * i + 2) = geometry(i, 2);
     }
 
-    EnergyCalculator interface(method, m_controller);
+    EnergyCalculator* own = calculator ? nullptr : new EnergyCalculator(method, m_controller);
+    EnergyCalculator& interface = calculator ? *calculator : *own;
     interface.setMolecule(initial->getMolInfo());
     json param = interface.Parameter();
     double energy = interface.CalculateEnergy(true, true);
@@ -357,6 +540,7 @@ double CurcumaOpt::SinglePoint(const Molecule* initial, std::string& output, Vec
         WriteMO(m_mo_homo, m_mo_lumo);
         WriteMOAscii();
     }
+    delete own;
     return energy;
 }
 
@@ -412,7 +596,7 @@ void CurcumaOpt::WriteMOAscii()
     }
 }
 
-Molecule CurcumaOpt::LBFGSOptimise(Molecule* initial, std::string& output, std::vector<Molecule>* intermediate, Vector& charges, int thread, const std::string& basename)
+Molecule CurcumaOpt::LBFGSOptimise(Molecule* initial, std::string& output, std::vector<Molecule>* intermediate, Vector& charges, int thread, const std::string& basename, EnergyCalculator* calculator, json* ff_parameter)
 {
     std::vector<int> constrain;
     Geometry geometry = initial->getGeometry();
@@ -429,10 +613,12 @@ Molecule CurcumaOpt::LBFGSOptimise(Molecule* initial, std::string& output, std::
         constrain.push_back(initial->Atom(i).first == 1);
     }
 
-    EnergyCalculator interface(m_method, m_controller);
+    EnergyCalculator* own = calculator ? nullptr : new EnergyCalculator(m_method, m_controller);
+    EnergyCalculator& interface = calculator ? *calculator : *own;
 
     interface.setMolecule(initial->getMolInfo());
-    m_parameters = interface.Parameter();
+    if (ff_parameter)
+        *ff_parameter = interface.Parameter();
     double final_energy = interface.CalculateEnergy(true);
     initial->setEnergy(final_energy);
     initial->writeXYZFile(basename + ".t" + std::to_string(thread) + ".xyz");
@@ -673,10 +859,11 @@ Molecule CurcumaOpt::LBFGSOptimise(Molecule* initial, std::string& output, std::
         previous.setEnergy(final_energy);
         previous.setGeometry(geometry);
     }
+    delete own;
     return previous;
 }
 
-Molecule CurcumaOpt::GPTLBFGS(Molecule* initial, std::string& output, std::vector<Molecule>* intermediate, Vector& charges, int thread, const std::string& basename)
+Molecule CurcumaOpt::GPTLBFGS(Molecule* initial, std::string& output, std::vector<Molecule>* intermediate, Vector& charges, int thread, const std::string& basename, EnergyCalculator* calculator, json* ff_parameter)
 {
     std::vector<int> constrain;
     Geometry geometry = initial->getGeometry();
@@ -693,10 +880,12 @@ Molecule CurcumaOpt::GPTLBFGS(Molecule* initial, std::string& output, std::vecto
         constrain.push_back(initial->Atom(i).first == 1);
     }
 
-    EnergyCalculator interface(m_method, m_controller);
+    EnergyCalculator* own = calculator ? nullptr : new EnergyCalculator(m_method, m_controller);
+    EnergyCalculator& interface = calculator ? *calculator : *own;
 
     interface.setMolecule(initial->getMolInfo());
-    m_parameters = interface.Parameter();
+    if (ff_parameter)
+        *ff_parameter = interface.Parameter();
     double final_energy = interface.CalculateEnergy(true);
     initial->setEnergy(final_energy);
     initial->writeXYZFile(basename + ".t" + std::to_string(thread) + ".xyz");
@@ -932,5 +1121,6 @@ Molecule CurcumaOpt::GPTLBFGS(Molecule* initial, std::string& output, std::vecto
         previous.setEnergy(final_energy);
         previous.setGeometry(geometry);
     }
+    delete own;
     return previous;
 }
@@ -20,6 +20,7 @@
 #pragma once
 
 #include "src/core/energycalculator.h"
+#include "src/core/outputbuffer.h"
 
 #include "src/capabilities/optimiser/lbfgs.h"
 
@@ -28,9 +29,17 @@
 #include <LBFGS.h>
 #include <LBFGSB.h>
 
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <map>
+#include <mutex>
+
 #include "curcumamethod.h"
 
 class CurcumaOpt;
+class FileIterator;
 
 static json CurcumaOptJson{
     { "writeXYZ", true },
@@ -59,6 +68,9 @@ static json CurcumaOptJson{
     { "SinglePoint", false },
     { "optH", false },
     { "serial", false },
+    { "persistent_calculator", true },
+    { "streaming", true },
+    { "stream_window", 0 },
     { "hessian", 0 },
     { "fusion", false },
     { "maxrise", 100 },
@@ -128,6 +140,7 @@ public:
 
     inline void setMolecule(const Molecule& molecule) { m_molecule = molecule; }
     inline Molecule getMolecule() const { return m_final; }
+    inline const Molecule& Input() const { return m_molecule; }
     virtual int execute() override;
 
     //  inline void setController(const json& controller) { m_controller = controller; }
@@ -135,18 +148,27 @@ public:
     const std::vector<Molecule>* Intermediates() const { return &m_intermediate; }
     void setBaseName(const std::string& basename) { m_basename = basename; }
     std::string Basename() const { return m_basename; }
-    // inline json Parameter() const { return m_param; }
+    inline json Parameter() const { return m_parameter; }
     inline json SCF() const { return m_scf; }
     void setOptiMethod(int method) { m_optimethod = method; }
 
+    /*! \brief Use this calculator instead of creating a new one, the molecule is set on it */
+    void setCalculator(EnergyCalculator* calculator) { m_calculator = calculator; }
+
+    /*! \brief Position of the structure in the input, used to write the results in order */
+    void setIndex(int index) { m_index = index; }
+    int Index() const { return m_index; }
+
 protected:
     std::string m_result;
     Molecule m_molecule, m_final;
-    json m_scf;
+    json m_scf, m_parameter;
     std::vector<Molecule> m_intermediate;
     std::string m_basename;
     CurcumaOpt* m_curcumaOpt;
+    EnergyCalculator* m_calculator = nullptr;
     int m_optimethod = 0;
+    int m_index = 0;
 };
 
 class OptThread : public SPThread {
@@ -178,6 +200,63 @@ private:
     std::vector<Molecule> m_molecules, m_finals;
 };
 
+/*! \brief Long-lived worker for batch single points and optimisations
+ *
+ * Every worker keeps one EnergyCalculator and asks for the next job until it gets
+ * none. The calculator is only created again if charge, spin or the elements
+ * of the next structure differ, otherwise setMolecule is called on the existing one.
+ */
+class OptWorker : public CxxThread {
+public:
+    /*! \brief Take the jobs of a fixed list, using a shared counter */
+    OptWorker(const std::string& method, const json& controller, const std::vector<SPThread*>* jobs, std::atomic<int>* next, int id);
+
+    /*! \brief take returns the next job or nullptr if there is none left, finish is called for every done job */
+    OptWorker(const std::string& method, const json& controller, const std::function<SPThread*()>& take, const std::function<void(SPThread*)>& finish, int id);
+    ~OptWorker() = default;
+
+    int execute() override;
+
+private:
+    std::string m_method;
+    json m_controller;
+    std::function<SPThread*()> m_take;
+    std::function<void(SPThread*)> m_finish;
+    int m_id = 0;
+};
+
+/*! \brief Bounded hand-over between reading, optimising and writing of a streamed batch
+ *
+ * At most capacity structures are between reading and writing at any time,
+ * pending ones wait for a worker, done ones wait for their turn to be written.
+ */
+struct OptStream {
+    std::mutex mutex;
+    std::condition_variable changed;
+    std::deque<SPThread*> pending;
+    std::map<int, SPThread*> done;
+    int read = 0, written = 0, capacity = 1;
+    bool end = false;
+
+    SPThread* Take();
+    void Finish(SPThread* job);
+};
+
+/*! \brief Reader and writer stage of a streamed batch, runs next to the OptWorkers */
+class OptStreamThread : public CxxThread {
+public:
+    OptStreamThread(CurcumaOpt* curcumaOpt, FileIterator* file, OptStream* stream, int charge, int spin);
+    ~OptStreamThread() = default;
+
+    int execute() override;
+
+private:
+    CurcumaOpt* m_curcumaOpt;
+    FileIterator* m_file;
+    OptStream* m_stream;
+    int m_charge = 0, m_spin = 0;
+};
+
 class CurcumaOpt : public CurcumaMethod {
 public:
     CurcumaOpt(const json& controller, bool silent);
@@ -187,13 +266,8 @@ public:
         m_filename = filename;
 
         getBasename(filename);
-        std::ofstream tfile1;
-        tfile1.open(Optfile());
-        tfile1.close();
-
-        std::ofstream tfile2;
-        tfile2.open(Trjfile());
-        tfile2.close();
+        OutputBuffer::Truncate(Optfile());
+        OutputBuffer::Truncate(Trjfile());
 
         m_file_set = true;
         m_mol_set = false;
@@ -229,12 +303,20 @@ public:
     void setSinglePoint(bool sp) { m_singlepoint = sp; }
     inline const std::vector<Molecule>* Molecules() const { return &m_molecules; }
 
-    Molecule LBFGSOptimise(Molecule* host, std::string& output, std::vector<Molecule>* intermediate, Vector& charges, int thread = -1, const std::string& basename = "base");
-    Molecule GPTLBFGS(Molecule* host, std::string& output, std::vector<Molecule>* intermediate, Vector& charges, int thread = -1, const std::string& basename = "base");
+    /* ff_parameter (optional) receives the parameters of the calculator, as used for a later Hessian */
+    Molecule LBFGSOptimise(Molecule* host, std::string& output, std::vector<Molecule>* intermediate, Vector& charges, int thread = -1, const std::string& basename = "base", EnergyCalculator* calculator = nullptr, json* ff_parameter = nullptr);
+    Molecule GPTLBFGS(Molecule* host, std::string& output, std::vector<Molecule>* intermediate, Vector& charges, int thread = -1, const std::string& basename = "base", EnergyCalculator* calculator = nullptr, json* ff_parameter = nullptr);
 
-    double SinglePoint(const Molecule* initial, std::string& output, Vector& charges);
+    double SinglePoint(const Molecule* initial, std::string& output, Vector& charges, EnergyCalculator* calculator = nullptr);
 
     void clear();
+
+    /*! \brief Single point or optimisation job for one structure, depending on the controller */
+    SPThread* CreateJob(const Molecule& molecule);
+
+    /*! \brief Print and write the result of one finished job, the final structure is stored in Molecules() */
+    void WriteResult(const SPThread* thread);
+
     void WriteMO(int n, int m);
     void WriteMOAscii();
 
@@ -255,11 +337,11 @@ private:
 
     void ProcessMolecules(const std::vector<Molecule>& molecule);
     void ProcessMoleculesSerial(const std::vector<Molecule>& molecule);
+    void ProcessFileStreaming();
 
     std::string m_filename;
     std::string m_method = "UFF";
     Molecule m_molecule;
-    json m_parameters;
     std::vector<Molecule> m_molecules;
     Vector m_orbital_energies;
     Matrix m_molecular_orbitals;
@@ -271,5 +353,7 @@ private:
     double m_dE = 0.1, m_dRMSD = 0.01, m_maxenergy = 100, m_GradNorm = 1e-5, m_lambda = 0.1, m_mo_scale = 1.0;
     int m_charge = 0, m_spin = 0;
     int m_serial = false;
+    bool m_persistent_calculator = true, m_streaming = true;
+    int m_stream_window = 0;
     int m_maxiter = 100, m_maxrise = 10, m_optimethod = 1, m_diis_hist = 10, m_diis_start = 10;
 };
@@ -25,28 +25,15 @@
 
 #include "hessian.h"
 
-HessianThread::HessianThread(const json& controller, int i, int j, int xi, int xj, bool fullnumerical)
+HessianThread::HessianThread(const json& controller, int i, int j, int xi, int xj)
     : m_controller(controller)
     , m_i(i)
     , m_j(j)
     , m_xi(xi)
     , m_xj(xj)
-    , m_fullnumerical(fullnumerical)
 {
     setAutoDelete(true);
     m_method = m_controller["method"];
-    if (i == j && xi == i && xj == i && i == 0)
-        m_schema = [this]() {
-            this->Threaded();
-        };
-    else if (m_fullnumerical)
-        m_schema = [this, i, j, xi, xj]() {
-            this->Numerical();
-        };
-    else
-        m_schema = [this]() {
-            this->Seminumerical();
-        };
 }
 
 HessianThread::~HessianThread()
@@ -60,7 +47,7 @@ void HessianThread::setMolecule(const Molecule& molecule)
 
 int HessianThread::execute()
 {
-    m_schema();
+    Numerical();
     return 0;
 }
 
@@ -102,63 +89,56 @@ void HessianThread::Numerical()
     double energy_im_jm = energy.CalculateEnergy(false, false);
     m_dd = d2 * (energy_ip_jp - energy_im_jp - energy_ip_jm + energy_im_jm);
 }
-void HessianThread::Seminumerical()
-{
-    m_geom_ip_jp = m_molecule.Coords();
-    m_geom_im_jp = m_molecule.Coords();
 
-    m_geom_ip_jp(m_i, m_xi) += m_d;
-    EnergyCalculator energy(m_method, m_controller);
-    energy.setParameter(m_parameter);
-    energy.setMolecule(m_molecule.getMolInfo());
-
-    energy.updateGeometry(m_geom_ip_jp);
-    energy.CalculateEnergy(true, false);
-    Matrix gradientp = energy.Gradient();
-
-    m_geom_im_jp(m_i, m_xi) -= m_d;
-
-    energy.updateGeometry(m_geom_im_jp);
-    energy.CalculateEnergy(true, false);
-    Matrix gradientm = energy.Gradient();
-    m_gradient = (gradientp - gradientm) / (2 * m_d);
+HessianWorker::HessianWorker(const json& controller, const std::string& method, const json& parameter, const Molecule* molecule, std::atomic<int>* next, Matrix* hessian, EnergyCalculator* energy)
+    : m_controller(controller)
+    , m_parameter(parameter)
+    , m_method(method)
+    , m_molecule(molecule)
+    , m_next(next)
+    , m_hessian(hessian)
+    , m_energy(energy)
+{
+    setAutoDelete(true);
 }
 
-void HessianThread::Threaded()
+int HessianWorker::execute()
 {
-    m_hessian = Eigen::MatrixXd::Zero(3 * m_molecule.AtomCount(), 3 * m_molecule.AtomCount());
-
-    EnergyCalculator energy(m_method, m_controller);
-    // std::cout << m_method << m_controller << std::endl;
-    energy.setParameter(m_parameter);
-    energy.setMolecule(m_molecule.getMolInfo());
-    for (int i : m_atoms) {
-        for (int xi = 0; xi < 3; ++xi) {
-
-            m_geom_ip_jp = m_molecule.Coords();
-            m_geom_im_jp = m_molecule.Coords();
-            m_geom_ip_jp(i, xi) += m_d;
-
-            energy.updateGeometry(m_geom_ip_jp);
-            energy.CalculateEnergy(true, false);
-            Matrix gradientp = energy.Gradient();
-
-            m_geom_im_jp(i, xi) -= m_d;
-
-            energy.updateGeometry(m_geom_im_jp);
-            energy.CalculateEnergy(true, false);
-            Matrix gradientm = energy.Gradient();
-            m_gradient = (gradientp - gradientm) / (2 * m_d);
+    const int size = 3 * m_molecule->AtomCount();
+    if (m_next->load() >= size)
+        return 0;
+
+    EnergyCalculator* energy = m_energy;
+    if (!energy) {
+        energy = new EnergyCalculator(m_method, m_controller);
+        energy->setParameter(m_parameter);
+        energy->setMolecule(m_molecule->getMolInfo());
+    }
 
-            for (int j = 0; j < m_gradient.rows(); ++j) {
-                for (int k = 0; k < m_gradient.cols(); ++k) {
-                    m_hessian(3 * i + xi, 3 * j + k) = m_gradient(j, k);
-                }
-            }
-        }
+    Geometry geometry = m_molecule->Coords();
+    for (int row = m_next->fetch_add(1); row < size; row = m_next->fetch_add(1)) {
+        const int i = row / 3;
+        const int xi = row % 3;
+        const double origin = geometry(i, xi);
+
+        geometry(i, xi) = origin + m_d;
+        energy->updateGeometry(geometry);
+        energy->CalculateEnergy(true, false);
+        Matrix gradientp = energy->Gradient();
+
+        geometry(i, xi) = origin - m_d;
+        energy->updateGeometry(geometry);
+        energy->CalculateEnergy(true, false);
+        Matrix gradientm = energy->Gradient();
+
+        geometry(i, xi) = origin;
+        for (int j = 0; j < gradientp.rows(); ++j)
+            for (int k = 0; k < 3; ++k)
+                (*m_hessian)(row, 3 * j + k) = (gradientp(j, k) - gradientm(j, k)) / (2 * m_d);
     }
-    // std::cout << "intermediate hessians" << std::endl;
-    // std::cout << std::endl << m_hessian << std::endl << std::endl;
+    if (energy != m_energy)
+        delete energy;
+    return 0;
 }
 
 Hessian::Hessian(const std::string& method, const json& controller, bool silent)
@@ -224,6 +204,7 @@ void Hessian::LoadControlJson()
     m_thermo = Json2KeyWord<double>(m_controller, "thermo");
     m_freq_cutoff = Json2KeyWord<double>(m_controller, "freq_cutoff");
     m_hess = Json2KeyWord<int>(m_controller, "hess");
+    m_hess_analytic = Json2KeyWord<bool>(m_controller, "hess_analytic");
     m_method = Json2KeyWord<std::string>(m_controller, "method");
     // m_threads = Json2KeyWord<int>(m_controller, "threads");
     m_threads = m_controller["threads"];
@@ -284,12 +265,17 @@ void Hessian::start()
 {
     if (m_hess_calc) {
 
-        if (m_hess == 1) {
-            CalculateHessianThreaded();
-        } else if (m_hess == 2) {
+        if (m_hess == 2) {
             CalculateHessianNumerical();
         } else {
-            CalculateHessianSemiNumerical();
+            /* force fields assemble their second derivatives directly, for all other methods
+             * the calculator is handed to the first seminumerical worker */
+            EnergyCalculator* energy = new EnergyCalculator(m_method, m_controller);
+            energy->setParameter(m_parameter);
+            energy->setMolecule(m_molecule.getMolInfo());
+            if (!(m_hess_analytic && CalculateHessianAnalytic(energy)))
+                CalculateHessianSemiNumerical(energy);
+            delete energy;
         }
     } else {
         LoadMolecule(m_read_xyz);
@@ -409,63 +395,15 @@ void Hessian::PrintVibrations(Vector& eigenvalues, const Vector& projected)
     std::cout << std::endl;
 }
 
-void Hessian::CalculateHessianThreaded()
+bool Hessian::CalculateHessianAnalytic(EnergyCalculator* energy)
 {
-    m_hessian = Eigen::MatrixXd::Zero(3 * m_molecule.AtomCount(), 3 * m_molecule.AtomCount());
-
-    CxxThreadPool* pool = new CxxThreadPool;
-    pool->setActiveThreadCount(m_threads);
-    if (m_silent)
-        pool->setProgressBar(CxxThreadPool::ProgressBarType::None);
-    else
-        std::cout << "Starting Hessian" << std::endl;
-
-    std::vector<int> atoms;
-    if (m_threads > m_molecule.AtomCount())
-        m_threads = m_molecule.AtomCount();
-    if (m_method.compare("gfnff") == 0) {
-        m_threads = 1;
-        std::cout << "GFN-FF enforces single thread approach" << std::endl;
-    }
-    std::vector<std::vector<int>> threads(m_threads);
-
-    for (int i = 0; i < m_molecule.AtomCount(); ++i) {
-        atoms.push_back(i);
-        threads[i % m_threads].push_back(i);
-    }
-
-    for (int i = 0; i < threads.size(); ++i) {
-        HessianThread* thread = new HessianThread(m_controller, 0, 0, 0, 0, true);
-        thread->setMethod(m_method);
-        thread->setMolecule(m_molecule);
-        thread->setParameter(m_parameter);
-        thread->setIndices(threads[i]);
-        pool->addThread(thread);
-    }
-
-    pool->StaticPool();
-    pool->StartAndWait();
-    int i = 0;
-    for (auto* t : pool->Finished()) {
-        HessianThread* thread = static_cast<HessianThread*>(t);
-        m_hessian += thread->getHessian();
-        ++i;
-    }
-
-    delete pool;
+    if (!energy->HasAnalyticHessian())
+        return false;
+    if (!m_silent)
+        std::cout << "Starting Analytic Hessian" << std::endl;
 
-    for (int i = 0; i < m_molecule.AtomCount(); ++i) {
-        for (int j = 0; j < m_molecule.AtomCount(); ++j) {
-            double mass = 1 / sqrt(Elements::AtomicMass[m_molecule.Atoms()[i]] * Elements::AtomicMass[m_molecule.Atoms()[j]]);
-            for (int xi = 0; xi < 3; ++xi) {
-                for (int xj = 0; xj < 3; ++xj) {
-                    double value = (m_hessian(3 * i + xi, 3 * j + xj) + m_hessian(3 * j + xj, 3 * i + xi)) / 2.0;
-                    m_hessian(3 * i + xi, 3 * j + xj) = value;
-                    m_hessian(3 * j + xj, 3 * i + xi) = value;
-                }
-            }
-        }
-    }
+    m_hessian = energy->AnalyticHessian().toDense();
+    return true;
 }
 
 void Hessian::CalculateHessianNumerical()
@@ -483,7 +421,7 @@ void Hessian::CalculateHessianNumerical()
         for (/*const auto j : m_atoms_j */ int j = 0; j < m_molecule.AtomCount(); ++j) {
             for (int xi = 0; xi < 3; ++xi)
                 for (int xj = 0; xj < 3; ++xj) {
-                    HessianThread* thread = new HessianThread(m_controller, i, j, xi, xj, true);
+                    HessianThread* thread = new HessianThread(m_controller, i, j, xi, xj);
                     thread->setMolecule(m_molecule);
                     thread->setParameter(m_parameter);
                     pool->addThread(thread);
@@ -501,51 +439,38 @@ void Hessian::CalculateHessianNumerical()
     delete pool;
 }
 
-void Hessian::CalculateHessianSemiNumerical()
+void Hessian::CalculateHessianSemiNumerical(EnergyCalculator* energy)
 {
-    m_hessian = Eigen::MatrixXd::Zero(3 * m_molecule.AtomCount(), 3 * m_molecule.AtomCount());
+    const int size = 3 * m_molecule.AtomCount();
+    m_hessian = Eigen::MatrixXd::Zero(size, size);
+
+    int threads = std::max(1, std::min(m_threads, size));
+    if (m_method.compare("gfnff") == 0) {
+        threads = 1;
+        std::cout << "GFN-FF enforces single thread approach" << std::endl;
+    }
 
     CxxThreadPool* pool = new CxxThreadPool;
-    pool->setActiveThreadCount(m_threads);
+    pool->setActiveThreadCount(threads);
     if (m_silent)
         pool->setProgressBar(CxxThreadPool::ProgressBarType::None);
     else
-        std::cout << "Starting Seminumerical Hessian Calculation" << std::endl;
-
-    for (/*auto int i : m_atoms_i */ int i = 0; i < m_molecule.AtomCount(); ++i) {
-        for (int xi = 0; xi < 3; ++xi) {
-            HessianThread* thread = new HessianThread(m_controller, i, 0, xi, 0, false);
-            thread->setMolecule(m_molecule);
-            thread->setParameter(m_parameter);
-            pool->addThread(thread);
-        }
-    }
-    pool->DynamicPool(2);
-    pool->StartAndWait();
+        std::cout << "Starting Seminumerical Hessian Calculation (" << 2 * size << " gradients on " << threads << " threads)" << std::endl;
 
-    for (auto* t : pool->Finished()) {
-        HessianThread* thread = static_cast<HessianThread*>(t);
-        int i = thread->I();
-        int xi = thread->XI();
-        Matrix gradient = thread->Gradient();
-        for (int j = 0; j < gradient.rows(); ++j) {
-            for (int k = 0; k < gradient.cols(); ++k) {
-                m_hessian(3 * i + xi, 3 * j + k) = thread->Gradient()(j, k);
-            }
-        }
+    std::atomic<int> next(0);
+    for (int i = 0; i < threads; ++i) {
+        HessianWorker* worker = new HessianWorker(m_controller, m_method, m_parameter, &m_molecule, &next, &m_hessian, i == 0 ? energy : nullptr);
+        pool->addThread(worker);
     }
+    pool->StaticPool();
+    pool->StartAndWait();
+    delete pool;
 
-    for (int i = 0; i < m_molecule.AtomCount(); ++i) {
-        for (int j = 0; j < m_molecule.AtomCount(); ++j) {
-            double mass = 1 / sqrt(Elements::AtomicMass[m_molecule.Atoms()[i]] * Elements::AtomicMass[m_molecule.Atoms()[j]]);
-            for (int xi = 0; xi < 3; ++xi) {
-                for (int xj = 0; xj < 3; ++xj) {
-                    double value = (m_hessian(3 * i + xi, 3 * j + xj) + m_hessian(3 * j + xj, 3 * i + xi)) / 2.0;
-                    m_hessian(3 * i + xi, 3 * j + xj) = value;
-                    m_hessian(3 * j + xj, 3 * i + xi) = value;
-                }
-            }
+    for (int i = 0; i < size; ++i) {
+        for (int j = i + 1; j < size; ++j) {
+            double value = (m_hessian(i, j) + m_hessian(j, i)) / 2.0;
+            m_hessian(i, j) = value;
+            m_hessian(j, i) = value;
         }
     }
-    delete pool;
 }
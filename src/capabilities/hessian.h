@@ -26,6 +26,7 @@
 #include "src/capabilities/curcumamethod.h"
 
 #include <algorithm>
+#include <atomic>
 #include <functional>
 #include <iterator>
 #include <vector>
@@ -44,6 +45,7 @@ static const json HessianJson = {
     { "thermo", 298.15 },
     { "freq_cutoff", 50 },
     { "hess", 1 },
+    { "hess_analytic", true },
     { "method", "uff" },
     { "threads", 1 }
 };
@@ -72,7 +74,7 @@ inline auto split_vector(const Vector& v, unsigned number_lines)
 
 class HessianThread : public CxxThread {
 public:
-    HessianThread(const json& controller, int i, int j, int xi, int xj, bool fullnumerical = true);
+    HessianThread(const json& controller, int i, int j, int xi, int xj);
     ~HessianThread();
 
     void setMethod(const std::string& method) { m_method = method; }
@@ -85,31 +87,44 @@ public:
     int XI() const { return m_xi; }
     int XJ() const { return m_xj; }
     double DD() const { return m_dd; }
-    Matrix Gradient() const { return m_gradient; }
-    Matrix getHessian() const { return m_hessian; }
-    void setIndices(const std::vector<int>& atoms) { m_atoms = atoms; }
 
 private:
     void Numerical();
-    void Seminumerical();
-    void Threaded();
-
-    std::function<void(void)> m_schema;
 
-    // EnergyCalculator* m_calculator;
     std::string m_method;
-    std::vector<int> m_atoms;
 
     json m_controller, m_parameter;
     Molecule m_molecule;
-    Matrix m_gradient, m_hessian;
     Geometry m_geom_ip_jp, m_geom_im_jp, m_geom_ip_jm, m_geom_im_jm;
     int m_i, m_j, m_xi, m_xj;
-    bool m_fullnumerical = true;
     double m_dd = 0;
     double m_d = 5e-3;
 };
 
+/*! \brief Worker of the seminumerical Hessian
+ *
+ * Every worker sets up one EnergyCalculator and keeps it until all rows are done.
+ * Displaced coordinates are taken from a shared counter, so faster workers simply
+ * take more of the 3N rows. A row costs two gradient calls and is written directly
+ * into the (shared) Hessian, rows of different workers never overlap.
+ */
+class HessianWorker : public CxxThread {
+public:
+    /* energy (optional, not owned) is a calculator already set up for the molecule, otherwise the worker builds its own */
+    HessianWorker(const json& controller, const std::string& method, const json& parameter, const Molecule* molecule, std::atomic<int>* next, Matrix* hessian, EnergyCalculator* energy = nullptr);
+
+    int execute() override;
+
+private:
+    json m_controller, m_parameter;
+    std::string m_method;
+    const Molecule* m_molecule;
+    std::atomic<int>* m_next;
+    Matrix* m_hessian;
+    EnergyCalculator* m_energy;
+    double m_d = 5e-3;
+};
+
 class Hessian : public CurcumaMethod {
 public:
     Hessian(const std::string& method, const json& controller, bool silent = true);
@@ -149,9 +164,10 @@ private:
     /* Read Controller has to be implemented for all */
     void LoadControlJson() override;
 
+    /* returns false if the method has no second derivatives of its own */
+    bool CalculateHessianAnalytic(EnergyCalculator* energy);
     void CalculateHessianNumerical();
-    void CalculateHessianSemiNumerical();
-    void CalculateHessianThreaded();
+    void CalculateHessianSemiNumerical(EnergyCalculator* energy = nullptr);
 
     void FiniteDiffHess();
     std::function<double(double)> m_scale_functions;
@@ -170,7 +186,7 @@ private:
     int m_threads = 1;
     int m_atom_count = 0;
     double m_freq_scale = 1, m_thermo = 298.5, m_freq_cutoff = 50;
-    bool m_hess_calc = true, m_hess_write = false, m_hess_read = false;
+    bool m_hess_calc = true, m_hess_write = false, m_hess_read = false, m_hess_analytic = true;
     int m_hess = 1;
     std::string m_read_file = "none", m_write_file = "none", m_read_xyz = "none";
 };
@@ -0,0 +1,89 @@
+/*
+ * <Shortest augmenting path solver for linear assignment problems>
+ * Copyright (C) 2025 Conrad Hübler <Conrad.Huebler@gmx.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <limits>
+#include <vector>
+
+namespace Assignment {
+
+/*! \brief Minimal cost assignment of a square cost matrix (row major, n x n)
+ *
+ * Jonker-Volgenant type shortest augmenting path algorithm with row and column
+ * potentials, O(n^3) in the worst case and without any full matrix scans per step.
+ * Returns for every row the assigned column.
+ */
+inline std::vector<int> LAPJV(const double* cost, int n)
+{
+    const double inf = std::numeric_limits<double>::infinity();
+    /* index 0 is a virtual column, rows and columns are counted from 1 internally */
+    std::vector<double> u(n + 1, 0), v(n + 1, 0), minv(n + 1);
+    std::vector<int> p(n + 1, 0), way(n + 1, 0);
+    std::vector<char> used(n + 1);
+
+    for (int i = 1; i <= n; ++i) {
+        p[0] = i;
+        int j0 = 0;
+        std::fill(minv.begin(), minv.end(), inf);
+        std::fill(used.begin(), used.end(), 0);
+        do {
+            used[j0] = 1;
+            const int i0 = p[j0];
+            const double* row = cost + std::size_t(i0 - 1) * n;
+            double delta = inf;
+            int j1 = 0;
+            for (int j = 1; j <= n; ++j) {
+                if (used[j])
+                    continue;
+                const double current = row[j - 1] - u[i0] - v[j];
+                if (current < minv[j]) {
+                    minv[j] = current;
+                    way[j] = j0;
+                }
+                if (minv[j] < delta) {
+                    delta = minv[j];
+                    j1 = j;
+                }
+            }
+            if (j1 == 0) /* only non-finite costs left */
+                break;
+            for (int j = 0; j <= n; ++j) {
+                if (used[j]) {
+                    u[p[j]] += delta;
+                    v[j] -= delta;
+                } else
+                    minv[j] -= delta;
+            }
+            j0 = j1;
+        } while (p[j0] != 0);
+        do {
+            const int j1 = way[j0];
+            p[j0] = p[j1];
+            j0 = j1;
+        } while (j0);
+    }
+    std::vector<int> assignment(n, -1);
+    for (int j = 1; j <= n; ++j)
+        if (p[j] > 0)
+            assignment[p[j] - 1] = j - 1;
+    return assignment;
+}
+}
@@ -22,6 +22,7 @@ extern "C" {
 #include "src/capabilities/c_code/interface.h"
 }
 
+#include "lapjv.h"
 #include "munkres.h"
 
 #include "src/core/fileiterator.h"
@@ -58,91 +59,69 @@ extern "C" {
 using json = nlohmann::json;
 
 #include "rmsd.h"
-RMSDThread::RMSDThread(const Molecule& reference_molecule, const Molecule& target, const Geometry& reference, const Matrix& reference_topology, const std::vector<int> intermediate, double connected_mass, int element, int topo)
-    : m_reference_molecule(reference_molecule)
-    , m_target(target)
-    , m_reference(reference)
-    , m_reference_topology(reference_topology)
-    , m_intermediate(intermediate)
-    , m_connected_mass(connected_mass)
-    , m_element(element)
-    , m_topo(topo)
+int IncrementalThread::execute()
 {
-    if (m_topo == 0) {
-        m_evaluator = [this](const Molecule& target_local) -> double {
-            auto t = RMSDFunctions::getAligned(m_reference, target_local.getGeometry(), 1);
-            return RMSDFunctions::getRMSD(m_reference, t);
-        };
-    } else if (m_topo == 1) {
-        m_evaluator = [this](const Molecule& target_local) -> double {
-            auto target_topo = target_local.DistanceMatrix().second;
-            return (target_topo - m_reference_topology).cwiseAbs().sum();
-        };
-    } else {
-        m_evaluator = [this](const Molecule& target_local) -> double {
-            Molecule tar;
-            Matrix reference_matrix = m_reference_molecule.DistanceMatrix().second;
-            Geometry reference_geometry = m_reference_molecule.getGeometry();
-            Geometry target_geometry = target_local.getGeometry();
-            Geometry step = (reference_geometry - target_geometry) / m_topo;
-            int topo = 0;
-            for (int j = 1; j <= m_topo; ++j) {
-                target_geometry += step;
-                topo += CompareTopoMatrix(reference_matrix, tar.DistanceMatrix().second);
-            }
-            return topo;
-        };
+    const IncrementalStep& step = *m_step;
+    const int atoms = step.reference_geometry.rows();
+    Geometry target(atoms, 3);
+    std::vector<char> used(step.target_geometry.rows(), 0);
+    /* the bound is the squared deviation of a found solution, it must not prune that solution itself */
+    const double bound = step.bound * (1 + 1e-9) + 1e-12;
+
+    for (int index = m_next->fetch_add(1); index < step.partials.size(); index = m_next->fetch_add(1)) {
+        const std::vector<int>& partial = *step.partials[index];
+        if (partial.size() + 1 != atoms)
+            continue;
+        for (int i = 0; i < partial.size(); ++i) {
+            target.row(i) = step.target_geometry.row(partial[i]);
+            used[partial[i]] = 1;
+        }
+        for (int j : step.candidates) {
+            if (used[j])
+                continue;
+            m_calculations++;
+            double value;
+            if (step.topo == 0) {
+                target.row(atoms - 1) = step.target_geometry.row(j);
+                value = RMSDFunctions::QCPRMSD(step.reference_geometry.data(), target.data(), atoms);
+                if (value * value * atoms > bound) {
+                    m_pruned++;
+                    continue;
+                }
+            } else
+                value = Topology(partial, j);
+            /* most extensions would be dropped by the storage anyway, they are not copied */
+            if (m_shelf.size() + 1 >= step.storage && m_shelf.size() && value >= m_shelf.data()->rbegin()->first)
+                continue;
+            std::vector<int> extended(partial);
+            extended.push_back(j);
+            m_shelf.addItem(value, extended);
+        }
+        for (int i : partial)
+            used[i] = 0;
     }
+    return 0;
 }
 
-int RMSDThread::execute()
+double IncrementalThread::Topology(const std::vector<int>& partial, int candidate) const
 {
-    Molecule reference;
     Molecule target;
-
-    for (int i = 0; i < m_intermediate.size(); i++) {
-        target.addPair(m_target.Atom(m_intermediate[i]));
+    for (int i : partial)
+        target.addPair(m_step->target->Atom(i));
+    target.addPair(m_step->target->Atom(candidate));
+    if (m_step->topo == 1)
+        return (target.DistanceMatrix().second - m_step->reference_topology).cwiseAbs().sum();
+
+    /* topology changes along the linear interpolation from the target to the reference */
+    Geometry target_geometry = target.getGeometry();
+    Geometry step = (m_step->reference->getGeometry() - target_geometry) / m_step->topo;
+    int topo = 0;
+    for (int j = 1; j <= m_step->topo; ++j) {
+        target_geometry += step;
+        target.setGeometry(target_geometry);
+        topo += CompareTopoMatrix(m_step->reference_topology, target.DistanceMatrix().second);
     }
-
-    const int i = reference.AtomCount();
-    Molecule reference_local(reference);
-    std::map<double, int> match;
-    bool found_none = true;
-
-    for (int j = 0; j < m_target.AtomCount(); ++j) {
-        if (m_target.Atoms()[j] == m_element) {
-            found_none = false;
-            Molecule target_local(target);
-            if (target_local.addPair(m_target.Atom(j))) {
-                /*
-                //const auto t = RMSDFunctions::getAligned(m_reference, GeometryTools::TranslateGeometry(target_local.getGeometry(), target_local.Centroid(true), Position{ 0, 0, 0 }), 1);
-                const auto t = RMSDFunctions::getAligned(m_reference, target_local.getGeometry(), 1);
-                double value = 0;
-                if(!m_topo)
-                    value = RMSDFunctions::getRMSD(m_reference, t);
-                else{
-                    Matrix target_topo = target_local.DistanceMatrix().second;
-                    value = (target_topo - m_reference_topology).cwiseAbs().sum();
-                }
-                */
-                double value = m_evaluator(target_local);
-                m_calculations++;
-                if (target_local.AtomCount() <= m_target.AtomCount()) {
-                    {
-                        match.insert(std::pair<double, int>(value, j));
-                    }
-                }
-            }
-        }
-    }
-    m_match = match.size();
-    for (const auto& element : match) {
-        std::vector<int> temp = m_intermediate;
-        temp.push_back(element.second);
-        m_shelf.insert(std::pair<double, std::vector<int>>(element.first, temp));
-    }
-
-    return 0;
+    return topo;
 }
 
 RMSDDriver::RMSDDriver(const json& controller, bool silent)
@@ -227,6 +206,13 @@ void RMSDDriver::LoadControlJson()
         fmt::print(fg(fmt::color::green) | fmt::emphasis::bold, "\nPermutation of atomic indices performed according to {0} \n\n", m_method);
     }
     m_costmatrix = Json2KeyWord<int>(m_defaults, "costmatrix");
+    std::string assignment = Json2KeyWord<std::string>(m_defaults, "assignment");
+    if (assignment.compare("munkres") == 0)
+        m_assignment = 1;
+    else if (assignment.compare("hungarian") == 0)
+        m_assignment = 2;
+    else
+        m_assignment = 0;
     std::string order = Json2KeyWord<std::string>(m_defaults, "order");
     int cycles = Json2KeyWord<int>(m_defaults, "cycles");
     if (cycles != -1)
@@ -370,8 +356,7 @@ double RMSDDriver::PartialRMSD(const Molecule& ref, const Molecule& tar)
     {
         auto reference = CenterMolecule(ref.getGeometry());
         auto target = CenterMolecule(tar.getGeometry());
-        const auto t = RMSDFunctions::getAligned(reference, target, 1);
-        rmsd = RMSDFunctions::getRMSD(reference, t);
+        rmsd = RMSDFunctions::QCPRMSD(reference, target);
     }
     return rmsd;
 }
@@ -410,25 +395,31 @@ void RMSDDriver::ReorderIncremental()
     Molecule ref = result.first;
     LimitedStorage storage_shelf = result.second;
 
+    /* a complete assignment bounds the search, its squared deviation is only valid for rmsd driven, statically centered reordering */
+    std::vector<int> incumbent;
+    double bound = std::numeric_limits<double>::max();
+    if (m_topo == 0 && !m_dynamic_center)
+        bound = IncrementalBound(incumbent);
+
     int reference_reordered = 0;
     int reference_not_reorordered = 0;
     int max = std::min(m_reference.AtomCount(), m_target.AtomCount());
-    int combinations = 0;
-    int wake_up = 100;
-    CxxThreadPool* pool = new CxxThreadPool;
-    if (m_silent)
-        pool->setProgressBar(CxxThreadPool::ProgressBarType::None);
-    else
-        pool->setProgressBar(CxxThreadPool::ProgressBarType::Continously);
-    pool->setActiveThreadCount(m_threads);
+    int combinations = 0, pruned = 0;
+    bool exhausted = false;
+    const std::vector<int> target_elements = m_reorder_target.Atoms();
+
+    IncrementalStep step;
+    step.target = &m_reorder_target;
+    step.target_geometry = m_reorder_target.getGeometry();
+    step.topo = m_topo;
+    step.storage = inter_size;
+    step.bound = bound;
+
     std::vector<AtomDef> atoms;
     while (
         m_reorder_reference_geometry.rows() < m_reorder_reference.AtomCount() && m_reorder_reference_geometry.rows() < m_reorder_target.AtomCount() && ((reference_reordered + reference_not_reorordered) <= m_reference.AtomCount())) {
-        int thread_count = 0;
-
         Molecule reference = ref;
         int i = reference.AtomCount();
-        double mass = m_reference.ConnectedMass(i);
         auto atom = m_reorder_reference.Atom(i);
         if (!m_silent) {
             std::cout << int((reference_reordered + reference_not_reorordered) / double(max) * 100) << " % " << std::endl;
@@ -439,30 +430,52 @@ void RMSDDriver::ReorderIncremental()
             m_reorder_reference_geometry = GeometryTools::TranslateGeometry(reference.getGeometry(), reference.Centroid(true), Position{ 0, 0, 0 });
         else
             m_reorder_reference_geometry = reference.getGeometry();
-        std::vector<RMSDThread*> threads;
-        for (const auto& e : *storage_shelf.data()) {
-            RMSDThread* thread = new RMSDThread(reference, m_reorder_target, m_reorder_reference_geometry, reference.DistanceMatrix().second, e.second, mass, element, m_topo);
-            pool->addThread(thread);
-            threads.push_back(thread);
-            thread_count++;
-        }
-        pool->StaticPool();
-        pool->setWakeUp(wake_up);
-        int match = 0;
+
+        step.reference = &reference;
+        step.reference_geometry = m_reorder_reference_geometry;
+        if (m_topo)
+            step.reference_topology = reference.DistanceMatrix().second;
+        step.candidates.clear();
+        for (int j = 0; j < target_elements.size(); ++j)
+            if (target_elements[j] == element)
+                step.candidates.push_back(j);
+        step.partials.clear();
+        for (const auto& e : *storage_shelf.data())
+            step.partials.push_back(&e.second);
+
+        LimitedStorage storage_shelf_next(inter_size);
+        int match = 0, step_pruned = 0;
         /* For now, lets just dont start the threads if the current element can not be found in target */
-        if (std::find(m_target.Atoms().begin(), m_target.Atoms().end(), element) != m_target.Atoms().end()) {
+        if (step.candidates.size() && step.partials.size()) {
+            std::atomic<int> next(0);
+            std::vector<IncrementalThread*> threads;
+            CxxThreadPool* pool = new CxxThreadPool;
+            if (m_silent)
+                pool->setProgressBar(CxxThreadPool::ProgressBarType::None);
+            else
+                pool->setProgressBar(CxxThreadPool::ProgressBarType::Continously);
+            pool->setActiveThreadCount(m_threads);
+            for (int t = 0; t < std::max(1, std::min(m_threads, int(step.partials.size()))); ++t) {
+                IncrementalThread* thread = new IncrementalThread(&step, &next);
+                threads.push_back(thread);
+                pool->addThread(thread);
+            }
             pool->StartAndWait();
-        }
-        LimitedStorage storage_shelf_next(inter_size);
-        for (const auto t : threads) {
-            RMSDThread* thread = static_cast<RMSDThread*>(t);
-            for (const auto& item : (*thread->data())) {
-                if (thread->Match()) {
+            delete pool;
+            for (auto* thread : threads) {
+                for (const auto& item : *thread->Shelf().data())
                     storage_shelf_next.addItem(item.first, item.second);
-                }
-                match += thread->Match();
+                match += thread->Shelf().size();
+                combinations += thread->Calculations();
+                step_pruned += thread->Pruned();
+                delete thread;
             }
-            combinations += thread->Calculations();
+        }
+        pruned += step_pruned;
+        if (match == 0 && step_pruned) {
+            /* every extension is worse than the complete assignment, nothing better can be found */
+            exhausted = true;
+            break;
         }
         if (match == 0) {
             Molecule ref_0;
@@ -492,10 +505,7 @@ void RMSDDriver::ReorderIncremental()
             }
             reference_not_reorordered++;
         }
-        wake_up = 2 * pool->WakeUp();
-        pool->clear();
     }
-    delete pool;
 
     int count = 0;
     for (const auto& e : *storage_shelf.data()) {
@@ -509,6 +519,14 @@ void RMSDDriver::ReorderIncremental()
             count++;
         }
     }
+    /* the complete assignment of the bound is kept, first if the search did not find a better one */
+    if (incumbent.size() && std::find(m_stored_rules.begin(), m_stored_rules.end(), incumbent) == m_stored_rules.end()) {
+        double rmsd = std::sqrt(bound / incumbent.size());
+        bool best = exhausted || storage_shelf.size() == 0 || storage_shelf.data()->begin()->first > rmsd;
+        m_stored_rules.insert(best ? m_stored_rules.begin() : m_stored_rules.end(), incumbent);
+        m_intermedia_rules.push_back(incumbent);
+        m_intermediate_cost_matrices.insert(std::pair<double, std::vector<int>>(rmsd, incumbent));
+    }
     // m_reorder_rules = m_results.begin()->second;
     if (m_stored_rules.size() == 0) {
         if (!m_silent)
@@ -522,7 +540,39 @@ void RMSDDriver::ReorderIncremental()
     m_target = m_target_reordered;
     m_target_aligned = m_target;
     if (!m_silent)
-        std::cout << "Overall " << combinations << " where evaluated!" << std::endl;
+        std::cout << "Overall " << combinations << " where evaluated, " << pruned << " were pruned!" << std::endl;
+}
+
+double RMSDDriver::IncrementalBound(std::vector<int>& order)
+{
+    const Geometry reference = m_reorder_reference.getGeometry();
+    const Geometry target = m_reorder_target.getGeometry();
+    double bound = std::numeric_limits<double>::max();
+    if (reference.rows() != target.rows())
+        return bound;
+    const std::vector<int> reference_atoms = m_reorder_reference.Atoms();
+    const std::vector<int> target_atoms = m_reorder_target.Atoms();
+
+    /* alternating assignment and best fit, stops if the deviation does not decrease any more */
+    Geometry rotated = target;
+    std::vector<int> current(reference.rows());
+    Geometry ordered(reference.rows(), 3);
+    for (int iter = 0; iter < 10; ++iter) {
+        BlockedCostMatrix costs = MakeCostMatrix(reference, rotated, reference_atoms, target_atoms, 1).second;
+        if (!costs.Square())
+            break;
+        SolveBlocks(costs, current);
+        for (int i = 0; i < current.size(); ++i)
+            ordered.row(i) = target.row(current[i]);
+        double rmsd = RMSDFunctions::QCPRMSD(reference, ordered);
+        double deviation = rmsd * rmsd * reference.rows();
+        if (deviation >= bound)
+            break;
+        bound = deviation;
+        order = current;
+        rotated = target * RMSDFunctions::BestFitRotation(reference, ordered);
+    }
+    return bound;
 }
 
 std::vector<int> RMSDDriver::FillMissing(const Molecule& molecule, const std::vector<int>& order)
@@ -669,6 +719,8 @@ double RMSDDriver::CalculateRMSD(const Molecule& reference_mol, const Molecule&
     double rmsd = 0;
     auto reference = CenterMolecule(reference_mol.getGeometry());
     auto target = CenterMolecule(target_mol.getGeometry());
+    if (ret_ref == NULL && ret_tar == NULL)
+        return RMSDFunctions::QCPRMSD(reference, target);
     const auto t = RMSDFunctions::getAligned(reference, target, 1);
     if (ret_ref != NULL) {
         ret_ref->LoadMolecule(reference_mol);
@@ -994,10 +1046,10 @@ void RMSDDriver::TemplateFree()
     }
 }
 
-void RMSDDriver::InsertRotation(std::pair<double, Matrix>& rotation)
+void RMSDDriver::InsertRotation(std::pair<double, BlockedCostMatrix>& rotation)
 {
-    for (auto i : m_prepared_cost_matrices) {
-        if ((rotation.second - i.second).cwiseAbs().sum() / double(i.second.rows() * i.second.rows()) < 10)
+    for (const auto& i : m_prepared_cost_matrices) {
+        if (rotation.second.Difference(i.second) / double(i.second.size * i.second.size) < 10)
             return;
     }
     m_prepared_cost_matrices.insert(rotation);
@@ -1311,7 +1363,7 @@ std::pair<std::vector<int>, std::vector<int>> RMSDDriver::PrepareDistanceTemplat
     return std::pair<std::vector<int>, std::vector<int>>(reference_indicies, target_indices);
 }
 
-std::pair<double, Matrix> RMSDDriver::MakeCostMatrix(const std::vector<int>& permuation)
+std::pair<double, BlockedCostMatrix> RMSDDriver::MakeCostMatrix(const std::vector<int>& permuation)
 {
     std::vector<int> first(permuation.size(), 0);
     for (int i = 0; i < permuation.size(); ++i)
@@ -1319,7 +1371,7 @@ std::pair<double, Matrix> RMSDDriver::MakeCostMatrix(const std::vector<int>& per
     return MakeCostMatrix(std::pair<std::vector<int>, std::vector<int>>(first, permuation));
 }
 
-std::pair<double, Matrix> RMSDDriver::MakeCostMatrix(const std::vector<int>& reference, const std::vector<int>& target)
+std::pair<double, BlockedCostMatrix> RMSDDriver::MakeCostMatrix(const std::vector<int>& reference, const std::vector<int>& target)
 {
     auto operators = GetOperateVectors(reference, target);
     Eigen::Matrix3d R = operators.first;
@@ -1339,12 +1391,12 @@ std::pair<double, Matrix> RMSDDriver::MakeCostMatrix(const std::vector<int>& ref
     return MakeCostMatrix(cached_reference, rotated);
 }
 
-std::pair<double, Matrix> RMSDDriver::MakeCostMatrix(const std::pair<std::vector<int>, std::vector<int>>& pair)
+std::pair<double, BlockedCostMatrix> RMSDDriver::MakeCostMatrix(const std::pair<std::vector<int>, std::vector<int>>& pair)
 {
     return MakeCostMatrix(pair.first, pair.second);
 }
 
-std::pair<double, Matrix> RMSDDriver::MakeCostMatrix(const Matrix& rotation)
+std::pair<double, BlockedCostMatrix> RMSDDriver::MakeCostMatrix(const Matrix& rotation)
 {
     // Geometry target = m_target.getGeometry().transpose();
     Geometry rotated = m_target.getGeometry() * rotation;
@@ -1352,100 +1404,127 @@ std::pair<double, Matrix> RMSDDriver::MakeCostMatrix(const Matrix& rotation)
     return MakeCostMatrix(reference, rotated);
 }
 
-std::pair<double, Matrix> RMSDDriver::MakeCostMatrix(const Geometry& reference, const Geometry& target /*, const std::vector<int> reference_atoms, const std::vector<int> target_atoms*/)
+std::pair<double, BlockedCostMatrix> RMSDDriver::MakeCostMatrix(const Geometry& reference, const Geometry& target /*, const std::vector<int> reference_atoms, const std::vector<int> target_atoms*/)
+{
+    return MakeCostMatrix(reference, target, m_reference.Atoms(), m_target.Atoms(), m_costmatrix);
+}
+
+std::pair<double, BlockedCostMatrix> RMSDDriver::MakeCostMatrix(const Geometry& reference, const Geometry& target, const std::vector<int>& reference_atoms, const std::vector<int>& target_atoms, int costmatrix)
 {
     double penalty = 1e23;
+    BlockedCostMatrix result;
+    result.size = reference_atoms.size();
+
+    /* atoms are grouped by element once, pairs of different elements are never stored */
+    std::map<int, int> elements;
+    auto block = [&elements, &result](int element) {
+        auto index = elements.emplace(element, elements.size());
+        if (index.second) {
+            result.reference.emplace_back();
+            result.target.emplace_back();
+        }
+        return index.first->second;
+    };
+    for (int i = 0; i < reference_atoms.size(); ++i)
+        result.reference[block(reference_atoms[i])].push_back(i);
+    for (int j = 0; j < reference_atoms.size() && j < target_atoms.size(); ++j)
+        result.target[block(target_atoms[j])].push_back(j);
 
-    Eigen::MatrixXd distance = Eigen::MatrixXd::Zero(m_reference.AtomCount(), m_reference.AtomCount());
     double sum = 0;
-    for (int i = 0; i < m_reference.AtomCount(); ++i) {
-        double min = penalty;
-        int row_count = 0;
-        for (int j = 0; j < m_reference.AtomCount(); ++j) {
-            double d = (target.row(j) - reference.row(i)).norm();
-            double norm = (target.row(j).norm() - reference.row(i).norm());
-            if (m_costmatrix == 2)
-                distance(i, j) = d;
-            else if (m_costmatrix == 1)
-                distance(i, j) = d * d;
-            else if (m_costmatrix == 3)
-                distance(i, j) = d + norm;
-            else if (m_costmatrix == 4)
-                distance(i, j) = d * d + norm * norm;
-            else if (m_costmatrix == 5)
-                distance(i, j) = d * norm;
-            else if (m_costmatrix == 5)
-                distance(i, j) = d * d * norm * norm;
-            else
-                distance(i, j) = d * d;
-            // + norm
-            distance(i, j) += penalty * (m_reference.Atom(i).first != m_target.Atom(j).first);
-            min = std::min(min, distance(i, j));
+    result.blocks.resize(result.reference.size());
+    for (int b = 0; b < result.blocks.size(); ++b) {
+        const std::vector<int>& rows = result.reference[b];
+        const std::vector<int>& columns = result.target[b];
+        Geometry ref(rows.size(), 3), tar(columns.size(), 3);
+        for (int i = 0; i < rows.size(); ++i)
+            ref.row(i) = reference.row(rows[i]);
+        for (int j = 0; j < columns.size(); ++j)
+            tar.row(j) = target.row(columns[j]);
+
+        Matrix& distance = result.blocks[b];
+        distance.resize(rows.size(), columns.size());
+        const Eigen::ArrayXd tar_norm = tar.rowwise().norm().array();
+        for (int i = 0; i < rows.size(); ++i) {
+            const Eigen::ArrayXd squared = (tar.rowwise() - ref.row(i)).rowwise().squaredNorm().array();
+            if (costmatrix < 2 || costmatrix > 5)
+                distance.row(i) = squared.matrix().transpose();
+            else {
+                const Eigen::ArrayXd d = squared.sqrt();
+                const Eigen::ArrayXd norm = tar_norm - ref.row(i).norm();
+                if (costmatrix == 2)
+                    distance.row(i) = d.matrix().transpose();
+                else if (costmatrix == 3)
+                    distance.row(i) = (d + norm).matrix().transpose();
+                else if (costmatrix == 4)
+                    distance.row(i) = (squared + norm * norm).matrix().transpose();
+                else
+                    distance.row(i) = (d * norm).matrix().transpose();
+            }
+            sum += columns.size() ? distance.row(i).minCoeff() : penalty;
         }
-        sum += min;
     }
-    return std::pair<double, Matrix>(sum, distance);
+    return std::pair<double, BlockedCostMatrix>(sum, result);
 }
 
-std::pair<double, Matrix> RMSDDriver::MakeCostMatrix(const Geometry& reference, const Geometry& target, const std::vector<int>& reference_atoms, const std::vector<int>& target_atoms, int costmatrix)
+int CostBlockThread::execute()
 {
-    double penalty = 1e23;
-    Eigen::MatrixXd distance = Eigen::MatrixXd::Zero(reference_atoms.size(), reference_atoms.size());
-    double sum = 0;
-    for (int i = 0; i < reference_atoms.size(); ++i) {
-        double min = penalty;
-        int row_count = 0;
-        for (int j = 0; j < reference_atoms.size(); ++j) {
-            double d = (target.row(j) - reference.row(i)).norm();
-            double norm = (target.row(j).norm() - reference.row(i).norm());
-            if (costmatrix == 2)
-                distance(i, j) = d;
-            else if (costmatrix == 1)
-                distance(i, j) = d * d;
-            else if (costmatrix == 3)
-                distance(i, j) = d + norm;
-            else if (costmatrix == 4)
-                distance(i, j) = d * d + norm * norm;
-            else if (costmatrix == 5)
-                distance(i, j) = d * norm;
-            else if (costmatrix == 5)
-                distance(i, j) = d * d * norm * norm;
-            else
-                distance(i, j) = d * d;
+    *m_assignment = Assignment::LAPJV(m_block->data(), m_block->rows());
+    return 0;
+}
 
-            // + norm
-            distance(i, j) += penalty * (reference_atoms[i] != target_atoms[j]);
-            min = std::min(min, distance(i, j));
-        }
-        sum += min;
+void RMSDDriver::SolveBlocks(const BlockedCostMatrix& distance, std::vector<int>& order) const
+{
+    std::vector<std::vector<int>> local(distance.blocks.size());
+    int large = 0;
+    for (const auto& block : distance.blocks)
+        large += block.rows() >= 32;
+    if (m_threads > 1 && large > 1) {
+        CxxThreadPool* pool = new CxxThreadPool;
+        pool->setProgressBar(CxxThreadPool::ProgressBarType::None);
+        pool->setActiveThreadCount(m_threads);
+        for (int b = 0; b < distance.blocks.size(); ++b)
+            pool->addThread(new CostBlockThread(&distance.blocks[b], &local[b]));
+        pool->StartAndWait();
+        delete pool;
+    } else {
+        for (int b = 0; b < distance.blocks.size(); ++b)
+            local[b] = Assignment::LAPJV(distance.blocks[b].data(), distance.blocks[b].rows());
     }
-    return std::pair<double, Matrix>(sum, distance);
+    for (int b = 0; b < distance.blocks.size(); ++b)
+        for (int i = 0; i < local[b].size(); ++i)
+            order[distance.reference[b][i]] = distance.target[b][local[b][i]];
 }
 
-std::vector<int> RMSDDriver::SolveCostMatrix(Matrix& distance)
+std::vector<int> RMSDDriver::SolveCostMatrix(BlockedCostMatrix& distance)
 {
     std::vector<int> new_order;
-    new_order.resize(distance.rows());
-    double difference = distance.cwiseAbs().sum();
+    new_order.resize(distance.size);
+    double difference = 1;
     int iter = 0;
     for (iter = 0; iter < 10 && difference != 0; ++iter) {
-        bool use_c = false;
-        int dim = distance.rows();
-        if (use_c) {
+        int dim = distance.size;
+        if (m_assignment == 0 && distance.Square()) {
+            SolveBlocks(distance, new_order);
+        } else if (m_assignment == 0) {
+            /* different compositions, some atoms have to be paired across elements */
+            Matrix dense = distance.Dense();
+            new_order = Assignment::LAPJV(dense.data(), dim);
+        } else if (m_assignment == 2) {
+            Matrix dense = distance.Dense();
             double* table = new double[dim * dim];
             for (int i = 0; i < dim; ++i) {
                 for (int j = 0; j < dim; ++j) {
-                    table[i * dim + j] = distance(i, j);
+                    table[i * dim + j] = dense(i, j);
                 }
             }
             int* order = new int[dim];
             assign(dim, table, order);
             for (int i = 0; i < dim; ++i)
                 new_order[i] = order[i];
-            delete (table);
-            delete (order);
+            delete[] table;
+            delete[] order;
         } else {
-            auto result = MunkressAssign(distance);
+            auto result = MunkressAssign(distance.Dense());
             for (int i = 0; i < result.cols(); ++i) {
                 for (int j = 0; j < result.rows(); ++j) {
                     if (result(i, j) == 1) {
@@ -1456,7 +1535,7 @@ std::vector<int> RMSDDriver::SolveCostMatrix(Matrix& distance)
             }
         }
         auto pair = MakeCostMatrix(new_order);
-        difference = (distance - pair.second).cwiseAbs().sum();
+        difference = distance.Difference(pair.second);
         distance = pair.second;
     }
     if (!m_silent)
@@ -26,8 +26,10 @@
 
 #include "external/CxxThreadPool/include/CxxThreadPool.h"
 
+#include <atomic>
 #include <chrono>
 #include <functional>
+#include <limits>
 #include <map>
 #include <queue>
 
@@ -44,30 +46,114 @@ struct StructComp {
     double diff_topology = 0;
 };
 
-class RMSDThread : public CxxThread {
+/*! \brief Cost matrix of a reordering, stored as one block per element
+ *
+ * Atoms of different elements are never paired, so only the blocks of equal
+ * elements are built. Row i of block b belongs to reference atom reference[b][i],
+ * column j to target atom target[b][j].
+ */
+struct BlockedCostMatrix {
+    std::vector<std::vector<int>> reference, target;
+    std::vector<Matrix> blocks;
+    int size = 0;
+
+    /*! \brief True if every element has as many reference as target atoms */
+    inline bool Square() const
+    {
+        for (int b = 0; b < blocks.size(); ++b)
+            if (reference[b].size() != target[b].size())
+                return false;
+        return true;
+    }
+
+    /*! \brief Sum of absolute differences of all blocks, both matrices have to share the element layout */
+    inline double Difference(const BlockedCostMatrix& other) const
+    {
+        if (other.blocks.size() != blocks.size())
+            return std::numeric_limits<double>::max();
+        double difference = 0;
+        for (int b = 0; b < blocks.size(); ++b) {
+            if (other.blocks[b].rows() != blocks[b].rows() || other.blocks[b].cols() != blocks[b].cols())
+                return std::numeric_limits<double>::max();
+            difference += (blocks[b] - other.blocks[b]).cwiseAbs().sum();
+        }
+        return difference;
+    }
+
+    /*! \brief Full size x size matrix, pairs of different elements get the penalty */
+    inline Matrix Dense(double penalty = 1e23) const
+    {
+        Matrix dense = Matrix::Constant(size, size, penalty);
+        for (int b = 0; b < blocks.size(); ++b)
+            for (int i = 0; i < reference[b].size(); ++i)
+                for (int j = 0; j < target[b].size(); ++j)
+                    dense(reference[b][i], target[b][j]) = blocks[b](i, j);
+        return dense;
+    }
+};
+
+/*! \brief Solves the assignment of one element block */
+class CostBlockThread : public CxxThread {
 public:
-    RMSDThread(const Molecule& reference_molecule, const Molecule& target, const Geometry& reference, const Matrix& reference_topology, const std::vector<int> intermediate, double connected_mass, int element, int topo);
-    inline virtual ~RMSDThread() = default;
+    CostBlockThread(const Matrix* block, std::vector<int>* assignment)
+        : m_block(block)
+        , m_assignment(assignment)
+    {
+        setAutoDelete(true);
+    }
+    ~CostBlockThread() = default;
+
+    virtual int execute() override;
+
+private:
+    const Matrix* m_block;
+    std::vector<int>* m_assignment;
+};
+
+/*! \brief Data of one growth step of the incremental reordering, shared read-only by all workers */
+struct IncrementalStep {
+    const Molecule* reference = nullptr; /* reference atoms placed so far, including the new one */
+    const Molecule* target = nullptr;
+    Geometry reference_geometry, target_geometry;
+    Matrix reference_topology; /* only needed for topo != 0 */
+    std::vector<int> candidates; /* target atoms with the element of the new reference atom */
+    std::vector<const std::vector<int>*> partials; /* partial assignments of the previous step */
+    double bound = std::numeric_limits<double>::max(); /* squared deviation of a complete assignment */
+    int topo = 0;
+    int storage = 1;
+};
 
-    int execute() override;
+/*! \brief Extends the partial assignments of one step by every candidate atom
+ *
+ * The workers take the next partial assignment from a shared counter, so uneven
+ * branches are balanced automatically. The squared deviation of a partial assignment
+ * can only grow when atoms are added, extensions above the bound of the step are pruned.
+ * Every worker keeps only the best extensions it found.
+ */
+class IncrementalThread : public CxxThread {
+public:
+    IncrementalThread(const IncrementalStep* step, std::atomic<int>* next)
+        : m_step(step)
+        , m_next(next)
+        , m_shelf(step->storage)
+    {
+        setAutoDelete(false);
+    }
+    ~IncrementalThread() = default;
+
+    virtual int execute() override;
 
-    const std::map<double, std::vector<int>>* data() const { return &m_shelf; }
-    inline int Match() const { return m_match; }
+    inline const LimitedStorage& Shelf() const { return m_shelf; }
     inline int Calculations() const { return m_calculations; }
+    inline int Pruned() const { return m_pruned; }
 
 private:
-    Molecule m_target;
-    Molecule m_reference_molecule;
-    Geometry m_reference;
-    Matrix m_reference_topology;
-    std::map<double, std::vector<int>> m_shelf;
-    std::vector<int> m_intermediate;
-    double m_connected_mass = 0;
-    int m_element = -1;
-    int m_match;
-    int m_topo = 0;
-    int m_calculations = 0;
-    std::function<double(const Molecule&)> m_evaluator;
+    double Topology(const std::vector<int>& partial, int candidate) const;
+
+    const IncrementalStep* m_step;
+    std::atomic<int>* m_next;
+    LimitedStorage m_shelf;
+    int m_calculations = 0, m_pruned = 0;
 };
 
 static const json RMSDJson = {
@@ -100,6 +186,7 @@ static const json RMSDJson = {
     { "nofree", false },
     { "limit", 10 },
     { "costmatrix", 1 },
+    { "assignment", "lapjv" },
     { "maxtrial", 3 },
     { "kmstat", false },
     { "km_conv", 1e-3 },
@@ -226,7 +313,7 @@ public:
     void setThreads(int threads) { m_threads = threads; }
 
     bool MolAlignLib();
-    static std::pair<double, Matrix> MakeCostMatrix(const Geometry& reference, const Geometry& target, const std::vector<int>& reference_atoms, const std::vector<int>& target_atoms, int costmatrix);
+    static std::pair<double, BlockedCostMatrix> MakeCostMatrix(const Geometry& reference, const Geometry& target, const std::vector<int>& reference_atoms, const std::vector<int>& target_atoms, int costmatrix);
 
     Geometry Gradient() const;
 
@@ -246,6 +333,8 @@ private:
     void ReadControlFile() override {}
 
     void ReorderIncremental();
+    /*! \brief Complete assignment of the centered structures and its squared deviation, bounds the incremental search */
+    double IncrementalBound(std::vector<int>& order);
 
     void HeavyTemplate();
 
@@ -279,7 +368,7 @@ private:
     }
 
     std::vector<int> FillMissing(const Molecule& molecule, const std::vector<int>& order);
-    void InsertRotation(std::pair<double, Matrix>& rotation);
+    void InsertRotation(std::pair<double, BlockedCostMatrix>& rotation);
 
     void InitialiseOrder();
     std::pair<Molecule, LimitedStorage> InitialisePair();
@@ -293,13 +382,15 @@ private:
     Geometry CenterMolecule(const Molecule& mol, int fragment) const;
     Geometry CenterMolecule(const Geometry& molt) const;
 
-    std::pair<double, Matrix> MakeCostMatrix(const std::vector<int>& permutation);
-    std::pair<double, Matrix> MakeCostMatrix(const std::vector<int>& reference, const std::vector<int>& target);
-    std::pair<double, Matrix> MakeCostMatrix(const std::pair<std::vector<int>, std::vector<int>>& pair);
-    std::pair<double, Matrix> MakeCostMatrix(const Geometry& reference, const Geometry& target /*, const std::vector<int> reference_atoms, const std::vector<int> target_atoms*/);
-    std::pair<double, Matrix> MakeCostMatrix(const Matrix& rotation);
+    std::pair<double, BlockedCostMatrix> MakeCostMatrix(const std::vector<int>& permutation);
+    std::pair<double, BlockedCostMatrix> MakeCostMatrix(const std::vector<int>& reference, const std::vector<int>& target);
+    std::pair<double, BlockedCostMatrix> MakeCostMatrix(const std::pair<std::vector<int>, std::vector<int>>& pair);
+    std::pair<double, BlockedCostMatrix> MakeCostMatrix(const Geometry& reference, const Geometry& target /*, const std::vector<int> reference_atoms, const std::vector<int> target_atoms*/);
+    std::pair<double, BlockedCostMatrix> MakeCostMatrix(const Matrix& rotation);
 
-    std::vector<int> SolveCostMatrix(Matrix& distance);
+    std::vector<int> SolveCostMatrix(BlockedCostMatrix& distance);
+    /*! \brief Solve every element block on its own, in parallel if threads are available */
+    void SolveBlocks(const BlockedCostMatrix& distance, std::vector<int>& order) const;
 
     std::pair<Matrix, Position> GetOperateVectors(int fragment_reference, int fragment_target);
     std::pair<Matrix, Position> GetOperateVectors(const std::vector<int>& reference_atoms, const std::vector<int>& target_atoms);
@@ -325,12 +416,13 @@ private:
     int m_molaligntol = 10;
     int m_limit = 10;
     int m_costmatrix = 1;
+    int m_assignment = 0; /* 0 - blocked lapjv, 1 - munkres, 2 - hungarian (c code) */
     int m_maxtrial = 2;
     double m_cost_limit = 0;
     mutable int m_fragment = -1, m_fragment_reference = -1, m_fragment_target = -1;
     std::vector<int> m_initial, m_element_templates;
     std::string m_molalign = "molalign", m_molalignarg = " -remap -fast -tol 10";
-    std::map<double, Matrix> m_prepared_cost_matrices;
+    std::map<double, BlockedCostMatrix> m_prepared_cost_matrices;
 };
 
 using namespace LBFGSpp;
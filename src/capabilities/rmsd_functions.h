@@ -26,11 +26,17 @@
 
 #include <Eigen/Dense>
 
-namespace RMSDFunctions {
+#include <algorithm>
+#include <cmath>
 
-/*! \brief Calculate the best fit rotation of two sets of coordinates, both have to be centered already */
+namespace RMSDFunctions {
 
-inline Eigen::Matrix3d BestFitRotation(const Geometry& reference, const Geometry& target, int factor = 1)
+/*! \brief Calculate the best fit rotation of two sets of coordinates with SVD, both have to be centered already
+ *
+ * factor = -1 allows an improper rotation (inversion), BestFitRotation calls this one in that case.
+ * Kept for validation of the QCP kernels below.
+ */
+inline Eigen::Matrix3d BestFitRotationSVD(const Geometry& reference, const Geometry& target, int factor = 1)
 {
     /* The rmsd kabsch algorithmn was adopted from here:
      * https://github.com/oleg-alexandrov/projects/blob/master/eigen/Kabsch.cpp
@@ -50,6 +56,220 @@ inline Eigen::Matrix3d BestFitRotation(const Geometry& reference, const Geometry
     return svd.matrixV() * I * svd.matrixU().transpose();
 }
 
+/* Quaternion characteristic polynomial (QCP) method
+ * D. L. Theobald, Acta Cryst. A 2005, 61, 478-480
+ * P. Liu, D. K. Agrafiotis, D. L. Theobald, J. Comput. Chem. 2010, 31, 1561-1563
+ * The largest eigenvalue of the 4x4 key matrix is found by Newton iterations on its
+ * characteristic polynomial, the rotation follows from the corresponding eigenvector.
+ * Everything is fixed size, coordinates are read in place (x, y, z of each atom in a row). */
+
+/*! \brief Inner product matrix M = reference^T * target and E0 = (|reference|^2 + |target|^2) / 2 */
+inline double QCPInnerProduct(const double* reference, const double* target, int atoms, Eigen::Matrix3d& M)
+{
+    double G = 0;
+    M.setZero();
+    for (int i = 0; i < atoms; ++i) {
+        const double* a = reference + 3 * i;
+        const double* b = target + 3 * i;
+        G += a[0] * a[0] + a[1] * a[1] + a[2] * a[2] + b[0] * b[0] + b[1] * b[1] + b[2] * b[2];
+        for (int j = 0; j < 3; ++j) {
+            M(j, 0) += a[j] * b[0];
+            M(j, 1) += a[j] * b[1];
+            M(j, 2) += a[j] * b[2];
+        }
+    }
+    return 0.5 * G;
+}
+
+/*! \brief Largest eigenvalue of the key matrix of M, E0 is the start value
+ *
+ * Newton is only reliable for a well separated largest eigenvalue. Linear structures,
+ * one or two atoms and exactly superimposed structures of that kind give a (nearly)
+ * degenerate one, the polynomial is flat there and the iteration may stop at a wrong root.
+ * reliable (optional) is false then or if the result is not the largest eigenvalue,
+ * the callers use the SVD in that case. */
+inline double QCPMaxEigenvalue(const Eigen::Matrix3d& M, double E0, bool* reliable = nullptr)
+{
+    const double Sxx = M(0, 0), Sxy = M(0, 1), Sxz = M(0, 2);
+    const double Syx = M(1, 0), Syy = M(1, 1), Syz = M(1, 2);
+    const double Szx = M(2, 0), Szy = M(2, 1), Szz = M(2, 2);
+
+    const double Sxx2 = Sxx * Sxx, Syy2 = Syy * Syy, Szz2 = Szz * Szz;
+    const double Sxy2 = Sxy * Sxy, Syz2 = Syz * Syz, Sxz2 = Sxz * Sxz;
+    const double Syx2 = Syx * Syx, Szy2 = Szy * Szy, Szx2 = Szx * Szx;
+
+    const double SyzSzymSyySzz2 = 2.0 * (Syz * Szy - Syy * Szz);
+    const double Sxx2Syy2Szz2Syz2Szy2 = Syy2 + Szz2 - Sxx2 + Syz2 + Szy2;
+
+    const double C2 = -2.0 * (Sxx2 + Syy2 + Szz2 + Sxy2 + Syx2 + Sxz2 + Szx2 + Syz2 + Szy2);
+    const double C1 = 8.0 * (Sxx * Syz * Szy + Syy * Szx * Sxz + Szz * Sxy * Syx - Sxx * Syy * Szz - Syz * Szx * Sxy - Szy * Syx * Sxz);
+
+    const double SxzpSzx = Sxz + Szx, SyzpSzy = Syz + Szy, SxypSyx = Sxy + Syx;
+    const double SyzmSzy = Syz - Szy, SxzmSzx = Sxz - Szx, SxymSyx = Sxy - Syx;
+    const double SxxpSyy = Sxx + Syy, SxxmSyy = Sxx - Syy;
+    const double Sxy2Sxz2Syx2Szx2 = Sxy2 + Sxz2 - Syx2 - Szx2;
+
+    const double C0 = Sxy2Sxz2Syx2Szx2 * Sxy2Sxz2Syx2Szx2
+        + (Sxx2Syy2Szz2Syz2Szy2 + SyzSzymSyySzz2) * (Sxx2Syy2Szz2Syz2Szy2 - SyzSzymSyySzz2)
+        + (-(SxzpSzx) * (SyzmSzy) + (SxymSyx) * (SxxmSyy - Szz)) * (-(SxzmSzx) * (SyzpSzy) + (SxymSyx) * (SxxmSyy + Szz))
+        + (-(SxzpSzx) * (SyzpSzy) - (SxypSyx) * (SxxpSyy - Szz)) * (-(SxzmSzx) * (SyzmSzy) - (SxypSyx) * (SxxpSyy + Szz))
+        + (+(SxypSyx) * (SyzpSzy) + (SxzpSzx) * (SxxmSyy + Szz)) * (-(SxymSyx) * (SyzmSzy) + (SxzpSzx) * (SxxpSyy + Szz))
+        + (+(SxypSyx) * (SyzmSzy) + (SxzmSzx) * (SxxmSyy - Szz)) * (-(SxymSyx) * (SyzpSzy) + (SxzmSzx) * (SxxpSyy - Szz));
+
+    double lambda = E0;
+    for (int i = 0; i < 50; ++i) {
+        const double previous = lambda;
+        const double x2 = lambda * lambda;
+        const double b = (x2 + C2) * lambda;
+        const double a = b + C1;
+        const double denominator = 2.0 * x2 * lambda + b + a;
+        if (denominator == 0)
+            break;
+        lambda -= (a * lambda + C0) / denominator;
+        if (std::abs(lambda - previous) <= std::abs(1e-14 * lambda))
+            break;
+    }
+    if (reliable) {
+        /* the slope at a simple largest root is the product of the gaps to the other roots,
+         * lambda has to be the largest eigenvalue: K - lambda is negative semidefinite */
+        const double scale = M.norm();
+        const double slope = 4.0 * lambda * lambda * lambda + 2.0 * C2 * lambda + C1;
+        *reliable = std::isfinite(lambda) && scale > 0 && slope > 1e-3 * scale * scale * scale;
+        if (*reliable) {
+            Eigen::Matrix4d K;
+            K << Sxx + Syy + Szz, Syz - Szy, Szx - Sxz, Sxy - Syx,
+                Syz - Szy, Sxx - Syy - Szz, Sxy + Syx, Szx + Sxz,
+                Szx - Sxz, Sxy + Syx, -Sxx + Syy - Szz, Syz + Szy,
+                Sxy - Syx, Szx + Sxz, Syz + Szy, -Sxx - Syy + Szz;
+            *reliable = Eigen::LLT<Eigen::Matrix4d>((lambda + 1e-10 * scale) * Eigen::Matrix4d::Identity() - K).info() == Eigen::Success;
+        }
+    }
+    return lambda;
+}
+
+/*! \brief RMSD after the best proper rotation from the SVD, used if QCP is not reliable */
+inline double SVDRMSD(const Geometry& reference, const Geometry& target)
+{
+    if (target.rows() == 0)
+        return 0;
+    return std::sqrt((reference - target * BestFitRotationSVD(reference, target, 1)).squaredNorm() / double(target.rows()));
+}
+
+/*! \brief RMSD after the best proper rotation, without building the rotation - both have to be centered */
+inline double QCPRMSD(const double* reference, const double* target, int atoms)
+{
+    if (atoms == 0)
+        return 0;
+    Eigen::Matrix3d M;
+    bool reliable;
+    const double E0 = QCPInnerProduct(reference, target, atoms, M);
+    const double lambda = QCPMaxEigenvalue(M, E0, &reliable);
+    if (!reliable)
+        return SVDRMSD(Eigen::Map<const Geometry>(reference, atoms, 3), Eigen::Map<const Geometry>(target, atoms, 3));
+    return std::sqrt(std::max(0.0, 2.0 * (E0 - lambda) / double(atoms)));
+}
+
+inline double QCPRMSD(const Geometry& reference, const Geometry& target)
+{
+    return QCPRMSD(reference.data(), target.data(), target.rows());
+}
+
+/*! \brief Rotation R with target * R fitted onto reference, taken from the eigenvector of lambda
+ *
+ * The eigenvector is the largest column of the adjugate of (K - lambda I), lambda has to be
+ * a reliable largest eigenvalue (see QCPMaxEigenvalue). Returns false if the eigenvector is not
+ * defined or the rotation does not reach lambda, the caller falls back to SVD. */
+inline bool QCPRotation(const Eigen::Matrix3d& M, double lambda, Eigen::Matrix3d& rotation)
+{
+    const double Sxx = M(0, 0), Sxy = M(0, 1), Sxz = M(0, 2);
+    const double Syx = M(1, 0), Syy = M(1, 1), Syz = M(1, 2);
+    const double Szx = M(2, 0), Szy = M(2, 1), Szz = M(2, 2);
+
+    Eigen::Matrix4d K;
+    K << Sxx + Syy + Szz, Syz - Szy, Szx - Sxz, Sxy - Syx,
+        Syz - Szy, Sxx - Syy - Szz, Sxy + Syx, Szx + Sxz,
+        Szx - Sxz, Sxy + Syx, -Sxx + Syy - Szz, Syz + Szy,
+        Sxy - Syx, Szx + Sxz, Syz + Szy, -Sxx - Syy + Szz;
+    K -= lambda * Eigen::Matrix4d::Identity();
+
+    Eigen::Vector4d best = Eigen::Vector4d::Zero();
+    for (int column = 0; column < 4; ++column) {
+        Eigen::Vector4d q;
+        for (int row = 0; row < 4; ++row) {
+            Eigen::Matrix3d minor;
+            for (int i = 0, mi = 0; i < 4; ++i) {
+                if (i == column)
+                    continue;
+                for (int j = 0, mj = 0; j < 4; ++j) {
+                    if (j == row)
+                        continue;
+                    minor(mi, mj++) = K(i, j);
+                }
+                mi++;
+            }
+            q(row) = ((row + column) % 2 ? -1.0 : 1.0) * minor.determinant();
+        }
+        if (q.squaredNorm() > best.squaredNorm())
+            best = q;
+    }
+    const double scale = M.norm() + std::abs(lambda);
+    const double norm = best.norm();
+    if (!(norm > 1e-12 * scale * scale * scale) || !std::isfinite(norm))
+        return false;
+    best /= norm;
+
+    const double q0 = best(0), q1 = best(1), q2 = best(2), q3 = best(3);
+    rotation << q0 * q0 + q1 * q1 - q2 * q2 - q3 * q3, 2 * (q1 * q2 - q0 * q3), 2 * (q1 * q3 + q0 * q2),
+        2 * (q1 * q2 + q0 * q3), q0 * q0 - q1 * q1 + q2 * q2 - q3 * q3, 2 * (q2 * q3 - q0 * q1),
+        2 * (q1 * q3 - q0 * q2), 2 * (q2 * q3 + q0 * q1), q0 * q0 - q1 * q1 - q2 * q2 + q3 * q3;
+    /* the overlap of the rotated structures, trace(M R), has to be lambda */
+    return std::abs((M * rotation).trace() - lambda) <= 1e-8 * scale;
+}
+
+/*! \brief Calculate the best fit rotation of two sets of coordinates, both have to be centered already
+ *
+ * Proper rotations are obtained with QCP, the SVD is used for improper ones (factor = -1) and degenerate cases.
+ */
+inline Eigen::Matrix3d BestFitRotation(const Geometry& reference, const Geometry& target, int factor = 1)
+{
+    if (factor == 1) {
+        Eigen::Matrix3d M, rotation;
+        bool reliable;
+        const double E0 = QCPInnerProduct(reference.data(), target.data(), target.rows(), M);
+        const double lambda = QCPMaxEigenvalue(M, E0, &reliable);
+        if (reliable && QCPRotation(M, lambda, rotation))
+            return rotation;
+    }
+    return BestFitRotationSVD(reference, target, factor);
+}
+
+/*! \brief One reference against count targets stored one after another (atoms x 3 each, row major)
+ *
+ * All structures have to be centered. rmsd has to hold count values, rotations (optional) as well.
+ */
+inline void QCPBatch(const Geometry& reference, const double* targets, int count, double* rmsd, Eigen::Matrix3d* rotations = nullptr)
+{
+    const int atoms = reference.rows();
+    Eigen::Matrix3d M;
+    bool reliable;
+    for (int i = 0; i < count; ++i) {
+        const double* target = targets + std::size_t(3) * atoms * i;
+        const double E0 = QCPInnerProduct(reference.data(), target, atoms, M);
+        const double lambda = QCPMaxEigenvalue(M, E0, &reliable);
+        if (!reliable) {
+            const Eigen::Map<const Geometry> structure(target, atoms, 3);
+            const Eigen::Matrix3d rotation = BestFitRotationSVD(reference, structure, 1);
+            rmsd[i] = atoms ? std::sqrt((reference - structure * rotation).squaredNorm() / double(atoms)) : 0;
+            if (rotations)
+                rotations[i] = rotation;
+            continue;
+        }
+        rmsd[i] = atoms ? std::sqrt(std::max(0.0, 2.0 * (E0 - lambda) / double(atoms))) : 0;
+        if (rotations && !QCPRotation(M, lambda, rotations[i]))
+            rotations[i] = BestFitRotationSVD(reference, Eigen::Map<const Geometry>(target, atoms, 3), 1);
+    }
+}
+
 inline Eigen::Matrix3d BestFitRotation(const Molecule& reference, const Molecule& target, int factor = 1)
 {
     return BestFitRotation(reference.getGeometry(), target.getGeometry(), factor);
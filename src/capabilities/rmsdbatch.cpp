@@ -0,0 +1,142 @@
+/*
+ * < RMSD of one structure against many stored ones. >
+ * Copyright (C) 2025 Conrad Hübler <Conrad.Huebler@gmx.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "rmsd_functions.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "rmsdbatch.h"
+
+void RMSDBatch::addGeometry(const Geometry& geometry)
+{
+    if (m_norms.empty())
+        m_atoms = geometry.rows();
+    if (geometry.rows() != m_atoms)
+        return;
+    const Eigen::RowVector3d centroid = geometry.colwise().mean();
+    double norm = 0;
+    const std::size_t offset = m_coordinates.size();
+    m_coordinates.resize(offset + std::size_t(3) * m_atoms);
+    for (int j = 0; j < 3; ++j) {
+        double* block = m_coordinates.data() + offset + std::size_t(j) * m_atoms;
+        for (int i = 0; i < m_atoms; ++i) {
+            block[i] = geometry(i, j) - centroid(j);
+            norm += block[i] * block[i];
+        }
+    }
+    m_norms.push_back(norm);
+}
+
+void RMSDBatch::clear()
+{
+    m_coordinates.clear();
+    m_norms.clear();
+    m_atoms = 0;
+}
+
+void RMSDBatch::Calculate(const Geometry& query, std::vector<double>& rmsd, std::vector<Geometry>* gradients) const
+{
+    rmsd.assign(size(), 0);
+    if (gradients)
+        gradients->resize(size());
+    if (size() == 0 || query.rows() != m_atoms)
+        return;
+
+    const Geometry centered = query.rowwise() - query.colwise().mean();
+    std::vector<double> blocks(std::size_t(3) * m_atoms);
+    for (int j = 0; j < 3; ++j)
+        Eigen::Map<Eigen::VectorXd>(blocks.data() + std::size_t(j) * m_atoms, m_atoms) = centered.col(j);
+    const double norm = centered.squaredNorm();
+
+    /* a comparison takes microseconds, threads only pay off for many structures */
+    const int chunk = 32;
+    if (m_threads > 1 && size() > 2 * chunk) {
+        std::atomic<int> next(0);
+        CxxThreadPool* pool = new CxxThreadPool;
+        pool->setProgressBar(CxxThreadPool::ProgressBarType::None);
+        pool->setActiveThreadCount(m_threads);
+        for (int i = 0; i < std::min(m_threads, (size() + chunk - 1) / chunk); ++i)
+            pool->addThread(new RMSDBatchThread(this, blocks.data(), norm, &centered, rmsd.data(), gradients, &next, chunk));
+        pool->StartAndWait();
+        delete pool;
+    } else
+        Evaluate(blocks.data(), norm, centered, 0, size(), rmsd.data(), gradients);
+}
+
+double RMSDBatch::RMSD(const Geometry& query, int index) const
+{
+    if (index < 0 || index >= size() || query.rows() != m_atoms)
+        return 0;
+    const Geometry centered = query.rowwise() - query.colwise().mean();
+    Geometry stored(m_atoms, 3);
+    for (int j = 0; j < 3; ++j)
+        stored.col(j) = Eigen::Map<const Eigen::VectorXd>(m_coordinates.data() + std::size_t(3) * m_atoms * index + std::size_t(j) * m_atoms, m_atoms);
+    const Eigen::Matrix3d M = centered.transpose() * stored;
+    bool reliable;
+    const double lambda = RMSDFunctions::QCPMaxEigenvalue(M, 0.5 * (centered.squaredNorm() + m_norms[index]), &reliable);
+    Eigen::Matrix3d rotation;
+    if (!reliable || !RMSDFunctions::QCPRotation(M, lambda, rotation))
+        rotation = RMSDFunctions::BestFitRotationSVD(centered, stored, 1);
+    return std::sqrt((centered - stored * rotation).squaredNorm() / double(m_atoms));
+}
+
+void RMSDBatch::Evaluate(const double* query, double norm, const Geometry& centered, int begin, int end, double* rmsd, std::vector<Geometry>* gradients) const
+{
+    const int atoms = m_atoms;
+    Eigen::Matrix3d M;
+    bool reliable;
+    for (int index = begin; index < end; ++index) {
+        const double* stored = m_coordinates.data() + std::size_t(3) * atoms * index;
+        for (int a = 0; a < 3; ++a)
+            for (int b = 0; b < 3; ++b)
+                M(a, b) = Eigen::Map<const Eigen::VectorXd>(query + std::size_t(a) * atoms, atoms).dot(Eigen::Map<const Eigen::VectorXd>(stored + std::size_t(b) * atoms, atoms));
+        const double E0 = 0.5 * (norm + m_norms[index]);
+        const double lambda = RMSDFunctions::QCPMaxEigenvalue(M, E0, &reliable);
+        if (reliable && !gradients) {
+            rmsd[index] = std::sqrt(std::max(0.0, 2.0 * (E0 - lambda) / double(atoms)));
+            continue;
+        }
+
+        /* degenerate structures and gradients need the rotated coordinates, the RMSD is taken from them */
+        Geometry aligned(atoms, 3);
+        for (int j = 0; j < 3; ++j)
+            aligned.col(j) = Eigen::Map<const Eigen::VectorXd>(stored + std::size_t(j) * atoms, atoms);
+        Eigen::Matrix3d rotation;
+        if (!reliable || !RMSDFunctions::QCPRotation(M, lambda, rotation))
+            rotation = RMSDFunctions::BestFitRotationSVD(centered, aligned, 1);
+        aligned = aligned * rotation;
+        const Geometry difference = centered - aligned;
+        rmsd[index] = std::sqrt(difference.squaredNorm() / double(atoms));
+        if (!gradients)
+            continue;
+        if (rmsd[index] > 0)
+            (*gradients)[index] = difference / (rmsd[index] * atoms);
+        else
+            (*gradients)[index] = Geometry::Zero(atoms, 3);
+    }
+}
+
+int RMSDBatchThread::execute()
+{
+    const int count = m_batch->size();
+    for (int begin = m_next->fetch_add(m_chunk); begin < count; begin = m_next->fetch_add(m_chunk))
+        m_batch->Evaluate(m_query, m_norm, *m_centered, begin, std::min(count, begin + m_chunk), m_rmsd, m_gradients);
+    return 0;
+}
@@ -0,0 +1,104 @@
+/*
+ * < RMSD of one structure against many stored ones. >
+ * Copyright (C) 2025 Conrad Hübler <Conrad.Huebler@gmx.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#pragma once
+
+#include "src/core/global.h"
+
+#include "external/CxxThreadPool/include/CxxThreadPool.h"
+
+#include <atomic>
+#include <vector>
+
+/*! \brief Best fit RMSD of one query structure against many stored structures
+ *
+ * The stored geometries are centered once and kept in one contiguous buffer,
+ * every structure as x of all atoms, then y, then z, together with its squared
+ * norm. A comparison is the 3x3 inner product of the (centered) query with a
+ * stored structure and the QCP eigenvalue, no molecules are copied and no rotated
+ * coordinates are built unless gradients are requested. This is the same RMSD
+ * RMSDDriver gives for structures with identical atom order (no reordering, all
+ * atoms), the gradient is the one of RMSDDriver::Gradient with the query as reference.
+ *
+ * Taken from the eigenvalue alone, the RMSD suffers from the cancellation in E0 - lambda
+ * and agrees with RMSDDriver only to about 1e-7 (worst close to zero). Values that are
+ * compared against a threshold within Accuracy should be taken from RMSD(), which
+ * rotates the stored structure and agrees to about 1e-15. With gradients and for degenerate
+ * structures (linear, one or two atoms, see QCPMaxEigenvalue) the RMSD is always taken
+ * from the rotated coordinates, the rotation from the SVD in the latter case.
+ */
+class RMSDBatch {
+public:
+    RMSDBatch() = default;
+
+    static constexpr double Accuracy = 1e-6;
+
+    inline void setThreads(int threads) { m_threads = threads; }
+
+    /*! \brief Add a geometry, all geometries have to have the same number of atoms */
+    void addGeometry(const Geometry& geometry);
+    void clear();
+
+    inline int size() const { return m_norms.size(); }
+    inline int Atoms() const { return m_atoms; }
+
+    /*! \brief RMSD of the query against every stored geometry, gradients (d rmsd / d query) are optional */
+    void Calculate(const Geometry& query, std::vector<double>& rmsd, std::vector<Geometry>* gradients = nullptr) const;
+
+    /*! \brief RMSD of the query against the stored geometry index from the rotated coordinates */
+    double RMSD(const Geometry& query, int index) const;
+
+    /*! \brief Evaluate the stored structures begin ... end-1, query has to be centered and stored as x, y, z blocks */
+    void Evaluate(const double* query, double norm, const Geometry& centered, int begin, int end, double* rmsd, std::vector<Geometry>* gradients) const;
+
+private:
+    std::vector<double> m_coordinates;
+    std::vector<double> m_norms;
+    int m_atoms = 0, m_threads = 1;
+};
+
+/*! \brief Evaluates chunks of stored structures of a batch, the chunks are taken from a shared counter */
+class RMSDBatchThread : public CxxThread {
+public:
+    RMSDBatchThread(const RMSDBatch* batch, const double* query, double norm, const Geometry* centered, double* rmsd, std::vector<Geometry>* gradients, std::atomic<int>* next, int chunk)
+        : m_batch(batch)
+        , m_query(query)
+        , m_norm(norm)
+        , m_centered(centered)
+        , m_rmsd(rmsd)
+        , m_gradients(gradients)
+        , m_next(next)
+        , m_chunk(chunk)
+    {
+        setAutoDelete(true);
+    }
+    ~RMSDBatchThread() = default;
+
+    virtual int execute() override;
+
+private:
+    const RMSDBatch* m_batch;
+    const double* m_query;
+    double m_norm;
+    const Geometry* m_centered;
+    double* m_rmsd;
+    std::vector<Geometry>* m_gradients;
+    std::atomic<int>* m_next;
+    int m_chunk;
+};
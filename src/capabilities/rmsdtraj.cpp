@@ -26,6 +26,7 @@
 #include "src/core/elements.h"
 #include "src/core/fileiterator.h"
 #include "src/core/molecule.h"
+#include "src/core/outputbuffer.h"
 
 #include "src/tools/formats.h"
 #include "src/tools/general.h"
@@ -54,6 +55,7 @@ RMSDTraj::~RMSDTraj()
     for (int i = 0; i < m_stored_structures.size(); ++i)
         delete m_stored_structures[i];
     delete m_driver;
+    delete m_aligned;
 }
 
 bool RMSDTraj::Initialise()
@@ -68,12 +70,13 @@ bool RMSDTraj::Initialise()
         std::cout << "  No                                '" << std::endl;
     std::cout << "'''''''''''''''''''''''''''''''''''''''''''''''''''''''''''" << std::endl;
     if (m_reference.compare("none") != 0) {
-        m_stored_structures.push_back(new Molecule(Files::LoadFile(m_reference)));
+        Molecule reference = Files::LoadFile(m_reference);
+        StoreStructure(&reference);
         m_atoms = m_stored_structures[0]->AtomCount();
     }
 
     m_outfile = m_filename;
-    for (int i = 0; i < 4; ++i)
+    for (int i = 0; i < (BinaryTrajectory::isBinary(m_filename) ? 5 : 4); ++i)
         m_outfile.pop_back();
 
     if (m_writeRMSD)
@@ -106,24 +109,28 @@ bool RMSDTraj::Initialise()
     m_driver->setForceReorder(false);
     m_driver->setCheckConnections(false);
     m_driver->setFragment(m_fragment);
-    std::ofstream export_file;
-    if (m_writeUnique) {
-        export_file.open(m_outfile + ".unique.xyz");
-        export_file.close();
-    }
-    if (m_writeAligned) {
-        export_file.open(m_outfile + "_aligned.xyz");
-        export_file.close();
-    }
+    if (m_writeUnique)
+        OutputBuffer::Truncate(m_outfile + ".unique.xyz");
+    if (m_writeAligned && m_trajectory_format.compare("xyz") != 0) {
+        delete m_aligned;
+        m_aligned = new BinaryTrajectoryWriter(m_outfile + "_aligned.ctrj", m_trajectory_format);
+    } else if (m_writeAligned)
+        OutputBuffer::Truncate(m_outfile + "_aligned.xyz");
     std::ifstream input(m_filename);
     std::vector<std::string> lines;
     //    int atoms = 0, atoms2 = 0;
     m_currentIndex = 0;
     //  int i = 0;
     //    int molecule = 0;
-    std::ifstream inFile(m_filename);
-    m_max_lines = std::count(std::istreambuf_iterator<char>(inFile),
-        std::istreambuf_iterator<char>(), '\n');
+    if (BinaryTrajectory::isBinary(m_filename)) {
+        /* no lines to count, the frames are counted like xyz blocks of atoms + 2 lines */
+        FileIterator file(m_filename, true);
+        m_max_lines = file.FrameCount() ? file.FrameCount() * (file.Frame(0).AtomCount() + 2) : 0;
+    } else {
+        std::ifstream inFile(m_filename);
+        m_max_lines = std::count(std::istreambuf_iterator<char>(inFile),
+            std::istreambuf_iterator<char>(), '\n');
+    }
 
     std::ifstream second;
     if (m_pairwise) {
@@ -154,9 +161,12 @@ void RMSDTraj::ProcessSingleFile()
             std::cout << "New structure added ... ( " << m_stored_structures.size() << "). " << /*  int(m_currentIndex / double(m_max_lines) * 100) << " % done ...!" << */ std::endl;
         } else {
         }
-        if (progress[int((m_currentIndex / double(m_max_lines)) * 100) / 10] == 0) {
-            progress[int((m_currentIndex / double(m_max_lines)) * 100) / 10] = 1;
-            std::cout << int(m_currentIndex / double(m_max_lines) * 100) << " % done ...!" << std::endl;
+        if (m_max_lines) {
+            const int bucket = std::min(9, int((m_currentIndex / double(m_max_lines)) * 100) / 10);
+            if (progress[bucket] == 0) {
+                progress[bucket] = 1;
+                std::cout << int(m_currentIndex / double(m_max_lines) * 100) << " % done ...!" << std::endl;
+            }
         }
         delete molecule;
         if (CheckStop())
@@ -187,7 +197,7 @@ bool RMSDTraj::CheckMolecule(Molecule* molecule)
             // std::cout << "First structure added!" << std::endl;
             result = true;
         }
-        m_stored_structures.push_back(new Molecule(molecule));
+        StoreStructure(molecule);
         m_initial = molecule;
         m_previous = molecule;
         return result;
@@ -225,7 +235,9 @@ bool RMSDTraj::CheckMolecule(Molecule* molecule)
         m_rmsd_file << m_driver->RMSD() << "\t" << std::setprecision(10) << energy << std::endl;
         m_rmsd_vector.push_back(m_driver->RMSD());
         m_energy_vector.push_back(energy);
-        if (m_writeAligned) {
+        if (m_aligned)
+            m_aligned->Write(m_driver->TargetAligned(), m_aligned->Frames());
+        else if (m_writeAligned) {
             m_driver->TargetAligned().appendXYZFile(m_outfile + "_aligned.xyz");
         }
 
@@ -239,7 +251,23 @@ bool RMSDTraj::CheckMolecule(Molecule* molecule)
         }
 
         double first_rmsd = m_driver->RMSD();
-        if (m_writeUnique) {
+        if (m_writeUnique && m_batch_valid && !m_heavy && m_fragment == -1 && molecule->Atoms() == m_stored_structures[0]->Atoms()) {
+            /* no reordering takes place, all stored structures are compared in one call
+             * the driver was run against the first stored structure last, its aligned target is stored */
+            m_batch.Calculate(molecule->getGeometry(), rmsd_results);
+            bool perform_rmsd = first_rmsd > m_rmsd_threshold;
+            for (int i = 0; i < rmsd_results.size() && perform_rmsd; ++i) {
+                if (std::abs(rmsd_results[i] - m_rmsd_threshold) < RMSDBatch::Accuracy)
+                    rmsd_results[i] = m_batch.RMSD(molecule->getGeometry(), i);
+                perform_rmsd = rmsd_results[i] > m_rmsd_threshold;
+            }
+            if (perform_rmsd) {
+                molecule->LoadMolecule(m_driver->TargetAlignedReference());
+                StoreStructure(molecule);
+                molecule->appendXYZFile(m_outfile + ".unique.xyz");
+                result = true;
+            }
+        } else if (m_writeUnique) {
             bool perform_rmsd = true;
             //  std::cout << std::endl;
             for (std::size_t mols = m_stored_structures.size() - 1; mols >= 0 && perform_rmsd && mols <= m_stored_structures.size(); --mols) {
@@ -258,7 +286,7 @@ bool RMSDTraj::CheckMolecule(Molecule* molecule)
 
             if (perform_rmsd) {
                 molecule->LoadMolecule(m_driver->TargetAlignedReference());
-                m_stored_structures.push_back(new Molecule(molecule));
+                StoreStructure(molecule);
                 molecule->appendXYZFile(m_outfile + ".unique.xyz");
                 //                std::cout << "New structure added ... ( " << m_stored_structures.size() << "). " << /*  int(m_currentIndex / double(m_max_lines) * 100) << " % done ...!" << */ std::endl;
                 result = true;
@@ -287,6 +315,13 @@ bool RMSDTraj::CheckMolecule(Molecule* molecule)
     return result;
 }
 
+void RMSDTraj::StoreStructure(const Molecule* molecule)
+{
+    m_stored_structures.push_back(new Molecule(molecule));
+    m_batch_valid = m_batch_valid && molecule->Atoms() == m_stored_structures[0]->Atoms();
+    m_batch.addGeometry(molecule->getGeometry());
+}
+
 void RMSDTraj::CompareTrajectories()
 {
     FileIterator file1(m_filename);
@@ -361,6 +396,7 @@ void RMSDTraj::LoadControlJson()
     m_pcafile = Json2KeyWord<bool>(m_defaults, "pcafile");
     m_writeUnique = Json2KeyWord<bool>(m_defaults, "writeUnique");
     m_writeAligned = Json2KeyWord<bool>(m_defaults, "writeAligned");
+    m_trajectory_format = Json2KeyWord<std::string>(m_defaults, "trajectory_format");
     m_rmsd_threshold = Json2KeyWord<double>(m_defaults, "rmsd");
     m_fragment = Json2KeyWord<int>(m_defaults, "fragment");
     m_reference = Json2KeyWord<std::string>(m_defaults, "reference");
@@ -372,6 +408,8 @@ void RMSDTraj::LoadControlJson()
     m_filter = Json2KeyWord<bool>(m_defaults, "filter");
     m_writeRMSD = Json2KeyWord<bool>(m_defaults, "writeRMSD");
     m_offset = m_defaults["offset"];
+    m_threads = Json2KeyWord<int>(m_defaults, "threads");
+    m_batch.setThreads(m_threads);
 }
 
 void RMSDTraj::Optimise()
@@ -26,6 +26,9 @@
 #include <string>
 #include <vector>
 
+#include "src/capabilities/rmsdbatch.h"
+
+#include "src/core/binarytrajectory.h"
 #include "src/core/molecule.h"
 
 #include "curcumamethod.h"
@@ -50,7 +53,9 @@ const json RMSDTrajJson{
     { "opt", false },
     { "filter", false },
     { "writeRMSD", true },
-    { "offset", 0 }
+    { "offset", 0 },
+    { "threads", 1 },
+    { "trajectory_format", "xyz" } // format of the aligned trajectory, xyz, float32, float64 or compressed
 };
 
 class RMSDTraj : public CurcumaMethod {
@@ -107,9 +112,16 @@ private:
     void ProcessSingleFile();
     void CompareTrajectories();
 
-    std::string m_filename, m_reference, m_second_file, m_outfile;
+    /*! \brief Keep a copy of a unique structure, the batch of stored geometries is kept in sync */
+    void StoreStructure(const Molecule* molecule);
+
+    std::string m_filename, m_reference, m_second_file, m_outfile, m_trajectory_format = "xyz";
+    BinaryTrajectoryWriter* m_aligned = nullptr;
     std::ofstream m_rmsd_file, m_pca_file, m_pairwise_file;
     std::vector<Molecule*> m_stored_structures;
+    /* stored structures with identical atom order, compared without reordering in one call */
+    RMSDBatch m_batch;
+    bool m_batch_valid = true;
     Molecule *m_initial, *m_previous;
     RMSDDriver* m_driver;
     std::vector<double> m_rmsd_vector, m_energy_vector;
@@ -118,6 +130,7 @@ private:
     int m_atoms = -1;
     int m_max_lines = -1;
     int m_offset = 0;
+    int m_threads = 1;
     bool m_writeUnique = false, m_pairwise = false, m_heavy = false, m_pcafile = false, m_writeAligned = false, m_ref_first = false, m_opt = false, m_filter = false, m_writeRMSD = true;
     bool m_allxyz = false;
     double m_rmsd_threshold = 1.0;
@@ -52,11 +52,9 @@
 
 BiasThread::BiasThread(const Molecule& reference, const json& rmsdconfig, bool nocolvarfile, bool nohillsfile)
     : m_reference(reference)
-    , m_target(reference)
     , m_nocolvarfile(nocolvarfile)
     , m_nohillsfile(nohillsfile)
 {
-    m_driver = RMSDDriver(rmsdconfig, true);
     m_config = rmsdconfig;
     setAutoDelete(true);
     m_current_bias = 0;
@@ -75,14 +73,12 @@ int BiasThread::execute()
         return 0;
     m_current_bias = 0;
     m_counter = 0;
-    m_driver.setReference(m_reference);
     m_gradient = Eigen::MatrixXd::Zero(m_reference.AtomCount(), 3);
+    m_batch.Calculate(m_reference.getGeometry(), m_rmsd, &m_gradients);
 
     for (int i = 0; i < m_biased_structures.size(); ++i) {
         double factor = 1;
-        m_target.setGeometry(m_biased_structures[i].geometry);
-        m_driver.setTarget(m_target);
-        double rmsd = m_driver.BestFitRMSD();
+        double rmsd = m_rmsd[i];
         double expr = exp(-rmsd * rmsd * m_alpha);
         double bias_energy = expr * m_dT;
         factor = m_biased_structures[i].factor;
@@ -103,10 +99,9 @@ int BiasThread::execute()
 
         m_current_bias += bias_energy;
         if (m_nocolvarfile == false) {
-            std::ofstream colvarfile;
-            colvarfile.open("COLVAR_" + std::to_string(m_biased_structures[i].index), std::iostream::app);
+            std::ostringstream colvarfile;
             colvarfile << m_currentStep << " " << rmsd << " " << bias_energy << " " << m_biased_structures[i].counter << " " << factor << std::endl;
-            colvarfile.close();
+            OutputBuffer::Append("COLVAR_" + std::to_string(m_biased_structures[i].index), colvarfile.str());
         }
         /*
         if(nohillsfile == false)
@@ -124,7 +119,7 @@ int BiasThread::execute()
 
         double dEdR = -2 * m_alpha * m_k / m_atoms * exp(-rmsd * rmsd * m_alpha) * factor * m_dT;
 
-        m_gradient += m_driver.Gradient() * dEdR;
+        m_gradient += m_gradients[i] * dEdR;
         m_counter += m_biased_structures[i].counter;
     }
     return 1;
@@ -158,6 +153,8 @@ SimpleMD::~SimpleMD()
 {
     for (const auto & m_unique_structure : m_unique_structures)
         delete m_unique_structure;
+    delete m_writer;
+    delete m_trajectory;
     // delete m_bias_pool;
 }
 
@@ -222,6 +219,12 @@ void SimpleMD::LoadControlJson()
     m_scaling_json = Json2KeyWord<std::string>(m_defaults, "scaling_json");
 
     m_writeXYZ = Json2KeyWord<bool>(m_defaults, "writeXYZ");
+    m_trajectory_format = Json2KeyWord<std::string>(m_defaults, "trajectory_format");
+    m_trajectory_precision = Json2KeyWord<double>(m_defaults, "trajectory_precision");
+    m_trajectory_velocities = Json2KeyWord<bool>(m_defaults, "trajectory_velocities");
+    m_async_io = Json2KeyWord<bool>(m_defaults, "async_io");
+    m_io_slots = Json2KeyWord<int>(m_defaults, "io_slots");
+    m_io_sync = Json2KeyWord<bool>(m_defaults, "io_sync");
     m_writeinit = Json2KeyWord<bool>(m_defaults, "writeinit");
     m_mtd = Json2KeyWord<bool>(m_defaults, "mtd");
     m_mtd_dT = Json2KeyWord<int>(m_defaults, "mtd_dT");
@@ -369,11 +372,11 @@ bool SimpleMD::Initialise()
     if (m_molecule.AtomCount() == 0)
         return false;
 
-    if (!m_restart) {
-        std::ofstream result_file;
-        result_file.open(Basename() + ".trj.xyz");
-        result_file.close();
-    }
+    if (m_writeXYZ && m_trajectory_format.compare("xyz") != 0) {
+        delete m_trajectory;
+        m_trajectory = new BinaryTrajectoryWriter(Basename() + ".trj.ctrj", m_trajectory_format, m_restart, m_trajectory_precision);
+    } else if (!m_restart)
+        OutputBuffer::Truncate(Basename() + ".trj.xyz");
 
     if (m_seed == -1) {
         const auto start = std::chrono::high_resolution_clock::now();
@@ -819,6 +822,12 @@ void SimpleMD::InitialiseWalls()
 }
 
 nlohmann::json SimpleMD::WriteRestartInformation()
+{
+    return RestartInformation(true);
+}
+
+/* without matrices, the output thread adds them to its own snapshot of the state */
+nlohmann::json SimpleMD::RestartInformation(bool matrices)
 {
     nlohmann::json restart;
     restart["method"] = m_method;
@@ -828,9 +837,11 @@ nlohmann::json SimpleMD::WriteRestartInformation()
     restart["T"] = m_T0;
     restart["currentStep"] = m_currentStep;
     restart["seed"] = m_seed;
-    restart["velocities"] = Tools::Geometry2String(m_eigen_velocities);
-    restart["geometry"] = Tools::Geometry2String(m_eigen_geometry);
-    restart["gradient"] = Tools::Geometry2String(m_eigen_gradient);
+    if (matrices) {
+        restart["velocities"] = Tools::Geometry2String(m_eigen_velocities);
+        restart["geometry"] = Tools::Geometry2String(m_eigen_geometry);
+        restart["gradient"] = Tools::Geometry2String(m_eigen_gradient);
+    }
     restart["rmrottrans"] = m_rmrottrans;
     restart["nocenter"] = m_nocenter;
     restart["COM"] = m_COM;
@@ -1198,6 +1209,13 @@ void SimpleMD::start()
     m_Etot = m_Epot + m_Ekin;
     AverageQuantities();
     int m_step = 0;
+    if (m_async_io) {
+        delete m_writer;
+        m_writer = new AsyncTrajectoryWriter(m_molecule, m_io_slots);
+        m_writer->setTrajectory(m_writeXYZ ? Basename() + ".trj.xyz" : std::string(), m_trajectory, m_trajectory_velocities);
+        m_writer->setRestart("curcuma_restart.json", MethodName()[0], m_io_sync);
+        m_writer->Start();
+    }
     WriteGeometry();
 #ifdef USE_Plumed
     if (m_mtd) {
@@ -1275,6 +1293,7 @@ void SimpleMD::start()
         auto step0 = std::chrono::system_clock::now();
 
         if (CheckStop() == true) {
+            FinishOutput();
             TriggerWriteRestart();
             aborted = true;
 #ifdef USE_Plumed
@@ -1314,33 +1333,33 @@ void SimpleMD::start()
         if (m_dipole && m_method == "gfn2") {
             //linear Dipoles
             auto curr_dipoles_lin = m_molecule.CalculateDipoleMoments(m_scaling_vector_linear, m_start_fragments);
-            std::ofstream file;
-            file.open(Basename() + "_dipole_linear.out", std::ios_base::app);
+            std::ostringstream file;
             Position d = {0,0,0};
             for (const auto& dipole_lin : curr_dipoles_lin) {
                 d += dipole_lin;
                 file << dipole_lin[0] << " " << dipole_lin[1] << " " << dipole_lin[2] << " " << dipole_lin.norm() << ", ";
             }
             file << d[0] << " " << d[1] << " " << d[2] << ", " << m_molecule.getDipole()[0] << " " << m_molecule.getDipole()[1] << " " << m_molecule.getDipole()[2] << std::endl;
-            file.close();
+            OutputBuffer::Append(Basename() + "_dipole_linear.out", file.str());
             //nonlinear Dipoles
             auto curr_dipoles_nlin = m_molecule.CalculateDipoleMoments(m_scaling_vector_nonlinear, m_start_fragments);
-            std::ofstream file2;
-            file2.open(Basename() + "_dipole_nonlinear.out", std::ios_base::app);
+            std::ostringstream file2;
             Position sum = {0,0,0};
             for (const auto& dipole_nlin : curr_dipoles_nlin) {
                 sum += dipole_nlin;
                 file2 << dipole_nlin[0] << " " << dipole_nlin[1] << " " << dipole_nlin[2] << " " << dipole_nlin.norm() <<", ";
             }
             file2 << sum[0] << " " << sum[1] << " " << sum[2] << ", " << m_molecule.getDipole()[0] << " " << m_molecule.getDipole()[1] << " " << m_molecule.getDipole()[2] << std::endl;
-            file2.close();
+            OutputBuffer::Append(Basename() + "_dipole_nonlinear.out", file2.str());
         }
         //////////// Dipole
 
 
         if (m_step % m_dump == 0) {
             if (bool write = WriteGeometry()) {
-                states.push_back(WriteRestartInformation());
+                /* the states are only needed to rescue the simulation */
+                if (m_rescue)
+                    states.push_back(WriteRestartInformation());
                 m_current_rescue = 0;
             } else if (!write && m_rescue && states.size() > (1 - m_current_rescue)) {
                 std::cout << "Molecule exploded, resetting to previous state ..." << std::endl;
@@ -1367,6 +1386,7 @@ void SimpleMD::start()
             PrintStatus();
             fmt::print(fg(fmt::color::salmon) | fmt::emphasis::bold, "Simulation got unstable, exiting!\n");
 
+            FinishOutput();
             std::ofstream restart_file("unstable_curcuma.json");
             nlohmann::json restart;
             restart[MethodName()[0]] = WriteRestartInformation();
@@ -1415,6 +1435,7 @@ void SimpleMD::start()
         m_currentStep += m_dT;
         m_time_step += std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now() - step0).count();
     } //MD Loop end here
+    FinishOutput();
     PrintStatus();
     if (m_thermostat == "csvr")
         std::cout << "Exchange with heat bath " << m_Ekin_exchange << "Eh" << std::endl;
@@ -1558,7 +1579,7 @@ void SimpleMD::Rattle()
      * updated velocities of the second atom (minus instead of plus)
      * and adjusted to some needs
      */
-    TriggerWriteRestart();
+    WriteRestart();
 
     auto* coord = new double[3 * m_natoms];
     double m_dT_inverse = 1 / m_dT;
@@ -2097,11 +2118,8 @@ void SimpleMD::ApplyRMSDMTD()
         m_bias_threads[0]->addGeometry(current_geometry, 0, m_currentStep, 0);
         m_bias_structure_count++;
         m_rmsd_mtd_molecule.writeXYZFile(Basename() + ".mtd.xyz");
-        if (m_nocolvarfile == false) {
-            std::ofstream colvarfile;
-            colvarfile.open("COLVAR");
-            colvarfile.close();
-        }
+        if (m_nocolvarfile == false)
+            OutputBuffer::Truncate("COLVAR");
     }
     if (m_threads == 1 || m_bias_structure_count == 1) {
         for (auto & m_bias_thread : m_bias_threads) {
@@ -2151,8 +2169,7 @@ void SimpleMD::ApplyRMSDMTD()
     m_rmsd_mtd_molecule.setGeometry(current_geometry);
 
     if (m_nocolvarfile == false) {
-        std::ofstream colvarfile;
-        colvarfile.open("COLVAR", std::iostream::app);
+        std::ostringstream colvarfile;
         colvarfile << m_currentStep << " ";
         if (m_rmsd_fragment_count < 2)
             colvarfile << rmsd_reference << " ";
@@ -2162,7 +2179,7 @@ void SimpleMD::ApplyRMSDMTD()
                 colvarfile << (m_rmsd_mtd_molecule.Centroid(true, i) - m_rmsd_mtd_molecule.Centroid(true, j)).norm() << " ";
             }
         colvarfile << current_bias << " " << std::endl;
-        colvarfile.close();
+        OutputBuffer::Append("COLVAR", colvarfile.str());
     }
     m_bias_energy += current_bias;
 
@@ -2592,13 +2609,32 @@ bool SimpleMD::WriteGeometry()
         geometry(i, 1) = m_eigen_geometry.data()[3 * i + 1];
         geometry(i, 2) = m_eigen_geometry.data()[3 * i + 2];
     }
-    TriggerWriteRestart();
     m_molecule.setGeometry(geometry);
-
     if (m_writeXYZ) {
         m_molecule.setEnergy(m_Epot);
         m_molecule.setName(std::to_string(m_currentStep));
-        m_molecule.appendXYZFile(Basename() + ".trj.xyz");
+    }
+
+    if (m_writer) {
+        /* the trajectory frame and the restart file are written by the output thread */
+        MDSnapshot* snapshot = m_writer->Acquire();
+        snapshot->geometry = m_eigen_geometry;
+        snapshot->velocities = m_eigen_velocities;
+        snapshot->gradient = m_eigen_gradient;
+        snapshot->energy = m_Epot;
+        snapshot->step = m_currentStep;
+        snapshot->frame = m_writeXYZ;
+        snapshot->restart = RestartInformation(false);
+        snapshot->has_restart = true;
+        m_writer->Publish();
+    } else {
+        TriggerWriteRestart();
+        if (m_writeXYZ) {
+            if (m_trajectory)
+                m_trajectory->Write(m_molecule, m_currentStep, m_trajectory_velocities ? &m_eigen_velocities : nullptr);
+            else
+                m_molecule.appendXYZFile(Basename() + ".trj.xyz");
+        }
     }
     if (m_writeUnique) {
         if (m_unqiue->CheckMolecule(new Molecule(m_molecule))) {
@@ -2611,6 +2647,38 @@ bool SimpleMD::WriteGeometry()
     return result;
 }
 
+void SimpleMD::WriteRestart()
+{
+    if (!m_writer) {
+        TriggerWriteRestart();
+        return;
+    }
+    /* a restart without frame is skipped if the output thread is busy, the next one follows soon */
+    MDSnapshot* snapshot = m_writer->Acquire(false);
+    if (!snapshot)
+        return;
+    snapshot->geometry = m_eigen_geometry;
+    snapshot->velocities = m_eigen_velocities;
+    snapshot->gradient = m_eigen_gradient;
+    snapshot->frame = false;
+    snapshot->restart = RestartInformation(false);
+    snapshot->has_restart = true;
+    m_writer->Publish();
+}
+
+void SimpleMD::FinishOutput()
+{
+    if (!m_writer)
+        return;
+    m_writer->Finish();
+    std::cout << "Output thread: " << m_writer->Written() << " frames written, integrator stalled " << m_writer->Stalls() << " times (" << m_writer->StallTime() << " s)";
+    if (m_writer->Dropped())
+        std::cout << ", " << m_writer->Dropped() << " intermediate restart files skipped";
+    std::cout << std::endl;
+    delete m_writer;
+    m_writer = nullptr;
+}
+
 void SimpleMD::None()
 {
 }
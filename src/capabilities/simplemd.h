@@ -25,16 +25,21 @@
 #include <functional>
 #include <random>
 #include <ratio>
+#include <sstream>
 
 #ifdef USE_Plumed
 #include "plumed2/src/wrapper/Plumed.h"
 #endif
 
 #include "src/capabilities/rmsd.h"
+#include "src/capabilities/rmsdbatch.h"
 #include "src/capabilities/rmsdtraj.h"
 
+#include "src/core/asyncwriter.h"
+#include "src/core/binarytrajectory.h"
 #include "src/core/energycalculator.h"
 #include "src/core/molecule.h"
+#include "src/core/outputbuffer.h"
 
 #include "external/CxxThreadPool/include/CxxThreadPool.h"
 
@@ -65,12 +70,9 @@ public:
         str.counter = 1;
         str.index = index;
         m_biased_structures.push_back(str);
-        if (m_nocolvarfile == false) {
-            std::ofstream colvarfile;
-            colvarfile.open("COLVAR_" + std::to_string(index));
-            colvarfile << "#m_currentStep  rmsd  bias_energy   counter  factor" << std::endl;
-            colvarfile.close();
-        }
+        m_batch.addGeometry(geometry);
+        if (m_nocolvarfile == false)
+            OutputBuffer::Write("COLVAR_" + std::to_string(index), "#m_currentStep  rmsd  bias_energy   counter  factor\n");
         /*
                 std::ofstream hillsfile;
                 hillsfile.open("HILLS_" + std::to_string(index));
@@ -91,6 +93,7 @@ public:
         str.energy = bias["energy"];
 
         m_biased_structures.push_back(str);
+        m_batch.addGeometry(geometry);
     }
 
     inline void setCurrentGeometry(const Geometry& geometry, double currentStep)
@@ -115,9 +118,12 @@ public:
 
 private:
     std::vector<BiasStructure> m_biased_structures;
-    RMSDDriver m_driver;
+    /* the bias structures share atoms and order with the current one, all rmsds and gradients come from one batch call */
+    RMSDBatch m_batch;
+    std::vector<double> m_rmsd;
+    std::vector<Geometry> m_gradients;
     json m_config, m_constrained;
-    Molecule m_reference, m_target;
+    Molecule m_reference;
     Geometry m_gradient;
     double m_k, m_alpha, m_DT, m_currentStep, m_rmsd_reference, m_current_bias, m_rmsd_econv, m_dT = 1;
     int m_counter = 0, m_atoms = 0;
@@ -204,7 +210,12 @@ static json CurcumaMDJson{
     { "anderson", 0.001 },
     { "noCOLVARfile", false },
     { "noHILSfile", false },
-
+    { "trajectory_format", "xyz" }, // can be xyz, float32, float64 or compressed (binary .trj.ctrj)
+    { "trajectory_precision", 1e-3 }, // resolution of compressed coordinates in Angstrom
+    { "trajectory_velocities", false },
+    { "async_io", true }, // trajectory and restart files are written on a separate thread
+    { "io_slots", 16 }, // snapshots that can wait for the output thread before the integrator stalls
+    { "io_sync", false } // sync restart files to disk (fsync)
 };
 
 class SimpleMD : public CurcumaMethod {
@@ -261,6 +272,9 @@ private:
     void PrintMatrix(const double* matrix) const;
 
     bool WriteGeometry();
+    nlohmann::json RestartInformation(bool matrices);
+    void WriteRestart();
+    void FinishOutput();
     void Verlet();
     void Rattle();
     void ApplyRMSDMTD();
@@ -322,6 +336,13 @@ private:
     std::vector<int> m_atomtype;
     Molecule m_molecule, m_reference, m_target, m_rmsd_mtd_molecule;
     bool m_initialised = false, m_restart = false, m_writeUnique = true, m_opt = false, m_rescue = false, m_writeXYZ = true, m_writeinit = false, m_norestart = false;
+    std::string m_trajectory_format = "xyz";
+    double m_trajectory_precision = 1e-3;
+    bool m_trajectory_velocities = false;
+    BinaryTrajectoryWriter* m_trajectory = nullptr;
+    bool m_async_io = true, m_io_sync = false;
+    int m_io_slots = 16;
+    AsyncTrajectoryWriter* m_writer = nullptr;
     int m_rmrottrans = 0, m_rattle_maxiter = 100;
     bool m_nocenter = false;
     bool m_COM = false;
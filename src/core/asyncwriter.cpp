@@ -0,0 +1,180 @@
+/*
+ * < Asynchronous trajectory and restart output. >
+ * Copyright (C) 2025 Conrad Hübler <Conrad.Huebler@gmx.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "src/core/outputbuffer.h"
+#include "src/tools/general.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include "asyncwriter.h"
+
+AsyncTrajectoryWriter::AsyncTrajectoryWriter(const Molecule& molecule, int slots)
+    : m_molecule(molecule)
+{
+    /* all matrices are allocated here, copying a snapshot of the same size does not allocate */
+    m_ring.resize(std::max(2, slots));
+    for (auto& slot : m_ring) {
+        slot.geometry = Geometry::Zero(molecule.AtomCount(), 3);
+        slot.velocities = Geometry::Zero(molecule.AtomCount(), 3);
+        slot.gradient = Geometry::Zero(molecule.AtomCount(), 3);
+    }
+}
+
+AsyncTrajectoryWriter::~AsyncTrajectoryWriter()
+{
+    Finish();
+}
+
+void AsyncTrajectoryWriter::setTrajectory(const std::string& xyzfile, BinaryTrajectoryWriter* binary, bool velocities)
+{
+    m_xyzfile = xyzfile;
+    m_binary = binary;
+    m_velocities = velocities;
+}
+
+void AsyncTrajectoryWriter::setRestart(const std::string& filename, const std::string& key, bool sync)
+{
+    m_restartfile = filename;
+    m_key = key;
+    m_sync = sync;
+}
+
+void AsyncTrajectoryWriter::Start()
+{
+    if (m_running)
+        return;
+    m_stop.store(false, std::memory_order_release);
+    m_thread = std::thread(&AsyncTrajectoryWriter::Run, this);
+    m_running = true;
+}
+
+MDSnapshot* AsyncTrajectoryWriter::Acquire(bool wait)
+{
+    const std::size_t head = m_head.load(std::memory_order_relaxed);
+    if (head - m_tail.load(std::memory_order_acquire) < m_ring.size())
+        return &m_ring[head % m_ring.size()];
+    if (!wait) {
+        m_dropped++;
+        return nullptr;
+    }
+    m_stalls++;
+    auto start = std::chrono::steady_clock::now();
+    while (head - m_tail.load(std::memory_order_acquire) >= m_ring.size())
+        std::this_thread::yield();
+    m_stall_time += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return &m_ring[head % m_ring.size()];
+}
+
+void AsyncTrajectoryWriter::Publish()
+{
+    m_head.store(m_head.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+}
+
+void AsyncTrajectoryWriter::Finish()
+{
+    if (!m_running)
+        return;
+    m_stop.store(true, std::memory_order_release);
+    m_thread.join();
+    m_running = false;
+    OutputBuffer::FlushAll();
+}
+
+void AsyncTrajectoryWriter::Run()
+{
+    int idle = 0;
+    while (true) {
+        const std::size_t tail = m_tail.load(std::memory_order_relaxed);
+        if (tail == m_head.load(std::memory_order_acquire)) {
+            /* stop is set after the last Publish, so an empty ring seen after stop is final */
+            if (m_stop.load(std::memory_order_acquire) && tail == m_head.load(std::memory_order_acquire))
+                break;
+            if (++idle < 64)
+                std::this_thread::yield();
+            else
+                std::this_thread::sleep_for(std::chrono::microseconds(200));
+            continue;
+        }
+        idle = 0;
+        Write(m_ring[tail % m_ring.size()]);
+        m_tail.store(tail + 1, std::memory_order_release);
+    }
+}
+
+void AsyncTrajectoryWriter::Write(MDSnapshot& snapshot)
+{
+    if (snapshot.frame) {
+        m_molecule.setGeometry(snapshot.geometry);
+        m_molecule.setEnergy(snapshot.energy);
+        m_molecule.setName(std::to_string(snapshot.step));
+        if (m_binary)
+            m_binary->Write(m_molecule, snapshot.step, m_velocities ? &snapshot.velocities : nullptr);
+        else if (!m_xyzfile.empty())
+            m_molecule.appendXYZFile(m_xyzfile);
+        m_written++;
+    }
+    if (snapshot.has_restart)
+        WriteRestart(snapshot);
+}
+
+/* the restart file is written to a temporary file and renamed, an interrupted run never leaves a truncated restart file */
+void AsyncTrajectoryWriter::WriteRestart(MDSnapshot& snapshot)
+{
+    if (m_restartfile.empty())
+        return;
+    OutputBuffer::FlushAll();
+    json& restart = snapshot.restart;
+    restart["velocities"] = Tools::Geometry2String(snapshot.velocities);
+    restart["geometry"] = Tools::Geometry2String(snapshot.geometry);
+    restart["gradient"] = Tools::Geometry2String(snapshot.gradient);
+
+    json content;
+    content[m_key] = restart;
+    std::string output;
+    try {
+        output = content.dump() + "\n";
+    } catch (json::type_error& e) {
+        return;
+    }
+    const std::string temporary = m_restartfile + ".tmp";
+    {
+        std::ofstream file(temporary, std::ios_base::out | std::ios_base::trunc);
+        file << output;
+    }
+#ifndef _WIN32
+    if (m_sync) {
+        int descriptor = open(temporary.c_str(), O_RDONLY);
+        if (descriptor >= 0) {
+            fsync(descriptor);
+            close(descriptor);
+        }
+    }
+#else
+    std::remove(m_restartfile.c_str());
+#endif
+    std::rename(temporary.c_str(), m_restartfile.c_str());
+}
@@ -0,0 +1,98 @@
+/*
+ * < Asynchronous trajectory and restart output. >
+ * Copyright (C) 2025 Conrad Hübler <Conrad.Huebler@gmx.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#pragma once
+
+#include "src/core/binarytrajectory.h"
+#include "src/core/global.h"
+#include "src/core/molecule.h"
+
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "json.hpp"
+using json = nlohmann::json;
+
+using namespace curcuma;
+
+/*! \brief Snapshot of one dump, filled by the integrator and written by the output thread */
+struct MDSnapshot {
+    Geometry geometry, velocities, gradient;
+    double energy = 0, step = 0;
+    json restart; /* restart information without the matrices, they are added by the output thread */
+    bool frame = false, has_restart = false;
+};
+
+/*! \brief Writes trajectory frames and restart files on a dedicated thread
+ *
+ * The integrator takes a free slot of a preallocated ring (Acquire), copies its
+ * data into it and hands it over (Publish). There is exactly one producer and one
+ * consumer, the ring is lock-free. Formatting, compression and writing happen on
+ * the output thread, the integrator only waits if all slots are taken - these
+ * stalls are counted and reported. Restart only snapshots are dropped instead of
+ * waiting, the next one supersedes them anyway.
+ */
+class AsyncTrajectoryWriter {
+public:
+    AsyncTrajectoryWriter(const Molecule& molecule, int slots);
+    ~AsyncTrajectoryWriter();
+
+    /*! \brief Frames are appended to the xyz file, or written through the binary writer if it is set (not owned) */
+    void setTrajectory(const std::string& xyzfile, BinaryTrajectoryWriter* binary, bool velocities);
+
+    /*! \brief Restart files are written to filename as {key : restart}, optionally synced to disk */
+    void setRestart(const std::string& filename, const std::string& key, bool sync);
+
+    void Start();
+
+    /*! \brief Free slot for the next snapshot, nullptr if the ring is full and wait is false */
+    MDSnapshot* Acquire(bool wait = true);
+    void Publish();
+
+    /*! \brief Write all pending snapshots and stop the output thread */
+    void Finish();
+
+    inline int Stalls() const { return m_stalls; }
+    inline double StallTime() const { return m_stall_time; }
+    inline int Dropped() const { return m_dropped; }
+    inline int Written() const { return m_written; }
+
+private:
+    void Run();
+    void Write(MDSnapshot& snapshot);
+    void WriteRestart(MDSnapshot& snapshot);
+
+    Molecule m_molecule;
+    std::vector<MDSnapshot> m_ring;
+    std::atomic<std::size_t> m_head{ 0 }, m_tail{ 0 };
+    std::atomic<bool> m_stop{ false };
+    std::thread m_thread;
+
+    std::string m_xyzfile, m_restartfile, m_key;
+    BinaryTrajectoryWriter* m_binary = nullptr;
+    bool m_velocities = false, m_sync = false, m_running = false;
+
+    /* producer side */
+    int m_stalls = 0, m_dropped = 0;
+    double m_stall_time = 0;
+    /* consumer side, read after Finish */
+    int m_written = 0;
+};
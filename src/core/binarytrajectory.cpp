@@ -0,0 +1,339 @@
+/*
+ * < Compact binary trajectory format. >
+ * Copyright (C) 2025 Conrad Hübler <Conrad.Huebler@gmx.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "binarytrajectory.h"
+
+#include <cmath>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+
+namespace {
+
+const char Magic[4] = { 'C', 'T', 'R', 'J' };
+const char IndexMagic[4] = { 'C', 'I', 'D', 'X' };
+const uint32_t Version = 1;
+
+/* magic, version, atoms, flags, precision, charge, spin */
+const std::size_t FixedHeader = 4 + 3 * sizeof(uint32_t) + sizeof(double) + 2 * sizeof(int32_t);
+/* size, step, energy */
+const std::size_t FrameHead = sizeof(uint32_t) + 2 * sizeof(double);
+/* number of frames, magic */
+const std::size_t IndexTail = sizeof(uint64_t) + 4;
+
+template <typename T>
+inline T Load(const char* data)
+{
+    T value;
+    memcpy(&value, data, sizeof(T));
+    return value;
+}
+
+template <typename T>
+inline void Store(std::vector<char>& buffer, T value)
+{
+    const char* bytes = reinterpret_cast<const char*>(&value);
+    buffer.insert(buffer.end(), bytes, bytes + sizeof(T));
+}
+
+inline void StoreVarint(std::vector<char>& buffer, int64_t value)
+{
+    uint64_t zigzag = (uint64_t(value) << 1) ^ uint64_t(value >> 63);
+    while (zigzag >= 0x80) {
+        buffer.push_back(char(zigzag | 0x80));
+        zigzag >>= 7;
+    }
+    buffer.push_back(char(zigzag));
+}
+
+inline int64_t LoadVarint(const char*& data)
+{
+    uint64_t zigzag = 0;
+    int shift = 0;
+    uint8_t byte;
+    do {
+        byte = uint8_t(*data++);
+        zigzag |= uint64_t(byte & 0x7f) << shift;
+        shift += 7;
+    } while (byte & 0x80);
+    return int64_t(zigzag >> 1) ^ -int64_t(zigzag & 1);
+}
+
+/* velocities are never quantised, only the precision of the coordinates applies to them */
+inline void StoreValues(std::vector<char>& buffer, const double* values, int count, bool double_precision)
+{
+    for (int i = 0; i < count; ++i) {
+        if (double_precision)
+            Store<double>(buffer, values[i]);
+        else
+            Store<float>(buffer, float(values[i]));
+    }
+}
+
+inline const char* LoadValues(const char* data, double* values, int count, bool double_precision)
+{
+    for (int i = 0; i < count; ++i) {
+        if (double_precision) {
+            values[i] = Load<double>(data);
+            data += sizeof(double);
+        } else {
+            values[i] = Load<float>(data);
+            data += sizeof(float);
+        }
+    }
+    return data;
+}
+}
+
+namespace BinaryTrajectory {
+
+bool isBinary(const std::string& filename)
+{
+    const std::string extension = ".ctrj";
+    return filename.size() >= extension.size() && filename.compare(filename.size() - extension.size(), extension.size(), extension) == 0;
+}
+
+bool ReadHeader(const char* data, std::size_t size, Header& header)
+{
+    if (data == nullptr || size < FixedHeader || memcmp(data, Magic, 4) != 0)
+        return false;
+    const char* pos = data + 4;
+    if (Load<uint32_t>(pos) != Version)
+        return false;
+    pos += sizeof(uint32_t);
+    header.atoms = Load<uint32_t>(pos);
+    pos += sizeof(uint32_t);
+    header.flags = Load<uint32_t>(pos);
+    pos += sizeof(uint32_t);
+    header.precision = Load<double>(pos);
+    pos += sizeof(double);
+    header.charge = Load<int32_t>(pos);
+    pos += sizeof(int32_t);
+    header.spin = Load<int32_t>(pos);
+    pos += sizeof(int32_t);
+
+    header.size = FixedHeader + header.atoms * sizeof(int32_t);
+    if (size < header.size)
+        return false;
+    header.elements.resize(header.atoms);
+    for (int i = 0; i < header.atoms; ++i, pos += sizeof(int32_t))
+        header.elements[i] = Load<int32_t>(pos);
+    return true;
+}
+
+std::vector<std::size_t> Index(const char* data, std::size_t size, const Header& header)
+{
+    std::vector<std::size_t> offsets;
+    if (size >= header.size + IndexTail && memcmp(data + size - 4, IndexMagic, 4) == 0) {
+        const uint64_t frames = Load<uint64_t>(data + size - IndexTail);
+        if (size - IndexTail - header.size >= frames * sizeof(uint64_t)) {
+            const char* pos = data + size - IndexTail - frames * sizeof(uint64_t);
+            offsets.resize(frames);
+            for (uint64_t i = 0; i < frames; ++i, pos += sizeof(uint64_t))
+                offsets[i] = Load<uint64_t>(pos);
+            if (frames == 0 || offsets[0] == header.size)
+                return offsets;
+            offsets.clear();
+        }
+    }
+    for (std::size_t pos = header.size; pos + FrameHead <= size;) {
+        const std::size_t next = pos + sizeof(uint32_t) + Load<uint32_t>(data + pos);
+        if (next > size)
+            break;
+        offsets.push_back(pos);
+        pos = next;
+    }
+    return offsets;
+}
+
+Molecule Frame(const char* data, const Header& header, double* step, Geometry* velocities)
+{
+    const bool double_precision = header.flags & DoublePrecision;
+    const char* pos = data + sizeof(uint32_t);
+
+    Mol mol;
+    mol.m_number_atoms = header.atoms;
+    mol.m_charge = header.charge;
+    mol.m_spin = header.spin;
+    mol.m_atoms = header.elements;
+    mol.m_geometry = Geometry(header.atoms, 3);
+
+    const double time = Load<double>(pos);
+    pos += sizeof(double);
+    mol.m_energy = Load<double>(pos);
+    pos += sizeof(double);
+
+    /* Geometry is row major, data() holds x, y, z of each atom in a row */
+    double* coordinates = mol.m_geometry.data();
+    if (header.flags & Compressed) {
+        int64_t previous[3] = { 0, 0, 0 };
+        for (int i = 0; i < 3 * header.atoms; ++i) {
+            previous[i % 3] += LoadVarint(pos);
+            coordinates[i] = previous[i % 3] * header.precision;
+        }
+    } else
+        pos = LoadValues(pos, coordinates, 3 * header.atoms, double_precision);
+
+    if (velocities && (header.flags & Velocities)) {
+        *velocities = Geometry(header.atoms, 3);
+        LoadValues(pos, velocities->data(), 3 * header.atoms, double_precision);
+    }
+    if (step)
+        *step = time;
+
+    Molecule molecule(mol);
+    molecule.setName(std::to_string(time));
+    return molecule;
+}
+}
+
+BinaryTrajectoryWriter::BinaryTrajectoryWriter(const std::string& filename, const std::string& format, bool append, double precision)
+    : m_filename(filename)
+{
+    if (format.compare("float64") == 0)
+        m_header.flags |= BinaryTrajectory::DoublePrecision;
+    else if (format.compare("compressed") == 0)
+        m_header.flags |= BinaryTrajectory::Compressed;
+    m_header.precision = precision;
+
+    if (append && Reopen())
+        return;
+    m_file.open(m_filename, std::ios::out | std::ios::binary | std::ios::trunc);
+    m_open = m_file.is_open();
+}
+
+BinaryTrajectoryWriter::~BinaryTrajectoryWriter()
+{
+    Close();
+}
+
+/* continue an existing trajectory, the old index is cut off and written again on Close */
+bool BinaryTrajectoryWriter::Reopen()
+{
+    std::ifstream input(m_filename, std::ios::binary);
+    if (!input.is_open())
+        return false;
+    std::vector<char> data((std::istreambuf_iterator<char>(input)), std::istreambuf_iterator<char>());
+    input.close();
+
+    BinaryTrajectory::Header header;
+    if (!BinaryTrajectory::ReadHeader(data.data(), data.size(), header))
+        return false;
+    const std::vector<std::size_t> offsets = BinaryTrajectory::Index(data.data(), data.size(), header);
+    std::size_t end = header.size;
+    if (offsets.size())
+        end = offsets.back() + sizeof(uint32_t) + Load<uint32_t>(data.data() + offsets.back());
+
+    std::filesystem::resize_file(m_filename, end);
+    m_file.open(m_filename, std::ios::out | std::ios::binary | std::ios::app);
+    if (!m_file.is_open())
+        return false;
+    m_header = header;
+    m_offsets.assign(offsets.begin(), offsets.end());
+    m_position = end;
+    m_header_written = true;
+    m_open = true;
+    return true;
+}
+
+void BinaryTrajectoryWriter::WriteHeader(const Molecule& molecule, bool velocities)
+{
+    m_header.atoms = molecule.AtomCount();
+    m_header.charge = molecule.Charge();
+    m_header.spin = molecule.Spin();
+    m_header.elements = molecule.Atoms();
+    if (velocities)
+        m_header.flags |= BinaryTrajectory::Velocities;
+
+    std::vector<char> buffer(Magic, Magic + 4);
+    Store<uint32_t>(buffer, Version);
+    Store<uint32_t>(buffer, m_header.atoms);
+    Store<uint32_t>(buffer, m_header.flags);
+    Store<double>(buffer, m_header.precision);
+    Store<int32_t>(buffer, m_header.charge);
+    Store<int32_t>(buffer, m_header.spin);
+    for (int element : m_header.elements)
+        Store<int32_t>(buffer, element);
+    m_file.write(buffer.data(), buffer.size());
+    m_position = buffer.size();
+    m_header.size = buffer.size();
+    m_header_written = true;
+}
+
+bool BinaryTrajectoryWriter::Write(const Molecule& molecule, double step, const Geometry* velocities)
+{
+    if (!m_open)
+        return false;
+    if (!m_header_written)
+        WriteHeader(molecule, velocities != nullptr);
+    if (molecule.AtomCount() != m_header.atoms) {
+        std::cerr << "BinaryTrajectoryWriter: " << molecule.AtomCount() << " atoms do not fit into a trajectory of " << m_header.atoms << " atoms." << std::endl;
+        return false;
+    }
+
+    const bool double_precision = m_header.flags & BinaryTrajectory::DoublePrecision;
+    const Geometry geometry = molecule.getGeometry();
+    const double* coordinates = geometry.data();
+
+    m_frame.clear();
+    Store<uint32_t>(m_frame, 0);
+    Store<double>(m_frame, step);
+    Store<double>(m_frame, molecule.Energy());
+    if (m_header.flags & BinaryTrajectory::Compressed) {
+        int64_t previous[3] = { 0, 0, 0 };
+        for (int i = 0; i < 3 * m_header.atoms; ++i) {
+            const int64_t value = std::llround(coordinates[i] / m_header.precision);
+            StoreVarint(m_frame, value - previous[i % 3]);
+            previous[i % 3] = value;
+        }
+    } else
+        StoreValues(m_frame, coordinates, 3 * m_header.atoms, double_precision);
+
+    if (m_header.flags & BinaryTrajectory::Velocities) {
+        if (velocities && velocities->rows() == m_header.atoms) {
+            const Geometry copy = *velocities;
+            StoreValues(m_frame, copy.data(), 3 * m_header.atoms, double_precision);
+        } else {
+            const std::vector<double> zero(3 * m_header.atoms, 0.0);
+            StoreValues(m_frame, zero.data(), 3 * m_header.atoms, double_precision);
+        }
+    }
+    const uint32_t size = m_frame.size() - sizeof(uint32_t);
+    memcpy(m_frame.data(), &size, sizeof(uint32_t));
+
+    m_file.write(m_frame.data(), m_frame.size());
+    m_offsets.push_back(m_position);
+    m_position += m_frame.size();
+    return m_file.good();
+}
+
+void BinaryTrajectoryWriter::Close()
+{
+    if (!m_open)
+        return;
+    std::vector<char> buffer;
+    for (uint64_t offset : m_offsets)
+        Store<uint64_t>(buffer, offset);
+    Store<uint64_t>(buffer, m_offsets.size());
+    buffer.insert(buffer.end(), IndexMagic, IndexMagic + 4);
+    if (m_header_written)
+        m_file.write(buffer.data(), buffer.size());
+    m_file.close();
+    m_open = false;
+}
@@ -0,0 +1,104 @@
+/*
+ * < Compact binary trajectory format. >
+ * Copyright (C) 2025 Conrad Hübler <Conrad.Huebler@gmx.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#pragma once
+
+#include "src/core/global.h"
+#include "src/core/molecule.h"
+
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+
+using namespace curcuma;
+
+/* Layout of a .ctrj file (native byte order):
+ *
+ *   header   "CTRJ", version, atoms, flags, precision, charge, spin, elements[atoms]
+ *   frame    size of the rest of the frame, step, energy, coordinates [, velocities]
+ *   ...
+ *   index    offsets of all frames, number of frames, "CIDX"
+ *
+ * Coordinates are stored as float32, float64 or - compressed - rounded to
+ * multiples of precision, as difference to the previous atom of the same frame
+ * and written as variable length integer, so every frame can be decoded on its own.
+ * The index is written when the trajectory is closed, if it is missing (the run
+ * was killed), the frames are found through their size fields. */
+
+namespace BinaryTrajectory {
+
+enum Flags {
+    Velocities = 1,
+    DoublePrecision = 2,
+    Compressed = 4
+};
+
+struct Header {
+    int atoms = 0;
+    int flags = 0;
+    double precision = 1e-3;
+    int charge = 0;
+    int spin = 0;
+    std::vector<int> elements;
+    std::size_t size = 0; /* bytes of the header, the first frame starts here */
+};
+
+/*! \brief Binary trajectories are recognised by the .ctrj extension */
+bool isBinary(const std::string& filename);
+
+bool ReadHeader(const char* data, std::size_t size, Header& header);
+
+/*! \brief Offsets of all complete frames, taken from the index or by walking through the frames */
+std::vector<std::size_t> Index(const char* data, std::size_t size, const Header& header);
+
+/*! \brief Decode the frame starting at data, step and velocities are optional */
+Molecule Frame(const char* data, const Header& header, double* step = nullptr, Geometry* velocities = nullptr);
+}
+
+/*! \brief Writes frames to a .ctrj file through one open handle
+ *
+ * format is float32, float64 or compressed. With append, frames are added to
+ * an existing trajectory of the same number of atoms, otherwise the file is truncated.
+ */
+class BinaryTrajectoryWriter {
+public:
+    BinaryTrajectoryWriter(const std::string& filename, const std::string& format = "float32", bool append = false, double precision = 1e-3);
+    ~BinaryTrajectoryWriter();
+
+    /*! \brief The header is taken from the first frame, velocities are stored if they are given for the first frame */
+    bool Write(const Molecule& molecule, double step, const Geometry* velocities = nullptr);
+
+    /*! \brief Write the index and close the file, called by the destructor */
+    void Close();
+
+    inline int Frames() const { return m_offsets.size(); }
+
+private:
+    bool Reopen();
+    void WriteHeader(const Molecule& molecule, bool velocities);
+
+    std::string m_filename;
+    std::ofstream m_file;
+    BinaryTrajectory::Header m_header;
+    std::vector<uint64_t> m_offsets;
+    std::vector<char> m_frame;
+    uint64_t m_position = 0;
+    bool m_header_written = false, m_open = false;
+};
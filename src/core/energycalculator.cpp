@@ -37,6 +37,55 @@ namespace fs = std::filesystem;
 
 #include "energycalculator.h"
 
+#include <list>
+#include <mutex>
+#include <unordered_map>
+
+/* Generated force field parameters, shared read-only by all calculators of the process.
+ * The key holds method, controller and topology, so generation happens once per topology.
+ * The cache holds at most 256 topologies, the least recently used one is dropped first. */
+struct ParameterCache {
+    std::mutex mutex;
+    std::list<std::string> order;
+    std::unordered_map<std::string, std::pair<std::shared_ptr<const json>, std::list<std::string>::iterator>> entries;
+};
+
+static ParameterCache& Parameters()
+{
+    static ParameterCache cache;
+    return cache;
+}
+
+static std::shared_ptr<const json> CachedParameter(const std::string& key)
+{
+    ParameterCache& cache = Parameters();
+    std::lock_guard<std::mutex> lock(cache.mutex);
+    auto entry = cache.entries.find(key);
+    if (entry == cache.entries.end())
+        return nullptr;
+    cache.order.splice(cache.order.begin(), cache.order, entry->second.second);
+    return entry->second.first;
+}
+
+/* returns the cached parameters if another thread was faster */
+static std::shared_ptr<const json> StoreParameter(const std::string& key, const std::shared_ptr<const json>& parameter)
+{
+    ParameterCache& cache = Parameters();
+    std::lock_guard<std::mutex> lock(cache.mutex);
+    auto entry = cache.entries.find(key);
+    if (entry != cache.entries.end()) {
+        cache.order.splice(cache.order.begin(), cache.order, entry->second.second);
+        return entry->second.first;
+    }
+    if (cache.entries.size() >= 256) {
+        cache.entries.erase(cache.order.back());
+        cache.order.pop_back();
+    }
+    cache.order.push_front(key);
+    cache.entries.emplace(key, std::make_pair(parameter, cache.order.begin()));
+    return parameter;
+}
+
 EnergyCalculator::EnergyCalculator(const std::string& method, const json& controller)
     : m_method(method)
 {
@@ -52,6 +101,9 @@ EnergyCalculator::EnergyCalculator(const std::string& method, const json& contro
         m_writeparam = controller["write_param"];
     }
 
+    m_param_format = m_controller["param_format"];
+    m_param_cache = m_controller["param_cache"];
+
     m_bonds = []() {
         return std::vector<std::vector<double>>{ {} };
     };
@@ -254,15 +306,34 @@ void EnergyCalculator::setMolecule(const Mol& mol)
 
     case 0:
     default:
+        m_forcefield->setAtomTypes(mol.m_atoms);
+        if (m_parameter.size() == 0 && std::filesystem::exists(m_param_file) && ForceField::isBinaryParameterFile(m_param_file)) {
+            /* binary parameters go straight into the term arrays, no json involved */
+            if (m_forcefield->setParameterFile(m_param_file))
+                break;
+        }
+        /* parameters are set up again for every molecule, so a calculator can be reused for other structures,
+         * only the cached methods may skip the generation */
+        const bool cached = m_param_cache && std::find(m_cached_methods.begin(), m_cached_methods.end(), m_method) != m_cached_methods.end();
         if (m_parameter.size() == 0) {
-            if (!std::filesystem::exists(m_param_file)) {
-                ForceFieldGenerator ff(m_controller);
-                ff.setMolecule(mol);
-                ff.Generate();
-                m_parameter = ff.getParameter();
-                if (m_writeparam) {
+            if (!std::filesystem::exists(m_param_file) || ForceField::isBinaryParameterFile(m_param_file)) {
+                std::string key;
+                m_shared_parameter.reset();
+                if (cached) {
+                    key = m_method + m_controller.dump() + ForceFieldGenerator::TopologyKey(mol);
+                    m_shared_parameter = CachedParameter(key);
+                }
+                if (!m_shared_parameter) {
+                    ForceFieldGenerator ff(m_controller);
+                    ff.setMolecule(mol);
+                    ff.Generate();
+                    m_shared_parameter = std::make_shared<const json>(ff.getParameter());
+                    if (cached)
+                        m_shared_parameter = StoreParameter(key, m_shared_parameter);
+                }
+                if (m_writeparam && m_param_format.compare("json") == 0) {
                     std::ofstream parameterfile("ff_param.json");
-                    parameterfile << m_parameter;
+                    parameterfile << *m_shared_parameter;
                 }
             } else {
                 std::ifstream parameterfile(m_param_file);
@@ -273,9 +344,9 @@ void EnergyCalculator::setMolecule(const Mol& mol)
                 }
             }
         }
-        m_forcefield->setAtomTypes(mol.m_atoms);
-
-        m_forcefield->setParameter(m_parameter);
+        m_forcefield->setParameter(m_parameter.size() || !m_shared_parameter ? m_parameter : *m_shared_parameter);
+        if (m_writeparam && m_param_format.compare("binary") == 0)
+            m_forcefield->writeParameterFile("ff_param.ffb");
         break;
     }
     m_initialised = true;
@@ -501,6 +572,12 @@ void EnergyCalculator::CalculateFF(bool gradient, bool verbose)
     }
 }
 
+Eigen::SparseMatrix<double> EnergyCalculator::AnalyticHessian()
+{
+    m_forcefield->UpdateGeometry(m_geometry);
+    return m_forcefield->AnalyticHessian();
+}
+
 Vector EnergyCalculator::Charges() const
 {
     if (m_qminterface == nullptr)
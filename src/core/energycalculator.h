@@ -44,17 +44,20 @@
 #include "src/core/ulyssesinterface.h"
 
 #include <functional>
+#include <memory>
 
 #include "json.hpp"
 using json = nlohmann::json;
 
 static json EnergyCalculatorJson{
     { "param_file", "none" },
+    { "param_format", "json" },
     { "multi", 1},
     { "method", "uff"},
     { "SCFmaxiter", 100 },
     { "Tele", 300 },
-    { "solvent", "none"}
+    { "solvent", "none"},
+    { "param_cache", true }
 
 };
 
@@ -73,6 +76,12 @@ public:
 
     Matrix Gradient() const { return m_gradient; }
 
+    /*! \brief True if the method provides second derivatives itself (force fields) */
+    bool HasAnalyticHessian() const { return m_forcefield != NULL; }
+
+    /*! \brief Hessian at the current geometry, only valid if HasAnalyticHessian() */
+    Eigen::SparseMatrix<double> AnalyticHessian();
+
     double CalculateEnergy(bool gradient = false, bool verbose = false);
 
     bool HasNan() const { return m_containsNaN; }
@@ -88,7 +97,7 @@ public:
         //     m_qmdff->setParameter(parameter);
     }
 
-    inline json Parameter() const { return m_parameter; }
+    inline json Parameter() const { return m_parameter.size() || !m_shared_parameter ? m_parameter : *m_shared_parameter; }
     Vector Energies() const { return m_orbital_energies; }
     Vector OrbitalOccuptations() const { return m_orbital_occupation; }
 
@@ -136,6 +145,8 @@ private:
 
     StringList m_uff_methods = { "fuff" };
     StringList m_ff_methods = { "uff", "uff-d3", "qmdff" };
+    /* qmdff takes its reference distances from the geometry, its parameters can not be shared */
+    StringList m_cached_methods = { "uff", "uff-d3" };
     StringList m_qmdff_method = { "fqmdff" };
     StringList m_tblite_methods = { "ipea1", "gfn1", "gfn2" };
     StringList m_xtb_methods = { "gfnff", "xtb-gfn1", "xtb-gfn2" };
@@ -149,7 +160,8 @@ private:
     std::function<Position()> m_dipole;
     std::function<std::vector<std::vector<double>>()> m_bonds;
     json m_parameter;
-    std::string m_method, m_param_file;
+    std::shared_ptr<const json> m_shared_parameter;
+    std::string m_method, m_param_file, m_param_format = "json";
     Matrix m_geometry, m_gradient, m_molecular_orbitals;
     Vector m_orbital_energies, m_orbital_occupation;
     Vector m_xtb_gradient;
@@ -167,4 +179,5 @@ private:
     bool m_containsNaN = false;
     bool m_error = false;
     bool m_writeparam = false;
+    bool m_param_cache = true;
 };
@@ -17,63 +17,431 @@
  *
  */
 
-#pragma once
-
+#include "src/core/elements.h"
 #include "src/core/molecule.h"
+#include "src/core/outputbuffer.h"
 
 #include "src/tools/formats.h"
 #include "src/tools/general.h"
 
+#include "external/CxxThreadPool/include/CxxThreadPool.h"
+
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
 #include <fstream>
 #include <iostream>
 #include <string>
+#include <unordered_map>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 
 #include "fileiterator.h"
 
+namespace {
+
+inline bool isBlank(char c)
+{
+    return c == ' ' || c == '\t' || c == '\r';
+}
+
+/* end of the line starting at pos, without the newline */
+inline const char* LineEnd(const char* pos, const char* end)
+{
+    const char* eol = static_cast<const char*>(memchr(pos, '\n', end - pos));
+    return eol ? eol : end;
+}
+
+inline bool isBlankLine(const char* begin, const char* end)
+{
+    for (; begin < end; ++begin)
+        if (!isBlank(*begin))
+            return false;
+    return true;
+}
+
+/* next whitespace separated token in [pos, end), pos is moved behind it */
+inline bool NextToken(const char*& pos, const char* end, const char*& begin, const char*& stop)
+{
+    while (pos < end && isBlank(*pos))
+        ++pos;
+    if (pos == end)
+        return false;
+    begin = pos;
+    while (pos < end && !isBlank(*pos))
+        ++pos;
+    stop = pos;
+    return true;
+}
+
+inline bool ParseInt(const char* begin, const char* end, int& value)
+{
+    while (begin < end && isBlank(*begin))
+        ++begin;
+    while (end > begin && isBlank(*(end - 1)))
+        --end;
+    if (begin == end)
+        return false;
+    value = 0;
+    for (; begin < end; ++begin) {
+        if (*begin < '0' || *begin > '9')
+            return false;
+        value = 10 * value + (*begin - '0');
+    }
+    return true;
+}
+
+/* Decimal mantissa with up to 15 digits and a power of ten that are both exact in double
+ * give the correctly rounded result with a single multiplication or division (Clinger's fast path).
+ * Everything else (long mantissas, large exponents, Fortran exponents ...) goes through strtod. */
+inline double ParseDouble(const char* begin, const char* end)
+{
+    static const double powers[] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+        1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22 };
+
+    const char* pos = begin;
+    bool negative = false;
+    if (pos < end && (*pos == '-' || *pos == '+'))
+        negative = *pos++ == '-';
+
+    uint64_t mantissa = 0;
+    int digits = 0, exponent = 0;
+    bool any = false;
+    for (; pos < end && *pos >= '0' && *pos <= '9'; ++pos, any = true) {
+        mantissa = 10 * mantissa + (*pos - '0');
+        digits += mantissa != 0;
+    }
+    if (pos < end && *pos == '.') {
+        for (++pos; pos < end && *pos >= '0' && *pos <= '9'; ++pos, any = true) {
+            mantissa = 10 * mantissa + (*pos - '0');
+            digits += mantissa != 0;
+            --exponent;
+        }
+    }
+    if (any && pos < end && (*pos == 'e' || *pos == 'E')) {
+        const char* mark = pos++;
+        bool negative_exponent = false;
+        if (pos < end && (*pos == '-' || *pos == '+'))
+            negative_exponent = *pos++ == '-';
+        int value = 0;
+        bool exponent_digits = false;
+        for (; pos < end && *pos >= '0' && *pos <= '9' && value < 10000; ++pos, exponent_digits = true)
+            value = 10 * value + (*pos - '0');
+        if (exponent_digits)
+            exponent += negative_exponent ? -value : value;
+        else
+            pos = mark;
+    }
+
+    if (any && pos == end && digits <= 15 && exponent >= -22 && exponent <= 22) {
+        double value = double(mantissa);
+        value = exponent < 0 ? value / powers[-exponent] : value * powers[exponent];
+        return negative ? -value : value;
+    }
+    const std::string token(begin, end);
+    return std::strtod(token.c_str(), nullptr);
+}
+
+/* same rules as Molecule::setXYZ, either the atomic number or the (case insensitive) symbol */
+inline int ElementNumber(const char* begin, const char* end)
+{
+    int number = 0;
+    if (ParseInt(begin, end, number))
+        return number;
+
+    static const std::unordered_map<std::string, int> symbols = []() {
+        std::unordered_map<std::string, int> map;
+        for (int i = 0; i < Elements::ElementAbbr_Low.size(); ++i)
+            map.emplace(Elements::ElementAbbr_Low[i], i);
+        return map;
+    }();
+    std::string symbol(begin, end);
+    for (char& c : symbol)
+        c = tolower(c);
+    auto element = symbols.find(symbol);
+    return element == symbols.end() ? 0 : element->second;
+}
+
+class FrameThread : public CxxThread {
+public:
+    FrameThread(const FileIterator* file, const std::vector<int>* indices, std::vector<Molecule>* frames, int start, int step)
+        : m_file(file)
+        , m_indices(indices)
+        , m_frames(frames)
+        , m_start(start)
+        , m_step(step)
+    {
+        setAutoDelete(true);
+    }
+
+    int execute() override
+    {
+        for (int i = m_start; i < m_indices->size(); i += m_step)
+            (*m_frames)[i] = m_file->Frame((*m_indices)[i]);
+        return 0;
+    }
+
+private:
+    const FileIterator* m_file;
+    const std::vector<int>* m_indices;
+    std::vector<Molecule>* m_frames;
+    int m_start, m_step;
+};
+}
+
 FileIterator::FileIterator(bool silent)
 {
 }
 
 FileIterator::FileIterator(const std::string& filename, bool silent)
-    : m_filename(filename)
 {
     if (!silent)
-        std::cerr << "Opening file " << m_filename << std::endl;
-    m_basename = filename;
-    m_basename.erase(m_basename.end() - 4, m_basename.end());
-    m_file = new std::ifstream(m_filename);
-    m_lines = CountLines();
-    m_init = CheckNext();
+        std::cerr << "Opening file " << filename << std::endl;
+    setFile(filename);
 }
 
 FileIterator::FileIterator(char* filename, bool silent)
+    : FileIterator(std::string(filename), silent)
 {
-    m_filename = std::string(filename);
-    if (!silent)
-        std::cerr << "Opening file " << m_filename << std::endl;
-    m_basename = std::string(filename);
-    ;
-    m_basename.erase(m_basename.end() - 4, m_basename.end());
-    m_file = new std::ifstream(m_filename);
-    m_lines = CountLines();
-    m_init = CheckNext();
 }
 
 void FileIterator::setFile(const std::string& filename)
 {
     m_filename = filename;
     m_basename = filename;
-    m_basename.erase(m_basename.end() - 4, m_basename.end());
+    m_binary = BinaryTrajectory::isBinary(filename);
+    m_basename.erase(m_basename.end() - (m_binary ? 5 : 4), m_basename.end());
+
+    /* the file may have been written in this run */
+    OutputBuffer::Flush(filename);
+
+    Unmap();
+    m_frames.clear();
+    m_block.clear();
+    m_end = false;
+    m_current_mol = 0;
+
+    if (m_binary) {
+        m_indexed = true;
+        if (Map() && BinaryTrajectory::ReadHeader(m_data, m_size, m_header))
+            m_frames = BinaryTrajectory::Index(m_data, m_size, m_header);
+        else
+            std::cerr << "FileIterator: " << m_filename << " is not a valid binary trajectory." << std::endl;
+        m_mols = m_frames.size();
+        setSlice(0, -1, 1);
+        return;
+    }
+
+    bool xyzfile = std::string(m_filename).find(".xyz") != std::string::npos || std::string(m_filename).find(".trj") != std::string::npos;
+    m_indexed = xyzfile && Map();
+    if (m_indexed) {
+        BuildIndex();
+        m_mols = m_frames.size();
+        setSlice(0, -1, 1);
+        return;
+    }
+    delete m_file;
     m_file = new std::ifstream(m_filename);
     m_lines = CountLines();
     m_init = CheckNext();
 }
+
 FileIterator::~FileIterator()
 {
+    Unmap();
+    delete m_file;
+}
+
+bool FileIterator::Map()
+{
+#ifndef _WIN32
+    int descriptor = open(m_filename.c_str(), O_RDONLY);
+    if (descriptor < 0)
+        return false;
+    struct stat status;
+    if (fstat(descriptor, &status) != 0) {
+        close(descriptor);
+        return false;
+    }
+    m_size = status.st_size;
+    if (m_size == 0) {
+        close(descriptor);
+        m_data = nullptr;
+        return true;
+    }
+    void* data = mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, descriptor, 0);
+    close(descriptor);
+    if (data == MAP_FAILED) {
+        m_size = 0;
+        return false;
+    }
+    madvise(data, m_size, MADV_SEQUENTIAL);
+    m_data = static_cast<const char*>(data);
+    return true;
+#else
+    std::ifstream file(m_filename, std::ios::binary);
+    if (!file.is_open())
+        return false;
+    m_buffer.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    m_data = m_buffer.data();
+    m_size = m_buffer.size();
+    return true;
+#endif
+}
+
+void FileIterator::Unmap()
+{
+#ifndef _WIN32
+    if (m_data && m_buffer.empty())
+        munmap(const_cast<char*>(m_data), m_size);
+#endif
+    m_buffer.clear();
+    m_data = nullptr;
+    m_size = 0;
+}
+
+void FileIterator::BuildIndex()
+{
+    const char* end = m_data + m_size;
+    const char* pos = m_data;
+    while (pos < end) {
+        const char* eol = LineEnd(pos, end);
+        if (isBlankLine(pos, eol)) {
+            pos = eol + 1;
+            continue;
+        }
+        int atoms = 0;
+        if (!ParseInt(pos, eol, atoms)) {
+            std::cerr << "FileIterator::BuildIndex() Got some error at line " << std::string(pos, eol) << "\n";
+            std::cerr << "Skipping molecules that follow after  " << m_frames.size() << " molecule!" << std::endl;
+            return;
+        }
+        const std::size_t start = pos - m_data;
+
+        /* comment line, may be empty */
+        pos = eol + 1;
+        if (pos > end)
+            return;
+        pos = LineEnd(pos, end) + 1;
+
+        int found = 0;
+        while (found < atoms && pos < end) {
+            eol = LineEnd(pos, end);
+            found += !isBlankLine(pos, eol);
+            pos = eol + 1;
+        }
+        if (found < atoms)
+            return;
+        m_frames.push_back(start);
+    }
+}
+
+Molecule FileIterator::Frame(int index) const
+{
+    if (!m_indexed || index < 0 || index >= m_frames.size())
+        return Molecule();
+    if (m_binary)
+        return BinaryTrajectory::Frame(m_data + m_frames[index], m_header);
+
+    const char* end = m_data + m_size;
+    const char* pos = m_data + m_frames[index];
+    const char* eol = LineEnd(pos, end);
+
+    Mol mol;
+    mol.m_energy = 0;
+    mol.m_spin = 0;
+    mol.m_charge = 0;
+    ParseInt(pos, eol, mol.m_number_atoms);
+    mol.m_atoms.resize(mol.m_number_atoms);
+    mol.m_geometry = Geometry::Zero(mol.m_number_atoms, 3);
+
+    pos = eol + 1;
+    eol = LineEnd(pos, end);
+    const char* comment_end = eol;
+    while (comment_end > pos && *(comment_end - 1) == '\r')
+        --comment_end;
+    const std::string comment(pos, comment_end);
+    pos = eol + 1;
+
+    for (int atom = 0; atom < mol.m_number_atoms && pos < end; pos = eol + 1) {
+        eol = LineEnd(pos, end);
+        const char *begin, *stop;
+        const char* cursor = pos;
+        if (!NextToken(cursor, eol, begin, stop))
+            continue;
+        mol.m_atoms[atom] = ElementNumber(begin, stop);
+        for (int xyz = 0; xyz < 3 && NextToken(cursor, eol, begin, stop); ++xyz)
+            mol.m_geometry(atom, xyz) = ParseDouble(begin, stop);
+        ++atom;
+    }
+
+    Molecule molecule(mol);
+    molecule.setXYZComment(comment);
+    return molecule;
+}
+
+std::vector<Molecule> FileIterator::Frames(int first, int last, int stride, int threads) const
+{
+    if (last < 0 || last > FrameCount())
+        last = FrameCount();
+    std::vector<int> indices;
+    for (int i = std::max(first, 0); i < last; i += std::max(stride, 1))
+        indices.push_back(i);
+
+    std::vector<Molecule> frames(indices.size());
+    threads = std::max(1, std::min(threads, int(indices.size())));
+    if (threads == 1) {
+        for (int i = 0; i < indices.size(); ++i)
+            frames[i] = Frame(indices[i]);
+        return frames;
+    }
+    CxxThreadPool* pool = new CxxThreadPool;
+    pool->setProgressBar(CxxThreadPool::ProgressBarType::None);
+    pool->setActiveThreadCount(threads);
+    for (int i = 0; i < threads; ++i)
+        pool->addThread(new FrameThread(this, &indices, &frames, i, threads));
+    pool->StartAndWait();
+    delete pool;
+    return frames;
+}
+
+void FileIterator::setSlice(int first, int last, int stride)
+{
+    if (!m_indexed)
+        return;
+    m_first = std::max(first, 0);
+    m_last = (last < 0 || last > FrameCount()) ? FrameCount() : last;
+    m_stride = std::max(stride, 1);
+    m_position = m_first;
+    m_current_mol = 0;
+    m_block.clear();
 }
 
 Molecule FileIterator::Next()
 {
+    if (m_indexed) {
+        if (AtEnd())
+            return Molecule();
+        Molecule current;
+        if (m_threads > 1) {
+            /* the next block of frames is parsed in parallel, then handed out one by one */
+            const int offset = (m_position - m_block_start) / m_stride;
+            if (m_block.empty() || m_position < m_block_start || offset >= m_block.size()) {
+                m_block = Frames(m_position, std::min(m_last, m_position + 16 * m_threads * m_stride), m_stride, m_threads);
+                m_block_start = m_position;
+            }
+            current = m_block[(m_position - m_block_start) / m_stride];
+        } else
+            current = Frame(m_position);
+        m_position += m_stride;
+        m_current_mol++;
+        return current;
+    }
     Molecule current = m_current;
     m_end = CheckNext();
     return current;
@@ -81,14 +449,24 @@ Molecule FileIterator::Next()
 
 bool FileIterator::AtEnd()
 {
+    if (m_indexed)
+        return m_position >= m_last;
     return m_end || m_init;
 }
+
 Molecule FileIterator::Current() const
 {
+    if (m_indexed)
+        return m_position < m_last ? Frame(m_position) : Molecule();
     return m_current;
 }
 
-int FileIterator::MaxMolecules() const { return m_mols; }
+int FileIterator::MaxMolecules() const
+{
+    if (m_indexed)
+        return m_last > m_first ? (m_last - m_first + m_stride - 1) / m_stride : 0;
+    return m_mols;
+}
 
 int FileIterator::CurrentMolecule() const { return m_current_mol; }
 
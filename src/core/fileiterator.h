@@ -19,6 +19,7 @@
 
 #pragma once
 
+#include "src/core/binarytrajectory.h"
 #include "src/core/molecule.h"
 
 #include "src/tools/formats.h"
@@ -27,7 +28,16 @@
 #include <fstream>
 #include <iostream>
 #include <string>
+#include <vector>
 
+/*! \brief Iterate through the structures of a (multi) xyz file
+ *
+ * xyz and trj files are mapped into memory and indexed once, every frame is
+ * only parsed when it is requested. Frames can be accessed randomly, a slice
+ * (first, last, stride) restricts Next() to a subset without touching the
+ * skipped frames. Binary trajectories (.ctrj) are handled the same way through
+ * their frame index. All other formats are loaded with Files::LoadFile.
+ */
 class FileIterator {
 public:
     FileIterator(bool silent = false);
@@ -42,20 +52,49 @@ public:
     bool AtEnd();
     Molecule Current() const;
 
+    /*! \brief Number of structures Next() will visit */
     int MaxMolecules() const;
 
     int CurrentMolecule() const;
 
     std::string Basename() const;
 
+    /*! \brief Number of complete frames in the file */
+    inline int FrameCount() const { return m_frames.size(); }
+
+    /*! \brief Parse frame index (starting at 0), safe to be called from several threads */
+    Molecule Frame(int index) const;
+
+    /*! \brief Parse the frames first, first + stride, ... < last (last < 0 means all) with threads */
+    std::vector<Molecule> Frames(int first = 0, int last = -1, int stride = 1, int threads = 1) const;
+
+    /*! \brief Let Next() visit only first, first + stride, ... < last and restart at first */
+    void setSlice(int first, int last = -1, int stride = 1);
+
+    /*! \brief Next() parses blocks of frames ahead with this number of threads */
+    inline void setThreads(int threads) { m_threads = std::max(1, threads); }
+
 private:
     bool CheckNext();
 
     int CountLines() const;
 
+    bool Map();
+    void Unmap();
+    void BuildIndex();
+
     std::string m_filename, m_basename;
-    std::ifstream* m_file;
-    bool m_end = false, m_init = false;
+    std::ifstream* m_file = nullptr;
+    bool m_end = false, m_init = false, m_indexed = false, m_binary = false;
     Molecule m_current;
     int m_lines = 0, m_current_mol = 0, m_mols = 0;
+
+    const char* m_data = nullptr;
+    std::size_t m_size = 0;
+    std::vector<char> m_buffer;
+    std::vector<std::size_t> m_frames;
+    BinaryTrajectory::Header m_header;
+    int m_first = 0, m_last = 0, m_stride = 1, m_position = 0, m_threads = 1;
+    std::vector<Molecule> m_block;
+    int m_block_start = 0;
 };
@@ -26,19 +26,33 @@
 #include "forcefield.h"
 #include "forcefieldthread.h"
 
+#include <algorithm>
+#include <cstdint>
+#include <fstream>
+
 ForceField::ForceField(const json& controller)
 {
     json parameter = MergeJson(UFFParameterJson, controller);
 
     m_threadpool = new CxxThreadPool();
     m_threadpool->setProgressBar(CxxThreadPool::ProgressBarType::None);
+    m_reductionpool = new CxxThreadPool();
+    m_reductionpool->setProgressBar(CxxThreadPool::ProgressBarType::None);
     m_threads = parameter["threads"];
     m_gradient_type = parameter["gradient"];
+    m_simd = parameter["simd"];
+    m_calibration = parameter["balance_calibration"];
+    m_gradient_check = parameter["gradient_check"];
 }
 
 ForceField::~ForceField()
 {
     delete m_threadpool;
+    delete m_reductionpool;
+    for (auto* thread : m_stored_threads)
+        delete thread;
+    for (auto* thread : m_reduction_threads)
+        delete thread;
 }
 
 void ForceField::UpdateGeometry(const Matrix& geometry)
@@ -78,11 +92,183 @@ void ForceField::setParameter(const json& parameters)
         setInversions(parameters["inversions"]);
     if (parameters.contains("vdws"))
         setvdWs(parameters["vdws"]);
+    m_vdw_atoms.clear();
+    m_vdw_exclusions.clear();
+    if (parameters.contains("vdw_atoms") && parameters.contains("vdw_exclusions"))
+        setvdWAtoms(parameters["vdw_atoms"], parameters["vdw_exclusions"]);
+    setOptions(parameters);
+    AutoRanges();
+}
+
+void ForceField::setOptions(const json& parameters)
+{
+    if (parameters.contains("vdw_cutoff"))
+        m_vdw_cutoff = parameters["vdw_cutoff"];
+    if (parameters.contains("vdw_skin"))
+        m_vdw_skin = parameters["vdw_skin"];
+    if (parameters.contains("vdw_switch"))
+        m_vdw_switch = parameters["vdw_switch"];
+    if (m_vdw_cutoff <= 0)
+        m_vdw_atoms.clear();
+    m_neighbourlist.setCutoff(m_vdw_cutoff, m_vdw_skin);
+    m_neighbourlist.setExclusions(m_vdw_exclusions);
+
     m_parameters = parameters;
     m_method = m_parameters["method"];
     if (m_parameters.contains("e0"))
         m_e0 = m_parameters["e0"];
+}
+
+bool ForceField::isBinaryParameterFile(const std::string& file)
+{
+    std::ifstream input(file, std::ios::binary);
+    char magic[4] = { 0, 0, 0, 0 };
+    if (!input.read(magic, 4))
+        return false;
+    FFParameterHeader header;
+    return std::equal(magic, magic + 4, header.magic);
+}
+
+template <typename T>
+inline bool ReadBlock(std::ifstream& input, std::vector<T>& data, uint64_t size)
+{
+    data.resize(size);
+    return size == 0 || bool(input.read(reinterpret_cast<char*>(data.data()), size * sizeof(T)));
+}
+
+template <typename T>
+inline void WriteBlock(std::ofstream& output, const std::vector<T>& data)
+{
+    if (data.size())
+        output.write(reinterpret_cast<const char*>(data.data()), data.size() * sizeof(T));
+}
+
+bool ForceField::setParameterFile(const std::string& file)
+{
+    if (!isBinaryParameterFile(file)) {
+        std::ifstream parameterfile(file);
+        json parameters;
+        try {
+            parameterfile >> parameters;
+        } catch (nlohmann::json::type_error& e) {
+            return false;
+        } catch (nlohmann::json::parse_error& e) {
+            return false;
+        }
+        setParameter(parameters);
+        return true;
+    }
+
+    std::ifstream input(file, std::ios::binary);
+    FFParameterHeader header, reference;
+    input.read(reinterpret_cast<char*>(&header), sizeof(FFParameterHeader));
+    if (!input || header.version != reference.version || !std::equal(header.sizes, header.sizes + 7, reference.sizes)) {
+        std::cout << "Binary parameter file " << file << " was written by an incompatible version, please regenerate it." << std::endl;
+        return false;
+    }
+
+    std::vector<int> offsets, indices;
+    std::vector<std::uint8_t> options;
+    bool ok = ReadBlock(input, m_bonds, header.bonds)
+        && ReadBlock(input, m_angles, header.angles)
+        && ReadBlock(input, m_dihedrals, header.dihedrals)
+        && ReadBlock(input, m_inversions, header.inversions)
+        && ReadBlock(input, m_vdWs, header.vdws)
+        && ReadBlock(input, m_EQs, header.eqs)
+        && ReadBlock(input, m_vdw_atoms, header.vdw_atoms)
+        && ReadBlock(input, offsets, header.vdw_atoms ? header.vdw_atoms + 1 : 0)
+        && ReadBlock(input, indices, header.exclusions)
+        && ReadBlock(input, options, header.options);
+    if (!ok) {
+        std::cout << "Binary parameter file " << file << " is truncated." << std::endl;
+        return false;
+    }
+
+    m_vdw_exclusions.assign(header.vdw_atoms, std::vector<int>());
+    for (int i = 0; i < header.vdw_atoms; ++i)
+        m_vdw_exclusions[i].assign(indices.begin() + offsets[i], indices.begin() + offsets[i + 1]);
+
+    setOptions(json::from_msgpack(options));
     AutoRanges();
+    return true;
+}
+
+bool ForceField::writeParameterFile(const std::string& file) const
+{
+    std::ofstream output(file, std::ios::binary);
+    if (!output)
+        return false;
+
+    json options = m_parameters;
+    for (const char* key : { "bonds", "angles", "dihedrals", "inversions", "vdws", "esps", "vdw_atoms", "vdw_exclusions" })
+        options.erase(key);
+    std::vector<std::uint8_t> msgpack = json::to_msgpack(options);
+
+    std::vector<int> offsets, indices;
+    if (m_vdw_atoms.size()) {
+        offsets.push_back(0);
+        for (int i = 0; i < m_vdw_atoms.size(); ++i) {
+            if (i < m_vdw_exclusions.size())
+                indices.insert(indices.end(), m_vdw_exclusions[i].begin(), m_vdw_exclusions[i].end());
+            offsets.push_back(indices.size());
+        }
+    }
+
+    FFParameterHeader header;
+    header.bonds = m_bonds.size();
+    header.angles = m_angles.size();
+    header.dihedrals = m_dihedrals.size();
+    header.inversions = m_inversions.size();
+    header.vdws = m_vdWs.size();
+    header.eqs = m_EQs.size();
+    header.vdw_atoms = m_vdw_atoms.size();
+    header.exclusions = indices.size();
+    header.options = msgpack.size();
+
+    output.write(reinterpret_cast<const char*>(&header), sizeof(FFParameterHeader));
+    WriteBlock(output, m_bonds);
+    WriteBlock(output, m_angles);
+    WriteBlock(output, m_dihedrals);
+    WriteBlock(output, m_inversions);
+    WriteBlock(output, m_vdWs);
+    WriteBlock(output, m_EQs);
+    WriteBlock(output, m_vdw_atoms);
+    WriteBlock(output, offsets);
+    WriteBlock(output, indices);
+    WriteBlock(output, msgpack);
+    return bool(output);
+}
+
+json ForceField::exportParameter() const
+{
+    json parameters = m_parameters;
+    parameters["bonds"] = json::array();
+    for (const auto& b : m_bonds)
+        parameters["bonds"].push_back({ { "type", b.type }, { "i", b.i }, { "j", b.j }, { "k", b.k }, { "distance", b.distance }, { "fc", b.fc }, { "exponent", b.exponent }, { "r0_ij", b.r0_ij }, { "r0_ik", b.r0_ik } });
+
+    parameters["angles"] = json::array();
+    for (const auto& a : m_angles)
+        parameters["angles"].push_back({ { "type", a.type }, { "i", a.i }, { "j", a.j }, { "k", a.k }, { "fc", a.fc }, { "r0_ij", a.r0_ij }, { "r0_ik", a.r0_ik }, { "theta0_ijk", a.theta0_ijk }, { "C0", a.C0 }, { "C1", a.C1 }, { "C2", a.C2 } });
+
+    parameters["dihedrals"] = json::array();
+    for (const auto& d : m_dihedrals)
+        parameters["dihedrals"].push_back({ { "type", d.type }, { "i", d.i }, { "j", d.j }, { "k", d.k }, { "l", d.l }, { "V", d.V }, { "n", d.n }, { "phi0", d.phi0 } });
+
+    parameters["inversions"] = json::array();
+    for (const auto& inv : m_inversions)
+        parameters["inversions"].push_back({ { "type", inv.type }, { "i", inv.i }, { "j", inv.j }, { "k", inv.k }, { "l", inv.l }, { "fc", inv.fc }, { "C0", inv.C0 }, { "C1", inv.C1 }, { "C2", inv.C2 } });
+
+    parameters["vdws"] = json::array();
+    for (const auto& v : m_vdWs)
+        parameters["vdws"].push_back({ { "type", v.type }, { "i", v.i }, { "j", v.j }, { "C_ij", v.C_ij }, { "r0_ij", v.r0_ij } });
+
+    if (m_vdw_atoms.size()) {
+        parameters["vdw_atoms"] = json::array();
+        for (const auto& atom : m_vdw_atoms)
+            parameters["vdw_atoms"].push_back({ atom.C_i, atom.r0_i });
+        parameters["vdw_exclusions"] = m_vdw_exclusions;
+    }
+    return parameters;
 }
 
 void ForceField::setBonds(const json& bonds)
@@ -186,6 +372,18 @@ void ForceField::setvdWs(const json& vdws)
     }
 }
 
+void ForceField::setvdWAtoms(const json& atoms, const json& exclusions)
+{
+    m_vdw_atoms.clear();
+    for (int i = 0; i < atoms.size(); ++i) {
+        vdWAtom atom;
+        atom.C_i = atoms[i][0];
+        atom.r0_i = atoms[i][1];
+        m_vdw_atoms.push_back(atom);
+    }
+    m_vdw_exclusions = exclusions.get<std::vector<std::vector<int>>>();
+}
+
 void ForceField::setESPs(const json& esps)
 {
     m_EQs.clear();
@@ -206,56 +404,247 @@ void ForceField::setESPs(const json& esps)
 
 void ForceField::AutoRanges()
 {
-    int free_threads = m_threads;
+    m_threadpool->clear();
+    for (auto* thread : m_stored_threads)
+        delete thread;
+    m_stored_threads.clear();
+
     int d3 = m_parameters["d3"];
-    if (d3) {
-        if (free_threads > 1)
-            free_threads--;
-        D3Thread* thread = new D3Thread(m_threads - 1, free_threads);
-        thread->setParamater(m_parameters);
-        thread->Initialise(m_atom_types);
-        m_threadpool->addThread(thread);
-        m_stored_threads.push_back(thread);
-    }
     int h4 = m_parameters["h4"];
-    if (h4) {
-        if (free_threads > 1)
-            free_threads--;
-        H4Thread* thread = new H4Thread(m_threads - 1, free_threads);
-        thread->setParamater(m_parameters);
-        thread->Initialise(m_atom_types);
-
-        m_threadpool->addThread(thread);
-        m_stored_threads.push_back(thread);
-    }
-    for (int i = 0; i < free_threads; ++i) {
-        ForceFieldThread* thread = new ForceFieldThread(i, free_threads);
+    for (int i = 0; i < m_threads; ++i) {
+        ForceFieldThread* thread = new ForceFieldThread(i, m_threads);
         thread->setGeometry(m_geometry, false);
-        m_threadpool->addThread(thread);
-        m_stored_threads.push_back(thread);
+        thread->setSIMD(m_simd);
         if (std::find(m_uff_methods.begin(), m_uff_methods.end(), m_method) != m_uff_methods.end()) {
             thread->setMethod(1);
         } else if (std::find(m_qmdff_methods.begin(), m_qmdff_methods.end(), m_method) != m_qmdff_methods.end()) {
             thread->setMethod(2);
         }
-        for (int j = int(i * m_bonds.size() / double(free_threads)); j < int((i + 1) * m_bonds.size() / double(free_threads)); ++j)
-            thread->addBond(m_bonds[j]);
+        if (m_vdw_atoms.size())
+            thread->setNeighbourList(&m_neighbourlist, &m_vdw_atoms, m_vdw_cutoff, m_vdw_switch);
 
-        for (int j = int(i * m_angles.size() / double(free_threads)); j < int((i + 1) * m_angles.size() / double(free_threads)); ++j)
-            thread->addAngle(m_angles[j]);
+        /* the H4 correction is split over all threads, D3 is one library call and stays on the last one */
+        if (h4)
+            thread->setH4(m_parameters, m_atom_types);
+        if (d3 && i == m_threads - 1)
+            thread->setD3(m_parameters, m_atom_types);
 
-        for (int j = int(i * m_dihedrals.size() / double(free_threads)); j < int((i + 1) * m_dihedrals.size() / double(free_threads)); ++j)
-            thread->addDihedral(m_dihedrals[j]);
+        m_threadpool->addThread(thread);
+        m_stored_threads.push_back(thread);
+    }
+    Partition();
+
+    m_calibration_calls = 0;
+    for (auto* thread : m_stored_threads) {
+        thread->resetTimings();
+        thread->setTiming(m_threads > 1 && m_calibration > 0);
+    }
 
-        for (int j = int(i * m_inversions.size() / double(free_threads)); j < int((i + 1) * m_inversions.size() / double(free_threads)); ++j)
-            thread->addInversion(m_inversions[j]);
+    /* contiguous atom ranges for the gradient reduction, small systems are summed up in one go */
+    m_reductionpool->clear();
+    for (auto* thread : m_reduction_threads)
+        delete thread;
+    m_reduction_threads.clear();
+    const int ranges = std::max(1, std::min(m_threads, m_natoms / 128));
+    for (int i = 0; i < ranges; ++i) {
+        ForceFieldReductionThread* thread = new ForceFieldReductionThread(&m_stored_threads, &m_gradient, i * m_natoms / ranges, (i + 1) * m_natoms / ranges);
+        m_reductionpool->addThread(thread);
+        m_reduction_threads.push_back(thread);
+    }
+}
 
-        for (int j = int(i * m_vdWs.size() / double(free_threads)); j < int((i + 1) * m_vdWs.size() / double(free_threads)); ++j)
-            thread->addvdW(m_vdWs[j]);
+std::array<double, FFTermTypes> ForceField::TermCounts() const
+{
+    std::array<double, FFTermTypes> counts = {};
+    counts[FFBondTerm] = m_bonds.size();
+    counts[FFAngleTerm] = m_angles.size();
+    counts[FFDihedralTerm] = m_dihedrals.size();
+    counts[FFInversionTerm] = m_inversions.size();
+    /* pairs within the cutoff are counted as found by the last neighbour list update */
+    counts[FFvdWTerm] = m_vdWs.size() + (m_vdw_atoms.size() ? m_neighbourlist.Size() : 0);
+    counts[FFEQTerm] = m_EQs.size();
+
+    /* both H4 and HH run over pairs of heavy donors/acceptors and pairs of hydrogens */
+    if (int(m_parameters.value("h4", 0))) {
+        double polar = 0, hydrogen = 0;
+        for (int element : m_atom_types) {
+            polar += (element == 7 || element == 8);
+            hydrogen += (element == 1);
+        }
+        counts[FFH4Term] = 0.5 * polar * polar + 0.5 * hydrogen * hydrogen;
+    }
+    if (int(m_parameters.value("d3", 0)))
+        counts[FFD3Term] = 0.5 * double(m_natoms) * double(m_natoms);
+    return counts;
+}
 
-        for (int j = int(i * m_EQs.size() / double(free_threads)); j < int((i + 1) * m_EQs.size() / double(free_threads)); ++j)
-            thread->addEQ(m_EQs[j]);
+std::vector<int> ForceField::SpatialOrder() const
+{
+    /* Morton (z-order) key of every atom on a grid of 2 Angstrom, terms sorted by it
+     * touch compact regions of the geometry and gradient */
+    std::vector<uint64_t> keys(m_natoms, 0);
+    if (m_geometry.rows() == m_natoms && m_natoms > 0) {
+        Eigen::RowVector3d min = m_geometry.colwise().minCoeff();
+        for (int i = 0; i < m_natoms; ++i) {
+            uint64_t key = 0;
+            for (int xyz = 0; xyz < 3; ++xyz) {
+                uint64_t cell = std::min<uint64_t>(uint64_t((m_geometry(i, xyz) - min(xyz)) / 2.0), (1u << 21) - 1);
+                for (int bit = 0; bit < 21; ++bit)
+                    key |= ((cell >> bit) & 1ull) << (3 * bit + xyz);
+            }
+            keys[i] = key;
+        }
     }
+    std::vector<int> order(m_natoms);
+    for (int i = 0; i < m_natoms; ++i)
+        order[i] = i;
+    std::stable_sort(order.begin(), order.end(), [&keys](int a, int b) { return keys[a] < keys[b]; });
+    std::vector<int> rank(m_natoms);
+    for (int i = 0; i < m_natoms; ++i)
+        rank[order[i]] = i;
+    return rank;
+}
+
+template <typename Term, typename Key>
+inline std::vector<int> SortedTerms(const std::vector<Term>& terms, const std::vector<int>& rank, Key key)
+{
+    std::vector<int> order(terms.size());
+    for (int i = 0; i < order.size(); ++i)
+        order[i] = i;
+    if (rank.size())
+        std::stable_sort(order.begin(), order.end(), [&](int a, int b) { return rank[key(terms[a])] < rank[key(terms[b])]; });
+    return order;
+}
+
+void ForceField::Partition()
+{
+    const int workers = m_stored_threads.size();
+    if (workers == 0)
+        return;
+
+    const std::array<double, FFTermTypes> counts = TermCounts();
+    double bonded = 0;
+    for (int type = 0; type < FFH4Term; ++type)
+        bonded += counts[type] * m_term_costs[type];
+    const double h4 = counts[FFH4Term] * m_term_costs[FFH4Term];
+    const double d3 = counts[FFD3Term] * m_term_costs[FFD3Term];
+    const double target = (bonded + h4 + d3) / workers;
+
+    /* every thread gets the share of bonded work that fills it up to the average load */
+    std::vector<double> budget(workers, 0);
+    double sum = 0;
+    for (int i = 0; i < workers; ++i) {
+        double extra = 0;
+        if (m_stored_threads[i]->hasH4())
+            extra += h4 / workers;
+        if (m_stored_threads[i]->hasD3())
+            extra += d3;
+        budget[i] = std::max(0.0, target - extra);
+        sum += budget[i];
+    }
+
+    /* the cutoff pairs go to the threads without D3, weighted by their budget, the rest of it is filled with bonded terms */
+    const double pairs = (m_vdw_atoms.size() ? m_neighbourlist.Size() : 0) * m_term_costs[FFvdWTerm];
+    std::vector<double> pair_weight(workers, 0);
+    double pair_sum = 0;
+    for (int i = 0; i < workers; ++i) {
+        if (m_stored_threads[i]->hasD3() && workers > 1)
+            continue;
+        pair_weight[i] = budget[i] > 0 ? budget[i] : 1e-12;
+        pair_sum += pair_weight[i];
+    }
+    std::vector<double> pair_fraction(workers + 1, 0);
+    sum = 0;
+    for (int i = 0; i < workers; ++i) {
+        pair_fraction[i + 1] = pair_fraction[i] + pair_weight[i] / pair_sum;
+        budget[i] = std::max(0.0, budget[i] - pairs * pair_weight[i] / pair_sum);
+        sum += budget[i];
+    }
+    pair_fraction[workers] = 1;
+
+    std::vector<double> fraction(workers + 1, 0);
+    for (int i = 0; i < workers; ++i)
+        fraction[i + 1] = fraction[i] + (sum > 0 ? budget[i] / sum : 1.0 / workers);
+    fraction[workers] = 1;
+
+    /* without a geometry there is no spatial order yet, Calculate partitions again once it is known */
+    m_spatial_order = m_geometry.rows() == m_natoms && m_natoms > 0;
+    const std::vector<int> rank = m_spatial_order ? SpatialOrder() : std::vector<int>();
+    const std::vector<int> bonds = SortedTerms(m_bonds, rank, [](const Bond& term) { return term.i; });
+    const std::vector<int> angles = SortedTerms(m_angles, rank, [](const Angle& term) { return term.j; });
+    const std::vector<int> dihedrals = SortedTerms(m_dihedrals, rank, [](const Dihedral& term) { return term.j; });
+    const std::vector<int> inversions = SortedTerms(m_inversions, rank, [](const Inversion& term) { return term.i; });
+    const std::vector<int> vdws = SortedTerms(m_vdWs, rank, [](const vdW& term) { return term.i; });
+    const std::vector<int> eqs = SortedTerms(m_EQs, rank, [](const EQ& term) { return term.i; });
+
+    auto range = [&fraction](int worker, std::size_t size, int& begin, int& end) {
+        begin = int(std::round(fraction[worker] * size));
+        end = int(std::round(fraction[worker + 1] * size));
+    };
+
+    for (int i = 0; i < workers; ++i) {
+        ForceFieldThread* thread = m_stored_threads[i];
+        thread->clearTerms();
+        thread->setPairRange(pair_fraction[i], pair_fraction[i + 1]);
+        int begin, end;
+        range(i, bonds.size(), begin, end);
+        for (int j = begin; j < end; ++j)
+            thread->addBond(m_bonds[bonds[j]]);
+        range(i, angles.size(), begin, end);
+        for (int j = begin; j < end; ++j)
+            thread->addAngle(m_angles[angles[j]]);
+        range(i, dihedrals.size(), begin, end);
+        for (int j = begin; j < end; ++j)
+            thread->addDihedral(m_dihedrals[dihedrals[j]]);
+        range(i, inversions.size(), begin, end);
+        for (int j = begin; j < end; ++j)
+            thread->addInversion(m_inversions[inversions[j]]);
+        range(i, vdws.size(), begin, end);
+        for (int j = begin; j < end; ++j)
+            thread->addvdW(m_vdWs[vdws[j]]);
+        range(i, eqs.size(), begin, end);
+        for (int j = begin; j < end; ++j)
+            thread->addEQ(m_EQs[eqs[j]]);
+
+        /* the pair loops of H4 run over j < i, so equal work means sqrt spaced boundaries */
+        if (thread->hasH4())
+            thread->setH4Range(int(m_natoms * std::sqrt(double(i) / workers)), i + 1 == workers ? m_natoms : int(m_natoms * std::sqrt(double(i + 1) / workers)));
+    }
+}
+
+void ForceField::Calibrate()
+{
+    std::array<double, FFTermTypes> timings = {};
+    for (const auto* thread : m_stored_threads)
+        for (int type = 0; type < FFTermTypes; ++type)
+            timings[type] += thread->Timings()[type];
+
+    const std::array<double, FFTermTypes> counts = TermCounts();
+    for (int type = 0; type < FFTermTypes; ++type) {
+        if (counts[type] > 0 && timings[type] > 0)
+            m_term_costs[type] = timings[type] / (counts[type] * m_calibration);
+    }
+    for (auto* thread : m_stored_threads)
+        thread->setTiming(false);
+    Partition();
+}
+
+void ForceField::ReduceGradient()
+{
+    if (m_gradient.rows() != m_geometry.rows() || m_gradient.cols() != 3)
+        m_gradient.resize(m_geometry.rows(), 3);
+
+    if (m_reduction_threads.empty()) {
+        m_gradient.setZero();
+        return;
+    }
+    if (m_reduction_threads.size() == 1) {
+        m_reduction_threads[0]->execute();
+        return;
+    }
+    m_reductionpool->Reset();
+    m_reductionpool->setActiveThreadCount(m_reduction_threads.size());
+    m_reductionpool->StartAndWait();
 }
 
 Eigen::MatrixXd ForceField::NumGrad()
@@ -282,7 +671,6 @@ Eigen::MatrixXd ForceField::NumGrad()
 
 double ForceField::Calculate(bool gradient, bool verbose)
 {
-    m_gradient = Eigen::MatrixXd::Zero(m_geometry.rows(), 3);
     double energy = 0.0;
     double d4_energy = 0;
     double d3_energy = 0;
@@ -296,6 +684,11 @@ double ForceField::Calculate(bool gradient, bool verbose)
     double h4_energy = 0.0;
     double hh_energy = 0.0;
 
+    if (m_vdw_atoms.size())
+        m_neighbourlist.Update(m_geometry);
+    if (!m_spatial_order && m_geometry.rows() == m_natoms && m_natoms > 0)
+        Partition();
+
     for (int i = 0; i < m_stored_threads.size(); ++i) {
         m_stored_threads[i]->UpdateGeometry(m_geometry, gradient);
     }
@@ -311,20 +704,39 @@ double ForceField::Calculate(bool gradient, bool verbose)
         angle_energy += m_stored_threads[i]->AngleEnergy();
         dihedral_energy += m_stored_threads[i]->DihedralEnergy();
         inversion_energy += m_stored_threads[i]->InversionEnergy();
-        if (m_stored_threads[i]->Type() != 3)
-            vdw_energy += m_stored_threads[i]->VdWEnergy();
-        else
-            h4_energy += m_stored_threads[i]->VdWEnergy();
-        if (m_stored_threads[i]->Type() != 3)
-            rep_energy += m_stored_threads[i]->RepEnergy();
-        else
-            hh_energy += m_stored_threads[i]->RepEnergy();
+        vdw_energy += m_stored_threads[i]->VdWEnergy();
+        rep_energy += m_stored_threads[i]->RepEnergy();
+        d3_energy += m_stored_threads[i]->D3Energy();
+        h4_energy += m_stored_threads[i]->H4Energy();
+        hh_energy += m_stored_threads[i]->HHEnergy();
         // eq_energy += m_stored_threads[i]->RepEnergy();
+    }
 
-        m_gradient += m_stored_threads[i]->Gradient();
+    /* the first call warms up caches and the neighbour list, the following ones are timed */
+    if (m_threads > 1 && m_calibration > 0 && m_calibration_calls <= m_calibration) {
+        if (m_calibration_calls == 0) {
+            for (auto* thread : m_stored_threads)
+                thread->resetTimings();
+        } else if (m_calibration_calls == m_calibration)
+            Calibrate();
+        m_calibration_calls++;
+    }
+    if (gradient)
+        ReduceGradient();
+    else
+        m_gradient = Eigen::MatrixXd::Zero(m_geometry.rows(), 3);
+
+    if (gradient && m_gradient_check) {
+        /* NumGrad only calls Calculate(false), the analytic gradient is restored afterwards */
+        Matrix analytic = m_gradient;
+        Eigen::MatrixXd numerical = NumGrad();
+        m_gradient = analytic;
+        Eigen::MatrixXd::Index atom, xyz;
+        double deviation = (analytic - numerical).cwiseAbs().maxCoeff(&atom, &xyz);
+        std::cout << "Gradient check: largest deviation between analytic and numerical gradient " << deviation << " Eh/A (atom " << atom + 1 << ", component " << xyz << ")" << std::endl;
     }
 
-    energy = m_e0 + bond_energy + angle_energy + dihedral_energy + inversion_energy + vdw_energy + rep_energy + eq_energy + h4_energy + hh_energy;
+    energy = m_e0 + bond_energy + angle_energy + dihedral_energy + inversion_energy + vdw_energy + rep_energy + eq_energy + h4_energy + hh_energy + d3_energy;
     if (verbose) {
         std::cout << "Total energy " << energy << " Eh. Sum of " << std::endl
                   << "E0 (from QMDFF) " << m_e0 << " Eh" << std::endl
@@ -24,6 +24,7 @@
 #include "forcefieldthread.h"
 
 #include "hbonds.h"
+#include "neighbourlist.h"
 
 #include "external/CxxThreadPool/include/CxxThreadPool.h"
 
@@ -38,15 +39,28 @@
 #include "src/core/qmdff_par.h"
 #include "src/core/uff_par.h"
 
+#include <array>
+#include <cstdint>
 #include <functional>
 #include <set>
 #include <vector>
 
 #include <Eigen/Dense>
+#include <Eigen/Sparse>
 
 #include "json.hpp"
 using json = nlohmann::json;
 
+/* header of the binary parameter file, followed by the raw term arrays
+ * Bond, Angle, Dihedral, Inversion, vdW, EQ, vdWAtom, the exclusion offsets and indices
+ * and finally the remaining (scalar) options as msgpack */
+struct FFParameterHeader {
+    char magic[4] = { 'C', 'F', 'F', 'P' };
+    uint32_t version = 1;
+    uint32_t sizes[7] = { sizeof(Bond), sizeof(Angle), sizeof(Dihedral), sizeof(Inversion), sizeof(vdW), sizeof(EQ), sizeof(vdWAtom) };
+    uint64_t bonds = 0, angles = 0, dihedrals = 0, inversions = 0, vdws = 0, eqs = 0, vdw_atoms = 0, exclusions = 0, options = 0;
+};
+
 static const json FFJson = {
     { "threads", 1 },
     { "gradient", 1 }
@@ -73,19 +87,44 @@ public:
     Matrix Gradient() const { return m_gradient; }
 
     void setParameter(const json& parameter);
-    void setParameterFile(const std::string& file);
+
+    /*! \brief Load parameters from file, binary files are read directly into the term arrays, everything else is parsed as json */
+    bool setParameterFile(const std::string& file);
+    bool writeParameterFile(const std::string& file) const;
+    static bool isBinaryParameterFile(const std::string& file);
+    json exportParameter() const;
+
     Eigen::MatrixXd NumGrad();
 
+    /*! \brief Second derivatives (Eh/A^2) at the current geometry, assembled term by term
+     *
+     * Pair terms and UFF angles are differentiated analytically, the remaining bonded terms
+     * by central differences of their own analytic gradient, displacing only the atoms of
+     * the term. D3 and H4 are differentiated from their gradients. */
+    Eigen::SparseMatrix<double> AnalyticHessian();
+
 private:
     void AutoRanges();
+    void setOptions(const json& parameters);
     void setBonds(const json& bonds);
     void setAngles(const json& angles);
     void setDihedrals(const json& dihedrals);
     void setInversions(const json& inversions);
     void setESPs(const json& esps);
+    void setvdWAtoms(const json& atoms, const json& exclusions);
+
+    void ReduceGradient();
+
+    /* cost model based distribution of the terms over the threads */
+    void Partition();
+    void Calibrate();
+    std::array<double, FFTermTypes> TermCounts() const;
+    std::vector<int> SpatialOrder() const;
 
     std::vector<ForceFieldThread*> m_stored_threads;
+    std::vector<ForceFieldReductionThread*> m_reduction_threads;
     CxxThreadPool* m_threadpool;
+    CxxThreadPool* m_reductionpool;
     void setvdWs(const json& vdws);
 
     Matrix m_geometry, m_gradient;
@@ -97,11 +136,22 @@ private:
     int m_natoms = 0;
     int m_threads = 1;
     int m_gradient_type = 1;
+    bool m_simd = true;
+    bool m_gradient_check = false;
+
+    /* estimated cost per term in microseconds, replaced by measured values after calibration */
+    std::array<double, FFTermTypes> m_term_costs = { 0.01, 0.03, 0.06, 0.06, 0.02, 0.02, 0.01, 0.05 };
+    int m_calibration = 3, m_calibration_calls = 0;
+    bool m_spatial_order = false;
     std::vector<Bond> m_bonds;
     std::vector<Angle> m_angles;
     std::vector<Dihedral> m_dihedrals;
     std::vector<Inversion> m_inversions;
     std::vector<vdW> m_vdWs;
     std::vector<EQ> m_EQs;
+    std::vector<vdWAtom> m_vdw_atoms;
+    std::vector<std::vector<int>> m_vdw_exclusions;
+    NeighbourList m_neighbourlist;
+    double m_vdw_cutoff = 0, m_vdw_skin = 2, m_vdw_switch = 1;
     json m_parameters;
 };
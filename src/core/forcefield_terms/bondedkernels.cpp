@@ -0,0 +1,71 @@
+/*
+ * < Scalar bonded UFF kernels and runtime dispatch. >
+ * Copyright (C) 2025 Conrad Hübler <Conrad.Huebler@gmx.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+#define BONDED_KERNEL_ARCH Generic
+#include "bondedkernels_impl.h"
+
+namespace BondedKernels {
+
+bool AVX2Available()
+{
+#ifdef CURCUMA_BONDED_AVX2
+    static const bool available = __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+    return available;
+#else
+    return false;
+#endif
+}
+
+double UFFBonds(const BondSoA& terms, const double* geometry, double* gradient, double factor, bool calc_gradient, bool simd)
+{
+#ifdef CURCUMA_BONDED_AVX2
+    if (simd && AVX2Available())
+        return AVX2::UFFBonds(terms, geometry, gradient, factor, calc_gradient);
+#endif
+    return Generic::UFFBondsT<double>(terms, geometry, gradient, factor, calc_gradient);
+}
+
+double UFFAngles(const AngleSoA& terms, const double* geometry, double* gradient, double factor, bool calc_gradient, bool simd)
+{
+#ifdef CURCUMA_BONDED_AVX2
+    if (simd && AVX2Available())
+        return AVX2::UFFAngles(terms, geometry, gradient, factor, calc_gradient);
+#endif
+    return Generic::UFFAnglesT<double>(terms, geometry, gradient, factor, calc_gradient);
+}
+
+double UFFDihedrals(const DihedralSoA& terms, const double* geometry, double* gradient, double factor, bool calc_gradient, bool simd)
+{
+#ifdef CURCUMA_BONDED_AVX2
+    if (simd && AVX2Available())
+        return AVX2::UFFDihedrals(terms, geometry, gradient, factor, calc_gradient);
+#endif
+    return Generic::UFFDihedralsT<double>(terms, geometry, gradient, factor, calc_gradient);
+}
+
+double UFFInversions(const InversionSoA& terms, const double* geometry, double* gradient, double factor, bool calc_gradient, bool simd)
+{
+#ifdef CURCUMA_BONDED_AVX2
+    if (simd && AVX2Available())
+        return AVX2::UFFInversions(terms, geometry, gradient, factor, calc_gradient);
+#endif
+    return Generic::UFFInversionsT<double>(terms, geometry, gradient, factor, calc_gradient);
+}
+}
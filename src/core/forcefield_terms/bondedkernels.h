@@ -0,0 +1,122 @@
+/*
+ * < Structure-of-arrays kernels for the bonded UFF terms. >
+ * Copyright (C) 2025 Conrad Hübler <Conrad.Huebler@gmx.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+/* Bonded UFF terms stored as structure of arrays, so that several terms can be
+ * evaluated in one SIMD register. The kernels themselves are in bondedkernels_impl.h,
+ * the AVX2 variant is selected at runtime if the cpu supports it. */
+
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#define CURCUMA_BONDED_AVX2
+#endif
+
+struct BondSoA {
+    std::vector<int> i, j;
+    std::vector<double> fc, r0;
+
+    inline void add(int a, int b, double force, double rest)
+    {
+        i.push_back(a);
+        j.push_back(b);
+        fc.push_back(force);
+        r0.push_back(rest);
+    }
+    inline int size() const { return i.size(); }
+};
+
+struct AngleSoA {
+    std::vector<int> i, j, k;
+    std::vector<double> fc, C0, C1, C2;
+
+    inline void add(int a, int b, int c, double force, double c0, double c1, double c2)
+    {
+        i.push_back(a);
+        j.push_back(b);
+        k.push_back(c);
+        fc.push_back(force);
+        C0.push_back(c0);
+        C1.push_back(c1);
+        C2.push_back(c2);
+    }
+    inline int size() const { return i.size(); }
+};
+
+/* n is the (integer) multiplicity, cos(n phi) is built by recurrence from cos(phi) */
+struct DihedralSoA {
+    std::vector<int> i, j, k, l;
+    std::vector<double> V, n, cos_nphi0;
+    int max_n = 0;
+
+    inline void add(int a, int b, int c, int d, double barrier, double multiplicity, double phi0)
+    {
+        i.push_back(a);
+        j.push_back(b);
+        k.push_back(c);
+        l.push_back(d);
+        V.push_back(barrier);
+        n.push_back(std::round(multiplicity));
+        cos_nphi0.push_back(cos(multiplicity * phi0));
+        max_n = std::max(max_n, int(std::round(multiplicity)));
+    }
+    inline int size() const { return i.size(); }
+};
+
+struct InversionSoA {
+    std::vector<int> i, j, k, l;
+    std::vector<double> fc, C0, C1, C2;
+
+    inline void add(int a, int b, int c, int d, double force, double c0, double c1, double c2)
+    {
+        i.push_back(a);
+        j.push_back(b);
+        k.push_back(c);
+        l.push_back(d);
+        fc.push_back(force);
+        C0.push_back(c0);
+        C1.push_back(c1);
+        C2.push_back(c2);
+    }
+    inline int size() const { return i.size(); }
+};
+
+namespace BondedKernels {
+
+/* returns true if the AVX2 kernels were compiled in and the cpu supports them */
+bool AVX2Available();
+
+double UFFBonds(const BondSoA& terms, const double* geometry, double* gradient, double factor, bool calc_gradient, bool simd = true);
+double UFFAngles(const AngleSoA& terms, const double* geometry, double* gradient, double factor, bool calc_gradient, bool simd = true);
+double UFFDihedrals(const DihedralSoA& terms, const double* geometry, double* gradient, double factor, bool calc_gradient, bool simd = true);
+double UFFInversions(const InversionSoA& terms, const double* geometry, double* gradient, double factor, bool calc_gradient, bool simd = true);
+
+#ifdef CURCUMA_BONDED_AVX2
+namespace AVX2 {
+double UFFBonds(const BondSoA& terms, const double* geometry, double* gradient, double factor, bool calc_gradient);
+double UFFAngles(const AngleSoA& terms, const double* geometry, double* gradient, double factor, bool calc_gradient);
+double UFFDihedrals(const DihedralSoA& terms, const double* geometry, double* gradient, double factor, bool calc_gradient);
+double UFFInversions(const InversionSoA& terms, const double* geometry, double* gradient, double factor, bool calc_gradient);
+}
+#endif
+}
+
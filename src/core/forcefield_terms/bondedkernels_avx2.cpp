@@ -0,0 +1,108 @@
+/*
+ * < AVX2 instantiation of the bonded UFF kernels. >
+ * Copyright (C) 2025 Conrad Hübler <Conrad.Huebler@gmx.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include "bondedkernels.h"
+
+#ifdef CURCUMA_BONDED_AVX2
+
+/* only this translation unit is compiled for avx2/fma, the dispatch in
+ * bondedkernels.cpp makes sure it is never entered on older cpus */
+#pragma GCC push_options
+#pragma GCC target("avx2,fma")
+
+#include <immintrin.h>
+
+#define BONDED_KERNEL_ARCH AVX2
+
+namespace BondedKernels {
+namespace AVX2 {
+
+struct Vec4 {
+    __m256d v;
+    inline Vec4() = default;
+    inline Vec4(__m256d value)
+        : v(value)
+    {
+    }
+};
+
+inline Vec4 operator+(Vec4 a, Vec4 b) { return _mm256_add_pd(a.v, b.v); }
+inline Vec4 operator-(Vec4 a, Vec4 b) { return _mm256_sub_pd(a.v, b.v); }
+inline Vec4 operator*(Vec4 a, Vec4 b) { return _mm256_mul_pd(a.v, b.v); }
+inline Vec4 operator/(Vec4 a, Vec4 b) { return _mm256_div_pd(a.v, b.v); }
+
+template <typename V>
+struct Lane;
+
+template <>
+struct Lane<Vec4> {
+    static constexpr int width = 4;
+    static inline Vec4 set(double value) { return _mm256_set1_pd(value); }
+    static inline Vec4 load(const double* data) { return _mm256_loadu_pd(data); }
+    static inline Vec4 gather(const double* geometry, const int* index, int xyz)
+    {
+        __m128i offset = _mm_loadu_si128(reinterpret_cast<const __m128i*>(index));
+        offset = _mm_add_epi32(_mm_mullo_epi32(offset, _mm_set1_epi32(3)), _mm_set1_epi32(xyz));
+        const __m256d zero = _mm256_setzero_pd();
+        return _mm256_mask_i32gather_pd(zero, geometry, offset, _mm256_cmp_pd(zero, zero, _CMP_EQ_OQ), 8);
+    }
+    static inline void store(double* data, Vec4 value) { _mm256_storeu_pd(data, value.v); }
+    static inline Vec4 sqrt(Vec4 value) { return _mm256_sqrt_pd(value.v); }
+    static inline Vec4 max(Vec4 a, Vec4 b) { return _mm256_max_pd(a.v, b.v); }
+    static inline Vec4 less(Vec4 a, Vec4 b, Vec4 x, Vec4 y) { return _mm256_blendv_pd(y.v, x.v, _mm256_cmp_pd(a.v, b.v, _CMP_LT_OQ)); }
+    static inline Vec4 equal(Vec4 a, Vec4 b, Vec4 x, Vec4 y) { return _mm256_blendv_pd(y.v, x.v, _mm256_cmp_pd(a.v, b.v, _CMP_EQ_OQ)); }
+};
+}
+}
+
+#include "bondedkernels_impl.h"
+
+namespace BondedKernels {
+namespace AVX2 {
+
+double UFFBonds(const BondSoA& terms, const double* geometry, double* gradient, double factor, bool calc_gradient)
+{
+    return UFFBondsT<Vec4>(terms, geometry, gradient, factor, calc_gradient);
+}
+
+double UFFAngles(const AngleSoA& terms, const double* geometry, double* gradient, double factor, bool calc_gradient)
+{
+    return UFFAnglesT<Vec4>(terms, geometry, gradient, factor, calc_gradient);
+}
+
+double UFFDihedrals(const DihedralSoA& terms, const double* geometry, double* gradient, double factor, bool calc_gradient)
+{
+    return UFFDihedralsT<Vec4>(terms, geometry, gradient, factor, calc_gradient);
+}
+
+double UFFInversions(const InversionSoA& terms, const double* geometry, double* gradient, double factor, bool calc_gradient)
+{
+    return UFFInversionsT<Vec4>(terms, geometry, gradient, factor, calc_gradient);
+}
+}
+}
+
+#pragma GCC pop_options
+
+#endif
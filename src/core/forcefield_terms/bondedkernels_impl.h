@@ -0,0 +1,387 @@
+/*
+ * < Lane generic kernels for the bonded UFF terms. >
+ * Copyright (C) 2025 Conrad Hübler <Conrad.Huebler@gmx.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+
+#include "bondedkernels.h"
+
+/* Included only by bondedkernels.cpp and bondedkernels_avx2.cpp. The including
+ * translation unit defines BONDED_KERNEL_ARCH, so that the scalar and the AVX2
+ * instantiations never share a symbol and the linker can not mix them up.
+ *
+ * The kernels work on raw row-major coordinates and gradients (x0 y0 z0 x1 ...).
+ * Every kernel is written once as template over the lane type, double is the
+ * scalar lane and handles the remainder of each term list. Gradient contributions
+ * are scattered lane by lane. NaN handling follows the former per-term implementation. */
+
+#ifndef BONDED_KERNEL_ARCH
+#error "BONDED_KERNEL_ARCH has to be defined before including bondedkernels_impl.h"
+#endif
+
+namespace BondedKernels {
+namespace BONDED_KERNEL_ARCH {
+
+template <typename V>
+struct Lane;
+
+template <>
+struct Lane<double> {
+    static constexpr int width = 1;
+    static inline double set(double value) { return value; }
+    static inline double load(const double* data) { return *data; }
+    static inline double gather(const double* geometry, const int* index, int xyz) { return geometry[3 * index[0] + xyz]; }
+    static inline void store(double* data, double value) { *data = value; }
+    static inline double sqrt(double value) { return std::sqrt(value); }
+    static inline double max(double a, double b) { return std::max(a, b); }
+    static inline double less(double a, double b, double x, double y) { return a < b ? x : y; }
+    static inline double equal(double a, double b, double x, double y) { return a == b ? x : y; }
+};
+
+template <typename V>
+struct Vec3 {
+    V x, y, z;
+};
+
+template <typename V>
+inline Vec3<V> Gather3(const double* geometry, const int* index)
+{
+    return Vec3<V>{ Lane<V>::gather(geometry, index, 0), Lane<V>::gather(geometry, index, 1), Lane<V>::gather(geometry, index, 2) };
+}
+
+template <typename V>
+inline Vec3<V> operator-(const Vec3<V>& a, const Vec3<V>& b) { return Vec3<V>{ a.x - b.x, a.y - b.y, a.z - b.z }; }
+
+template <typename V>
+inline Vec3<V> operator+(const Vec3<V>& a, const Vec3<V>& b) { return Vec3<V>{ a.x + b.x, a.y + b.y, a.z + b.z }; }
+
+template <typename V>
+inline Vec3<V> operator*(const Vec3<V>& a, const V& s) { return Vec3<V>{ a.x * s, a.y * s, a.z * s }; }
+
+template <typename V>
+inline V Dot(const Vec3<V>& a, const Vec3<V>& b) { return a.x * b.x + a.y * b.y + a.z * b.z; }
+
+template <typename V>
+inline Vec3<V> Cross(const Vec3<V>& a, const Vec3<V>& b)
+{
+    return Vec3<V>{ a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z, a.x * b.y - a.y * b.x };
+}
+
+template <typename V>
+inline void Store3(double* x, double* y, double* z, const Vec3<V>& a)
+{
+    Lane<V>::store(x, a.x);
+    Lane<V>::store(y, a.y);
+    Lane<V>::store(z, a.z);
+}
+
+inline void Scatter(double* gradient, int atom, double x, double y, double z)
+{
+    gradient[3 * atom + 0] += x;
+    gradient[3 * atom + 1] += y;
+    gradient[3 * atom + 2] += z;
+}
+
+template <typename V>
+inline double UFFBondBlock(const BondSoA& terms, int base, const double* geometry, double* gradient, double factor, bool calc_gradient)
+{
+    using L = Lane<V>;
+    constexpr int W = L::width;
+    const int* I = terms.i.data() + base;
+    const int* J = terms.j.data() + base;
+
+    Vec3<V> ij = Gather3<V>(geometry, I) - Gather3<V>(geometry, J);
+    V rij = L::sqrt(Dot(ij, ij));
+    V fc = L::load(terms.fc.data() + base);
+    V dr = rij - L::load(terms.r0.data() + base);
+    V f = L::set(factor);
+
+    double energy[W];
+    L::store(energy, L::set(0.5) * fc * dr * dr * f);
+    double sum = 0;
+    for (int lane = 0; lane < W; ++lane)
+        sum += energy[lane];
+
+    if (calc_gradient) {
+        double gx[W], gy[W], gz[W];
+        Store3(gx, gy, gz, ij * (fc * dr * f / rij));
+        for (int lane = 0; lane < W; ++lane) {
+            Scatter(gradient, I[lane], gx[lane], gy[lane], gz[lane]);
+            Scatter(gradient, J[lane], -gx[lane], -gy[lane], -gz[lane]);
+        }
+    }
+    return sum;
+}
+
+template <typename V>
+inline double UFFAngleBlock(const AngleSoA& terms, int base, const double* geometry, double* gradient, double factor, bool calc_gradient)
+{
+    using L = Lane<V>;
+    constexpr int W = L::width;
+    const int* I = terms.i.data() + base;
+    const int* J = terms.j.data() + base;
+    const int* K = terms.k.data() + base;
+
+    Vec3<V> j = Gather3<V>(geometry, J);
+    Vec3<V> rij = Gather3<V>(geometry, I) - j;
+    Vec3<V> rkj = Gather3<V>(geometry, K) - j;
+    V dij = L::sqrt(Dot(rij, rij));
+    V dkj = L::sqrt(Dot(rkj, rkj));
+    V costheta = Dot(rij, rkj) / (dij * dkj);
+
+    V fc = L::load(terms.fc.data() + base);
+    V C1 = L::load(terms.C1.data() + base);
+    V C2 = L::load(terms.C2.data() + base);
+    V f = L::set(factor);
+
+    double energy[W];
+    L::store(energy, fc * (L::load(terms.C0.data() + base) + C1 * costheta + C2 * (L::set(2) * costheta * costheta - L::set(1))) * f);
+    double sum = 0;
+    for (int lane = 0; lane < W; ++lane)
+        sum += energy[lane];
+
+    if (calc_gradient) {
+        /* dE/dcos(theta) times dcos(theta)/dx, the sin(theta) of the angle formulation cancels */
+        V dEdcos = fc * (C1 + L::set(4) * C2 * costheta) * f;
+        Vec3<V> nij = rij * (L::set(1) / dij);
+        Vec3<V> nkj = rkj * (L::set(1) / dkj);
+        Vec3<V> gi = (nkj - nij * costheta) * (dEdcos / dij);
+        Vec3<V> gk = (nij - nkj * costheta) * (dEdcos / dkj);
+        double ix[W], iy[W], iz[W], kx[W], ky[W], kz[W];
+        Store3(ix, iy, iz, gi);
+        Store3(kx, ky, kz, gk);
+        for (int lane = 0; lane < W; ++lane) {
+            Scatter(gradient, I[lane], ix[lane], iy[lane], iz[lane]);
+            Scatter(gradient, K[lane], kx[lane], ky[lane], kz[lane]);
+            Scatter(gradient, J[lane], -ix[lane] - kx[lane], -iy[lane] - ky[lane], -iz[lane] - kz[lane]);
+        }
+    }
+    return sum;
+}
+
+template <typename V>
+inline double UFFDihedralBlock(const DihedralSoA& terms, int base, const double* geometry, double* gradient, double factor, bool calc_gradient)
+{
+    using L = Lane<V>;
+    constexpr int W = L::width;
+    const int* I = terms.i.data() + base;
+    const int* J = terms.j.data() + base;
+    const int* K = terms.k.data() + base;
+    const int* Ll = terms.l.data() + base;
+
+    Vec3<V> i = Gather3<V>(geometry, I);
+    Vec3<V> j = Gather3<V>(geometry, J);
+    Vec3<V> k = Gather3<V>(geometry, K);
+    Vec3<V> l = Gather3<V>(geometry, Ll);
+
+    Vec3<V> nijk = Cross(j - i, j - k);
+    Vec3<V> njkl = Cross(k - j, k - l);
+    V n_ijk2 = Dot(nijk, nijk);
+    V n_jkl2 = Dot(njkl, njkl);
+    V cosacos = Dot(nijk, njkl) / L::sqrt(n_ijk2 * n_jkl2);
+    V sign = L::less(Dot(i - j, njkl), L::set(0), L::set(-1), L::set(1));
+
+    /* phi = pi + sign * acos(x) */
+    V cosphi = L::set(0) - cosacos;
+    V sinphi = L::set(0) - sign * L::sqrt(L::set(1) - cosacos * cosacos);
+
+    V n = L::load(terms.n.data() + base);
+    V cosn = L::set(1), sinn = L::set(0);
+    V cosm = L::set(1), sinm = L::set(0);
+    for (int m = 1; m <= terms.max_n; ++m) {
+        V c = cosm * cosphi - sinm * sinphi;
+        sinm = sinm * cosphi + cosm * sinphi;
+        cosm = c;
+        cosn = L::equal(n, L::set(m), cosm, cosn);
+        sinn = L::equal(n, L::set(m), sinm, sinn);
+    }
+
+    V barrier = L::load(terms.V.data() + base);
+    V cos_nphi0 = L::load(terms.cos_nphi0.data() + base);
+    V f = L::set(factor);
+
+    double energy[W];
+    L::store(energy, L::set(0.5) * barrier * (L::set(1) - cos_nphi0 * cosn) * f);
+
+    double gi[3][W], gj[3][W], gk[3][W], gl[3][W];
+    if (calc_gradient) {
+        Vec3<V> kj = k - j;
+        Vec3<V> kl = k - l;
+        V kj2 = Dot(kj, kj);
+        V dkj = L::sqrt(kj2);
+        V dEdphi = L::set(0.5) * barrier * n * cos_nphi0 * sinn * f;
+
+        Vec3<V> dEdi = nijk * (dEdphi * dkj / n_ijk2);
+        Vec3<V> dEdl = njkl * (L::set(0) - dEdphi * dkj / n_jkl2);
+        Vec3<V> dEdj = dEdi * (Dot(i - j, kj) / kj2 - L::set(1)) - dEdl * (Dot(kl, kj) / kj2);
+        Vec3<V> dEdk = (dEdi + dEdj + dEdl) * L::set(-1);
+        Store3(gi[0], gi[1], gi[2], dEdi);
+        Store3(gj[0], gj[1], gj[2], dEdj);
+        Store3(gk[0], gk[1], gk[2], dEdk);
+        Store3(gl[0], gl[1], gl[2], dEdl);
+    }
+
+    double sum = 0;
+    for (int lane = 0; lane < W; ++lane) {
+        if (std::isnan(energy[lane]))
+            continue;
+        sum += energy[lane];
+        if (!calc_gradient)
+            continue;
+        double check = 0;
+        for (int x = 0; x < 3; ++x)
+            check += gi[x][lane] + gj[x][lane] + gk[x][lane] + gl[x][lane];
+        if (std::isnan(check))
+            continue;
+        Scatter(gradient, I[lane], gi[0][lane], gi[1][lane], gi[2][lane]);
+        Scatter(gradient, J[lane], gj[0][lane], gj[1][lane], gj[2][lane]);
+        Scatter(gradient, K[lane], gk[0][lane], gk[1][lane], gk[2][lane]);
+        Scatter(gradient, Ll[lane], gl[0][lane], gl[1][lane], gl[2][lane]);
+    }
+    return sum;
+}
+
+template <typename V>
+inline double UFFInversionBlock(const InversionSoA& terms, int base, const double* geometry, double* gradient, double factor, bool calc_gradient)
+{
+    using L = Lane<V>;
+    constexpr int W = L::width;
+    const int* I = terms.i.data() + base;
+    const int* J = terms.j.data() + base;
+    const int* K = terms.k.data() + base;
+    const int* Ll = terms.l.data() + base;
+
+    Vec3<V> i = Gather3<V>(geometry, I);
+    Vec3<V> j = Gather3<V>(geometry, J);
+    Vec3<V> k = Gather3<V>(geometry, K);
+    Vec3<V> l = Gather3<V>(geometry, Ll);
+
+    V fc = L::load(terms.fc.data() + base);
+    V C1 = L::load(terms.C1.data() + base);
+    V C2 = L::load(terms.C2.data() + base);
+    V f = L::set(factor);
+
+    Vec3<V> ail = i - l;
+    Vec3<V> nijk = Cross(j - i, j - k);
+    V cosY = Dot(nijk, ail) / L::sqrt(Dot(nijk, nijk) * Dot(ail, ail));
+    V sinY = L::sqrt(L::max(L::set(1) - cosY * cosY, L::set(0)));
+    V cos2Y = sinY * sinY - L::set(1);
+
+    double energy[W];
+    L::store(energy, fc * (L::load(terms.C0.data() + base) + C1 * sinY + C2 * cos2Y) * f);
+
+    double gi[3][W], gj[3][W], gk[3][W], gl[3][W], norms[3][W];
+    if (calc_gradient) {
+        Vec3<V> ji = j - i;
+        Vec3<V> jk = k - i;
+        Vec3<V> jl = l - i;
+        V dji = L::sqrt(Dot(ji, ji));
+        V djk = L::sqrt(Dot(jk, jk));
+        V djl = L::sqrt(Dot(jl, jl));
+        L::store(norms[0], dji);
+        L::store(norms[1], djk);
+        L::store(norms[2], djl);
+        ji = ji * (L::set(1) / dji);
+        jk = jk * (L::set(1) / djk);
+        jl = jl * (L::set(1) / djl);
+
+        Vec3<V> n = Cross(ji, jk);
+        n = n * (L::set(1) / L::sqrt(Dot(n, n)));
+        V cosYg = Dot(n, jl);
+        V sinYg = L::sqrt(L::max(L::set(1) - cosYg * cosYg, L::set(0)));
+        V cosTheta = Dot(ji, jk);
+        V sinTheta = L::max(L::sqrt(L::max(L::set(1) - cosTheta * cosTheta, L::set(1e-8))), L::set(1e-8));
+
+        V dEdY = L::set(0) - fc * (C1 * cosYg - L::set(4) * C2 * cosYg * sinYg) * f;
+
+        Vec3<V> p1 = Cross(ji, jk);
+        Vec3<V> p2 = Cross(jk, jl);
+        Vec3<V> p3 = Cross(jl, ji);
+        V sin_dl = Dot(p1, jl) / sinTheta;
+
+        Vec3<V> dYdl = (p1 * (L::set(1) / sinTheta) - jl * sin_dl) * (L::set(1) / djl);
+        Vec3<V> dYdi = (p2 + (jk * cosTheta - ji) * (sin_dl / sinTheta)) * (L::set(1) / (dji * sinTheta));
+        Vec3<V> dYdk = (p3 + (ji * cosTheta - jk) * (sin_dl / sinTheta)) * (L::set(1) / (djk * sinTheta));
+        Vec3<V> dYdj = (dYdi + dYdk + dYdl) * L::set(-1);
+
+        /* the central atom i gets dYdj, the outer atoms j, k, l get dYdi, dYdk and dYdl */
+        Store3(gi[0], gi[1], gi[2], dYdj * dEdY);
+        Store3(gj[0], gj[1], gj[2], dYdi * dEdY);
+        Store3(gk[0], gk[1], gk[2], dYdk * dEdY);
+        Store3(gl[0], gl[1], gl[2], dYdl * dEdY);
+    }
+
+    double sum = 0;
+    for (int lane = 0; lane < W; ++lane) {
+        if (std::isnan(energy[lane]))
+            continue;
+        sum += energy[lane];
+        if (!calc_gradient)
+            continue;
+        if (norms[0][lane] < 1e-5 || norms[1][lane] < 1e-5 || norms[2][lane] < 1e-5)
+            continue;
+        Scatter(gradient, I[lane], gi[0][lane], gi[1][lane], gi[2][lane]);
+        Scatter(gradient, J[lane], gj[0][lane], gj[1][lane], gj[2][lane]);
+        Scatter(gradient, K[lane], gk[0][lane], gk[1][lane], gk[2][lane]);
+        Scatter(gradient, Ll[lane], gl[0][lane], gl[1][lane], gl[2][lane]);
+    }
+    return sum;
+}
+
+/* full blocks with lane type V, the remainder with the scalar lane */
+template <typename V, typename Terms, typename Block>
+inline double RunBlocks(const Terms& terms, Block block)
+{
+    constexpr int W = Lane<V>::width;
+    double energy = 0;
+    int base = 0;
+    for (; base + W <= terms.size(); base += W)
+        energy += block(base, V());
+    for (; base < terms.size(); ++base)
+        energy += block(base, double());
+    return energy;
+}
+
+template <typename V>
+inline double UFFBondsT(const BondSoA& terms, const double* geometry, double* gradient, double factor, bool calc_gradient)
+{
+    return RunBlocks<V>(terms, [&](int base, auto lane) { return UFFBondBlock<decltype(lane)>(terms, base, geometry, gradient, factor, calc_gradient); });
+}
+
+template <typename V>
+inline double UFFAnglesT(const AngleSoA& terms, const double* geometry, double* gradient, double factor, bool calc_gradient)
+{
+    return RunBlocks<V>(terms, [&](int base, auto lane) { return UFFAngleBlock<decltype(lane)>(terms, base, geometry, gradient, factor, calc_gradient); });
+}
+
+template <typename V>
+inline double UFFDihedralsT(const DihedralSoA& terms, const double* geometry, double* gradient, double factor, bool calc_gradient)
+{
+    return RunBlocks<V>(terms, [&](int base, auto lane) { return UFFDihedralBlock<decltype(lane)>(terms, base, geometry, gradient, factor, calc_gradient); });
+}
+
+template <typename V>
+inline double UFFInversionsT(const InversionSoA& terms, const double* geometry, double* gradient, double factor, bool calc_gradient)
+{
+    return RunBlocks<V>(terms, [&](int base, auto lane) { return UFFInversionBlock<decltype(lane)>(terms, base, geometry, gradient, factor, calc_gradient); });
+}
+}
+}
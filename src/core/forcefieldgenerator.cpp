@@ -135,6 +135,7 @@ void ForceFieldGenerator::Generate(const std::vector<std::pair<int, int>>& forme
     m_uff_dihedral_force = m_parameter["torsion_force"];
     m_uff_inversion_force = m_parameter["inversion_force"];
     m_vdw_force = m_parameter["vdw_force"];
+    m_vdw_cutoff = m_parameter["vdw_cutoff"];
 
     setBonds(bonds);
 
@@ -147,6 +148,32 @@ void ForceFieldGenerator::Generate(const std::vector<std::pair<int, int>>& forme
     setNCI();
 }
 
+std::string ForceFieldGenerator::TopologyKey(const Mol& mol)
+{
+    const double scaling = 1.4;
+    std::string key;
+    auto append = [&key](const auto& value) {
+        key.append(reinterpret_cast<const char*>(&value), sizeof(value));
+    };
+    append(mol.m_charge);
+    append(mol.m_number_atoms);
+    for (int element : mol.m_atoms)
+        append(element);
+    for (double charge : mol.m_partial_charges)
+        append(charge);
+
+    /* all pairs within the bond criterion, the bonds picked by Generate follow from these */
+    for (int i = 0; i < mol.m_number_atoms; ++i) {
+        for (int j = i + 1; j < mol.m_number_atoms; ++j) {
+            const double r_ij = (mol.m_geometry.row(i) - mol.m_geometry.row(j)).norm();
+            if (r_ij <= (Elements::CovalentRadius[mol.m_atoms[i]] + Elements::CovalentRadius[mol.m_atoms[j]]) * scaling)
+                append(j);
+        }
+        append(-1);
+    }
+    return key;
+}
+
 double ForceFieldGenerator::UFFBondRestLength(int i, int j, double n)
 {
     double cRi = UFFParameters[m_atom_types[i]][cR];
@@ -468,20 +495,25 @@ void ForceFieldGenerator::setNCI()
 {
     // std::vector<double> charges = m_mol.m_partial_charges // m_molecule.getPartialCharges();
     double q_thresh = 1e-5;
+    /* with a cutoff, the pairs are found on the fly by the force field from vdw_atoms and vdw_exclusions */
+    if (m_vdw_cutoff > 0 && m_mol.m_partial_charges.size() < m_atom_types.size())
+        return;
     for (int i = 0; i < m_atom_types.size(); ++i) {
         for (int j = i + 1; j < m_atom_types.size(); ++j) {
             if (std::find(m_ignored_vdw[i].begin(), m_ignored_vdw[i].end(), j) != m_ignored_vdw[i].end() || std::find(m_ignored_vdw[j].begin(), m_ignored_vdw[j].end(), i) != m_ignored_vdw[j].end())
                 continue;
-            json vdW = vdWJson;
-            double cDi = UFFParameters[m_atom_types[i]][cD];
-            double cDj = UFFParameters[m_atom_types[j]][cD];
-            double cxi = UFFParameters[m_atom_types[i]][cx];
-            double cxj = UFFParameters[m_atom_types[j]][cx];
-            vdW["C_ij"] = sqrt(cDi * cDj) * m_vdw_force;
-            vdW["i"] = i;
-            vdW["j"] = j;
-            vdW["r0_ij"] = sqrt(cxi * cxj);
-            m_vdws.push_back(vdW);
+            if (m_vdw_cutoff <= 0) {
+                json vdW = vdWJson;
+                double cDi = UFFParameters[m_atom_types[i]][cD];
+                double cDj = UFFParameters[m_atom_types[j]][cD];
+                double cxi = UFFParameters[m_atom_types[i]][cx];
+                double cxj = UFFParameters[m_atom_types[j]][cx];
+                vdW["C_ij"] = sqrt(cDi * cDj) * m_vdw_force;
+                vdW["i"] = i;
+                vdW["j"] = j;
+                vdW["r0_ij"] = sqrt(cxi * cxj);
+                m_vdws.push_back(vdW);
+            }
 
             if (m_mol.m_partial_charges.size() <= i || m_mol.m_partial_charges.size() <= j)
                 continue;
@@ -727,6 +759,10 @@ json ForceFieldGenerator::getParameter()
     parameters["dihedrals"] = Dihedrals();
     parameters["inversions"] = Inversions();
     parameters["vdws"] = vdWs();
+    if (m_vdw_cutoff > 0) {
+        parameters["vdw_atoms"] = vdWAtoms();
+        parameters["vdw_exclusions"] = vdWExclusions();
+    }
     parameters["esps"] = ESPs();
 
     return parameters;
@@ -801,6 +837,35 @@ json ForceFieldGenerator::vdWs() const
     return vdws;
 }
 
+json ForceFieldGenerator::vdWAtoms() const
+{
+    /* C_ij and r0_ij are geometric means, so storing the square roots per atom is enough */
+    json atoms;
+    for (int i = 0; i < m_atom_types.size(); ++i) {
+        atoms[i] = { sqrt(UFFParameters[m_atom_types[i]][cD] * m_vdw_force), sqrt(UFFParameters[m_atom_types[i]][cx]) };
+    }
+    return atoms;
+}
+
+json ForceFieldGenerator::vdWExclusions() const
+{
+    std::vector<std::vector<int>> exclusions(m_atom_types.size());
+    for (int i = 0; i < m_ignored_vdw.size(); ++i) {
+        for (int j : m_ignored_vdw[i]) {
+            if (i < j)
+                exclusions[i].push_back(j);
+            else if (j < i)
+                exclusions[j].push_back(i);
+        }
+    }
+    for (auto& list : exclusions) {
+        std::sort(list.begin(), list.end());
+        list.erase(std::unique(list.begin(), list.end()), list.end());
+    }
+    json result = exclusions;
+    return result;
+}
+
 json ForceFieldGenerator::ESPs() const
 {
     json esps;
@@ -137,6 +137,9 @@ const json FFGenerator{
     { "vdw_force", 1 / 627.503 },
     { "h4_scaling", 0 },
     { "hh_scaling", 0 },
+    { "vdw_cutoff", 0 },
+    { "vdw_skin", 2.0 },
+    { "vdw_switch", 1.0 },
     { "e0", 0 }
 };
 
@@ -148,6 +151,11 @@ public:
     void Generate(const std::vector<std::pair<int, int>>& formed_bonds = std::vector<std::pair<int, int>>());
     json getParameter();
 
+    /*! \brief Everything the generated parameters depend on besides the controller:
+     * charge, elements, partial charges and the bond graph (same criterion as Generate).
+     * Only valid for methods whose parameters do not take reference distances from the geometry. */
+    static std::string TopologyKey(const Mol& mol);
+
 private:
     double UFFBondRestLength(int i, int j, double order);
     void AssignUffAtomTypes();
@@ -164,6 +172,8 @@ private:
     json Dihedrals() const;
     json Inversions() const;
     json vdWs() const;
+    json vdWAtoms() const;
+    json vdWExclusions() const;
     json ESPs() const;
 
     json writeUFF();
@@ -184,7 +194,7 @@ private:
     std::vector<json> m_bonds, m_angles, m_dihedrals, m_inversions, m_vdws, m_esps;
     double m_uff_bond_force = 1.0584 /* in Eh kcal/mol = 664.12 */, m_uff_angle_force = 1.0584 /* in Eh kcal/mol = 664.12 */, m_uff_dihedral_force = 1, m_uff_inversion_force = 1, m_vdw_force = 1, m_scaling = 1.4;
 
-    double m_au = 1;
+    double m_au = 1, m_vdw_cutoff = 0;
 
     int m_ff_type = 1;
     std::string m_method = "uff";
@@ -0,0 +1,272 @@
+/*
+ * < Term by term second derivatives of the generic force field. >
+ * Copyright (C) 2025 Conrad Hübler <Conrad.Huebler@gmx.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "src/core/forcefieldderivaties.h"
+
+#include "forcefield.h"
+#include "forcefieldthread.h"
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include <Eigen/Sparse>
+
+typedef Eigen::Triplet<double> HessianEntry;
+
+inline void AddBlock(std::vector<HessianEntry>& entries, int a, int b, const Eigen::Matrix3d& block)
+{
+    for (int x = 0; x < 3; ++x)
+        for (int y = 0; y < 3; ++y)
+            if (block(x, y) != 0)
+                entries.emplace_back(3 * a + x, 3 * b + y, block(x, y));
+}
+
+/* E(r) with r = |r_i - r_j|: d2E/dr_i dr_i = E'' u u^T + E' / r (1 - u u^T) */
+inline void AddPair(std::vector<HessianEntry>& entries, int i, int j, const Eigen::Vector3d& rij, double dEdr, double d2Edr2)
+{
+    const double r = rij.norm();
+    const Eigen::Vector3d u = rij / r;
+    const Eigen::Matrix3d uu = u * u.transpose();
+    const Eigen::Matrix3d block = d2Edr2 * uu + dEdr / r * (Eigen::Matrix3d::Identity() - uu);
+    AddBlock(entries, i, i, block);
+    AddBlock(entries, j, j, block);
+    AddBlock(entries, i, j, -block);
+    AddBlock(entries, j, i, -block);
+}
+
+/* E = fc (C0 + C1 cos + C2 cos(2 theta)), written in the bond vectors a = r_i - r_j and b = r_k - r_j */
+inline void AddUFFAngle(std::vector<HessianEntry>& entries, const Angle& angle, const Matrix& geometry)
+{
+    const Eigen::Vector3d a = geometry.row(angle.i) - geometry.row(angle.j);
+    const Eigen::Vector3d b = geometry.row(angle.k) - geometry.row(angle.j);
+    const double da = a.norm(), db = b.norm();
+    const Eigen::Vector3d na = a / da, nb = b / db;
+    const double costheta = na.dot(nb);
+    const double dEdcos = angle.fc * (angle.C1 + 4 * angle.C2 * costheta);
+    const double d2Edcos2 = 4 * angle.fc * angle.C2;
+
+    const Eigen::Matrix3d I = Eigen::Matrix3d::Identity();
+    const Eigen::Vector3d ga = (nb - costheta * na) / da;
+    const Eigen::Vector3d gb = (na - costheta * nb) / db;
+    const Eigen::Matrix3d haa = d2Edcos2 * ga * ga.transpose() - dEdcos * ((na * ga.transpose() + ga * na.transpose()) / da + costheta * (I - na * na.transpose()) / (da * da));
+    const Eigen::Matrix3d hbb = d2Edcos2 * gb * gb.transpose() - dEdcos * ((nb * gb.transpose() + gb * nb.transpose()) / db + costheta * (I - nb * nb.transpose()) / (db * db));
+    const Eigen::Matrix3d hab = d2Edcos2 * ga * gb.transpose() + dEdcos * ((I - nb * nb.transpose()) / db - na * gb.transpose()) / da;
+
+    AddBlock(entries, angle.i, angle.i, haa);
+    AddBlock(entries, angle.k, angle.k, hbb);
+    AddBlock(entries, angle.i, angle.k, hab);
+    AddBlock(entries, angle.k, angle.i, hab.transpose());
+    AddBlock(entries, angle.i, angle.j, -(haa + hab));
+    AddBlock(entries, angle.j, angle.i, -(haa + hab).transpose());
+    AddBlock(entries, angle.k, angle.j, -(hab.transpose() + hbb));
+    AddBlock(entries, angle.j, angle.k, -(hab.transpose() + hbb).transpose());
+    AddBlock(entries, angle.j, angle.j, haa + hab + hab.transpose() + hbb);
+}
+
+/* Central differences of the analytic gradient of a single term, evaluated by the scratch thread
+ * on a copy of the atoms of the term. The term has to be added with local indices 0 ... n - 1. */
+template <typename Term>
+inline void AddLocal(std::vector<HessianEntry>& entries, ForceFieldThread& scratch, const std::vector<int>& atoms, const Matrix& geometry, Term term, double step)
+{
+    const int size = 3 * atoms.size();
+    Matrix local(atoms.size(), 3);
+    for (int a = 0; a < atoms.size(); ++a)
+        local.row(a) = geometry.row(atoms[a]);
+
+    scratch.clearTerms();
+    term(scratch);
+
+    Eigen::MatrixXd hessian(size, size);
+    for (int column = 0; column < size; ++column) {
+        double& coordinate = local(column / 3, column % 3);
+        const double origin = coordinate;
+        coordinate = origin + step;
+        scratch.UpdateGeometry(local, true);
+        scratch.execute();
+        const Matrix plus = scratch.Gradient();
+        coordinate = origin - step;
+        scratch.execute();
+        const Matrix& minus = scratch.Gradient();
+        coordinate = origin;
+        for (int row = 0; row < size; ++row)
+            hessian(row, column) = (plus(row / 3, row % 3) - minus(row / 3, row % 3)) / (2 * step);
+    }
+
+    for (int a = 0; a < atoms.size(); ++a)
+        for (int b = 0; b < atoms.size(); ++b)
+            AddBlock(entries, atoms[a], atoms[b], 0.5 * (hessian.block<3, 3>(3 * a, 3 * b) + hessian.block<3, 3>(3 * b, 3 * a).transpose()));
+}
+
+Eigen::SparseMatrix<double> ForceField::AnalyticHessian()
+{
+    const double step = 1e-5;
+    const bool qmdff = std::find(m_qmdff_methods.begin(), m_qmdff_methods.end(), m_method) != m_qmdff_methods.end();
+    std::vector<HessianEntry> entries;
+
+    /* all terms with more than two atoms that are not done analytically go through one scratch thread */
+    ForceFieldThread scratch(0, 1);
+    scratch.setSIMD(false);
+    scratch.setMethod(qmdff ? 2 : 1);
+
+    for (const auto& bond : m_bonds) {
+        const Eigen::Vector3d rij = m_geometry.row(bond.i) - m_geometry.row(bond.j);
+        const double r = rij.norm();
+        if (qmdff) {
+            /* same (historical) force constant as in ForceFieldThread::CalculateQMDFFBondContribution */
+            const double fc = bond.r0_ij;
+            const double a = bond.exponent;
+            const double ratio_a = pow(bond.r0_ij / r, a);
+            const double ratio_a2 = pow(bond.r0_ij / r, a * 0.5);
+            AddPair(entries, bond.i, bond.j, rij, -fc * a / r * (ratio_a - ratio_a2), fc * a / (r * r) * ((a + 1) * ratio_a - (a * 0.5 + 1) * ratio_a2));
+        } else
+            AddPair(entries, bond.i, bond.j, rij, bond.fc * (r - bond.r0_ij), bond.fc);
+    }
+
+    for (const auto& angle : m_angles) {
+        if (!qmdff) {
+            AddUFFAngle(entries, angle, m_geometry);
+            continue;
+        }
+        AddLocal(entries, scratch, { angle.i, angle.j, angle.k }, m_geometry, [&angle](ForceFieldThread& thread) {
+            Angle term = angle;
+            term.i = 0;
+            term.j = 1;
+            term.k = 2;
+            thread.addAngle(term);
+        },
+            step);
+    }
+
+    /* QMDFF dihedrals and inversions are not part of the energy (yet), see ForceFieldThread::execute */
+    for (const auto& dihedral : m_dihedrals) {
+        if (dihedral.type != 1)
+            continue;
+        AddLocal(entries, scratch, { dihedral.i, dihedral.j, dihedral.k, dihedral.l }, m_geometry, [&dihedral](ForceFieldThread& thread) {
+            Dihedral term = dihedral;
+            term.i = 0;
+            term.j = 1;
+            term.k = 2;
+            term.l = 3;
+            thread.addDihedral(term);
+        },
+            step);
+    }
+
+    for (const auto& inversion : m_inversions) {
+        if (inversion.type != 1)
+            continue;
+        AddLocal(entries, scratch, { inversion.i, inversion.j, inversion.k, inversion.l }, m_geometry, [&inversion](ForceFieldThread& thread) {
+            Inversion term = inversion;
+            term.i = 0;
+            term.j = 1;
+            term.k = 2;
+            term.l = 3;
+            thread.addInversion(term);
+        },
+            step);
+    }
+
+    for (const auto& vdw : m_vdWs) {
+        if (vdw.type != 1)
+            continue;
+        const Eigen::Vector3d rij = m_geometry.row(vdw.i) - m_geometry.row(vdw.j);
+        const double r = rij.norm();
+        const double pow6 = pow(vdw.r0_ij / r, 6);
+        AddPair(entries, vdw.i, vdw.j, rij, vdw.C_ij * 12 * (pow6 - pow6 * pow6) / (r * 100), vdw.C_ij * (156 * pow6 * pow6 - 84 * pow6) / (r * r * 100));
+    }
+
+    if (m_vdw_atoms.size()) {
+        /* E = S(r) V(r), the switching function is a polynomial in r^2 */
+        m_neighbourlist.Update(m_geometry);
+        const double rc2 = m_vdw_cutoff * m_vdw_cutoff;
+        const double r_on = std::max(m_vdw_cutoff - m_vdw_switch, 0.0);
+        const double ron2 = r_on * r_on;
+        const double denominator = (rc2 - ron2) > 0 ? 1 / ((rc2 - ron2) * (rc2 - ron2) * (rc2 - ron2)) : 0;
+        for (int index = 0; index < m_neighbourlist.Size(); ++index) {
+            const int i = m_neighbourlist.First(index);
+            const int j = m_neighbourlist.Second(index);
+            const Eigen::Vector3d rij = m_geometry.row(i) - m_geometry.row(j);
+            const double r2 = rij.squaredNorm();
+            if (r2 >= rc2)
+                continue;
+            const double r = sqrt(r2);
+            const double C_ij = m_vdw_atoms[i].C_i * m_vdw_atoms[j].C_i;
+            const double pow6 = pow(m_vdw_atoms[i].r0_i * m_vdw_atoms[j].r0_i / r, 6);
+            const double V = C_ij * (pow6 * pow6 - 2 * pow6) / 100;
+            const double dV = C_ij * 12 * (pow6 - pow6 * pow6) / (r * 100);
+            const double d2V = C_ij * (156 * pow6 * pow6 - 84 * pow6) / (r2 * 100);
+
+            double S = 1, dS = 0, d2S = 0;
+            if (r2 > ron2) {
+                S = (rc2 - r2) * (rc2 - r2) * (rc2 + 2 * r2 - 3 * ron2) * denominator;
+                const double dSdr2 = 6 * (rc2 - r2) * (ron2 - r2) * denominator;
+                const double d2Sdr22 = 6 * (2 * r2 - ron2 - rc2) * denominator;
+                dS = 2 * r * dSdr2;
+                d2S = 2 * dSdr2 + 4 * r2 * d2Sdr22;
+            }
+            AddPair(entries, i, j, rij, dS * V + S * dV, d2S * V + 2 * dS * dV + S * d2V);
+        }
+    }
+
+    for (const auto& eq : m_EQs) {
+        const Eigen::Vector3d rij = m_geometry.row(eq.i) - m_geometry.row(eq.j);
+        const double r = rij.norm();
+        const double qq = eq.epsilon * eq.q_i * eq.q_j;
+        AddPair(entries, eq.i, eq.j, rij, -qq / (r * r), 2 * qq / (r * r * r));
+    }
+
+    /* D3 and H4 are many body terms without a second derivative, they are differentiated from their gradient */
+    const int d3 = m_parameters.value("d3", 0);
+    const int h4 = m_parameters.value("h4", 0);
+    if (d3 || h4) {
+        ForceFieldThread correction(0, 1);
+        if (h4)
+            correction.setH4(m_parameters, m_atom_types);
+        if (d3)
+            correction.setD3(m_parameters, m_atom_types);
+        Matrix displaced = m_geometry;
+        correction.UpdateGeometry(displaced, true);
+        const int size = 3 * m_natoms;
+        Eigen::MatrixXd hessian(size, size);
+        for (int column = 0; column < size; ++column) {
+            double& coordinate = displaced(column / 3, column % 3);
+            const double origin = coordinate;
+            coordinate = origin + step;
+            correction.execute();
+            const Matrix plus = correction.Gradient();
+            coordinate = origin - step;
+            correction.execute();
+            const Matrix& minus = correction.Gradient();
+            coordinate = origin;
+            for (int row = 0; row < size; ++row)
+                hessian(row, column) = (plus(row / 3, row % 3) - minus(row / 3, row % 3)) / (2 * step);
+        }
+        for (int row = 0; row < size; ++row)
+            for (int column = 0; column < size; ++column) {
+                const double value = 0.5 * (hessian(row, column) + hessian(column, row));
+                if (value != 0)
+                    entries.emplace_back(row, column, value);
+            }
+    }
+
+    Eigen::SparseMatrix<double> hessian(3 * m_natoms, 3 * m_natoms);
+    hessian.setFromTriplets(entries.begin(), entries.end());
+    return hessian;
+}
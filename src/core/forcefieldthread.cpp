@@ -26,17 +26,51 @@
 #include "forcefield.h"
 
 ForceFieldThread::ForceFieldThread(int thread, int threads)
-    : m_thread(thread)
+    : m_geometry(nullptr, 0, 3)
+    , m_thread(thread)
     , m_threads(threads)
 {
     setAutoDelete(false);
+    m_pair_begin = thread / double(threads);
+    m_pair_end = (thread + 1) / double(threads);
     m_final_factor = 1; // / 2625.15 * 4.19;
     // m_d = parameters["differential"].get<double>();
     m_d = 1e-7;
 }
 
+ForceFieldThread::~ForceFieldThread()
+{
+#ifdef USE_D3
+    delete m_d3;
+#endif
+    delete m_h4correction;
+}
+
+void ForceFieldThread::clearTerms()
+{
+    m_uff_bonds.clear();
+    m_uff_angles.clear();
+    m_qmdff_dihedrals.clear();
+    m_qmdff_inversions.clear();
+    m_uff_vdWs.clear();
+    m_EQs.clear();
+    m_bond_soa = BondSoA();
+    m_angle_soa = AngleSoA();
+    m_dihedral_soa = DihedralSoA();
+    m_inversion_soa = InversionSoA();
+}
+
+void ForceFieldThread::ResetGradient()
+{
+    if (m_gradient.rows() != m_geometry.rows() || m_gradient.cols() != 3)
+        m_gradient.resize(m_geometry.rows(), 3);
+    if (m_calculate_gradient)
+        m_gradient.setZero();
+}
+
 int ForceFieldThread::execute()
 {
+    ResetGradient();
     m_angle_energy = 0.0;
     m_bond_energy = 0.0;
     m_vdw_energy = 0;
@@ -45,21 +79,30 @@ int ForceFieldThread::execute()
     m_dihedral_energy = 0;
     m_angle_energy = 0;
     m_bond_energy = 0.0;
+    m_d3_energy = 0;
+    m_h4_energy = 0;
+    m_hh_energy = 0;
 
     if (m_method == 1) {
-        CalculateUFFBondContribution();
-        CalculateUFFAngleContribution();
+        Timed(FFBondTerm, [this]() { CalculateUFFBondContribution(); });
+        Timed(FFAngleTerm, [this]() { CalculateUFFAngleContribution(); });
 
     } else if (m_method == 2) {
-        CalculateQMDFFBondContribution();
+        Timed(FFBondTerm, [this]() { CalculateQMDFFBondContribution(); });
         // CalculateUFFBondContribution();
-        CalculateQMDFFAngleContribution();
+        Timed(FFAngleTerm, [this]() { CalculateQMDFFAngleContribution(); });
     }
 
-    CalculateUFFDihedralContribution();
-    CalculateUFFInversionContribution();
-    CalculateUFFvdWContribution();
-    CalculateESPContribution();
+    Timed(FFDihedralTerm, [this]() { CalculateUFFDihedralContribution(); });
+    Timed(FFInversionTerm, [this]() { CalculateUFFInversionContribution(); });
+    Timed(FFvdWTerm, [this]() { CalculateUFFvdWContribution(); });
+    if (m_neighbourlist)
+        Timed(FFvdWTerm, [this]() { CalculateUFFvdWCutoffContribution(); });
+    Timed(FFEQTerm, [this]() { CalculateESPContribution(); });
+    if (m_h4correction)
+        Timed(FFH4Term, [this]() { CalculateH4Contribution(); });
+    if (m_has_d3)
+        Timed(FFD3Term, [this]() { CalculateD3Contribution(); });
     /*
     CalculateQMDFFDihedralContribution();
     */
@@ -70,6 +113,7 @@ void ForceFieldThread::addBond(const Bond& bonds)
 {
     // if (bonds.type == 1)
     m_uff_bonds.push_back(bonds);
+    m_bond_soa.add(bonds.i, bonds.j, bonds.fc, bonds.r0_ij);
     // else if (bonds.type == 2)
     //     m_qmdff_bonds.push_back(bonds);
 }
@@ -78,6 +122,7 @@ void ForceFieldThread::addAngle(const Angle& angles)
 {
     // if (angles.type == 1)
     m_uff_angles.push_back(angles);
+    m_angle_soa.add(angles.i, angles.j, angles.k, angles.fc, angles.C0, angles.C1, angles.C2);
     // else if (angles.type == 2)
     //     m_qmdff_angles.push_back(angles);
 }
@@ -85,7 +130,7 @@ void ForceFieldThread::addAngle(const Angle& angles)
 void ForceFieldThread::addDihedral(const Dihedral& dihedrals)
 {
     if (dihedrals.type == 1)
-        m_uff_dihedrals.push_back(dihedrals);
+        m_dihedral_soa.add(dihedrals.i, dihedrals.j, dihedrals.k, dihedrals.l, dihedrals.V, dihedrals.n, dihedrals.phi0);
     else if (dihedrals.type == 2)
         m_qmdff_dihedrals.push_back(dihedrals);
 }
@@ -93,7 +138,7 @@ void ForceFieldThread::addDihedral(const Dihedral& dihedrals)
 void ForceFieldThread::addInversion(const Inversion& inversions)
 {
     if (inversions.type == 1)
-        m_uff_inversions.push_back(inversions);
+        m_inversion_soa.add(inversions.i, inversions.j, inversions.k, inversions.l, inversions.fc, inversions.C0, inversions.C1, inversions.C2);
     else if (inversions.type == 2)
         m_qmdff_inversions.push_back(inversions);
 }
@@ -112,188 +157,22 @@ void ForceFieldThread::addEQ(const EQ& EQs)
 
 void ForceFieldThread::CalculateUFFBondContribution()
 {
-    double factor = m_final_factor * m_bond_scaling;
-
-    for (int index = 0; index < m_uff_bonds.size(); ++index) {
-        const auto& bond = m_uff_bonds[index];
-
-        Vector i = m_geometry.row(bond.i);
-        Vector j = m_geometry.row(bond.j);
-        Matrix derivate;
-        double rij = UFF::BondStretching(i, j, derivate, m_calculate_gradient);
-
-        m_bond_energy += (0.5 * bond.fc * (rij - bond.r0_ij) * (rij - bond.r0_ij)) * factor;
-        if (m_calculate_gradient) {
-            double diff = (bond.fc) * (rij - bond.r0_ij) * factor;
-            m_gradient.row(bond.i) += diff * derivate.row(0);
-            m_gradient.row(bond.j) += diff * derivate.row(1);
-        }
-    }
+    m_bond_energy += BondedKernels::UFFBonds(m_bond_soa, m_geometry.data(), m_gradient.data(), m_final_factor * m_bond_scaling, m_calculate_gradient, m_simd);
 }
 
 void ForceFieldThread::CalculateUFFAngleContribution()
 {
-    for (int index = 0; index < m_uff_angles.size(); ++index) {
-        const auto& angle = m_uff_angles[index];
-        auto i = m_geometry.row(angle.i);
-        auto j = m_geometry.row(angle.j);
-        auto k = m_geometry.row(angle.k);
-        Matrix derivate;
-        double costheta = UFF::AngleBending(i, j, k, derivate, m_calculate_gradient);
-        m_angle_energy += (angle.fc * (angle.C0 + angle.C1 * costheta + angle.C2 * (2 * costheta * costheta - 1))) * m_final_factor * m_angle_scaling;
-        if (m_calculate_gradient) {
-            double sintheta = sin(acos(costheta));
-            double dEdtheta = -angle.fc * sintheta * (angle.C1 + 4 * angle.C2 * costheta) * m_final_factor * m_angle_scaling;
-            m_gradient.row(angle.i) += dEdtheta * derivate.row(0);
-            m_gradient.row(angle.j) += dEdtheta * derivate.row(1);
-            m_gradient.row(angle.k) += dEdtheta * derivate.row(2);
-        }
-    }
+    m_angle_energy += BondedKernels::UFFAngles(m_angle_soa, m_geometry.data(), m_gradient.data(), m_final_factor * m_angle_scaling, m_calculate_gradient, m_simd);
 }
 
 void ForceFieldThread::CalculateUFFDihedralContribution()
 {
-    for (int index = 0; index < m_uff_dihedrals.size(); ++index) {
-        const auto& dihedral = m_uff_dihedrals[index];
-        Eigen::Vector3d i = m_geometry.row(dihedral.i);
-        Eigen::Vector3d j = m_geometry.row(dihedral.j);
-        Eigen::Vector3d k = m_geometry.row(dihedral.k);
-        Eigen::Vector3d l = m_geometry.row(dihedral.l);
-        Eigen::Vector3d nijk = UFF::NormalVector(i, j, k);
-        Eigen::Vector3d njkl = UFF::NormalVector(j, k, l);
-        double n_ijk = (nijk).norm();
-        double n_jkl = (njkl).norm();
-        double dotpr = nijk.dot(njkl);
-        Eigen::Vector3d ji = j - i;
-
-        double sign = (-1 * ji).dot(njkl) < 0 ? -1 : 1;
-        double phi = pi + sign * acos(dotpr / (n_ijk * n_jkl));
-        double sinphi = sin(phi);
-        double tmp_energy = (1 / 2.0 * dihedral.V * (1 - cos(dihedral.n * dihedral.phi0) * cos(dihedral.n * phi))) * m_final_factor * m_dihedral_scaling;
-        if (isnan(tmp_energy))
-            continue;
-
-        m_dihedral_energy += tmp_energy;
-        if (m_calculate_gradient) {
-
-            Eigen::Vector3d kj = k - j;
-            Eigen::Vector3d kl = k - l;
-            double tmp = 0;
-            double dEdphi = (1 / 2.0 * dihedral.V * dihedral.n * (cos(dihedral.n * dihedral.phi0) * sin(dihedral.n * phi))) * m_final_factor * m_dihedral_scaling;
-            if (isnan(dEdphi))
-                continue;
-
-            Eigen::Vector3d dEdi = dEdphi * kj.norm() / (nijk.norm() * nijk.norm()) * nijk;
-            Eigen::Vector3d dEdl = -1 * dEdphi * kj.norm() / (njkl.norm() * njkl.norm()) * njkl;
-            Eigen::Vector3d dEdj = -1 * dEdi + ((-1 * ji).dot(kj) / (kj.norm() * kj.norm()) * dEdi) - (kl.dot(kj) / (kj.norm() * kj.norm()) * dEdl);
-            Eigen::Vector3d dEdk = -1 * (dEdi + dEdj + dEdl);
-
-            if (isnan(dEdi.sum()) || isnan(dEdj.sum()) || isnan(dEdk.sum()) || isnan(dEdl.sum()))
-                continue;
-            m_gradient(dihedral.i, 0) += dEdi(0);
-            m_gradient(dihedral.i, 1) += dEdi(1);
-            m_gradient(dihedral.i, 2) += dEdi(2);
-
-            m_gradient(dihedral.l, 0) += dEdl(0);
-            m_gradient(dihedral.l, 1) += dEdl(1);
-            m_gradient(dihedral.l, 2) += dEdl(2);
-
-            m_gradient(dihedral.j, 0) += dEdj(0);
-            m_gradient(dihedral.j, 1) += dEdj(1);
-            m_gradient(dihedral.j, 2) += dEdj(2);
-
-            m_gradient(dihedral.k, 0) += dEdk(0);
-            m_gradient(dihedral.k, 1) += dEdk(1);
-            m_gradient(dihedral.k, 2) += dEdk(2);
-        }
-    }
+    m_dihedral_energy += BondedKernels::UFFDihedrals(m_dihedral_soa, m_geometry.data(), m_gradient.data(), m_final_factor * m_dihedral_scaling, m_calculate_gradient, m_simd);
 }
 
 void ForceFieldThread::CalculateUFFInversionContribution()
 {
-
-    for (int index = 0; index < m_uff_inversions.size(); ++index) {
-        const auto& inversion = m_uff_inversions[index];
-
-        Eigen::Vector3d i = m_geometry.row(inversion.i);
-        Eigen::Vector3d j = m_geometry.row(inversion.j);
-        Eigen::Vector3d k = m_geometry.row(inversion.k);
-        Eigen::Vector3d l = m_geometry.row(inversion.l);
-
-        Eigen::Vector3d ail = SubVector(i, l);
-        Eigen::Vector3d nijk = UFF::NormalVector(i, j, k);
-
-        double cosY = (nijk.dot(ail) / ((nijk).norm() * (ail).norm()));
-
-        double sinYSq = 1.0 - cosY * cosY;
-        double sinY = ((sinYSq > 0.0) ? sqrt(sinYSq) : 0.0);
-        double cos2Y = sinY * sinY - 1.0;
-
-        double tmp_energy = (inversion.fc * (inversion.C0 + inversion.C1 * sinY + inversion.C2 * cos2Y)) * m_final_factor * m_inversion_scaling;
-        if (std::isnan(tmp_energy))
-            continue;
-        m_inversion_energy += tmp_energy;
-
-        // energy += Inversion(i, j, k, l, d_forceConstant, C0, C1, C2);
-        if (m_calculate_gradient) {
-            Eigen::Vector3d ji = (j - i);
-            Eigen::Vector3d jk = (k - i);
-            Eigen::Vector3d jl = (l - i);
-
-            if (ji.norm() < 1e-5 || jk.norm() < 1e-5 || jl.norm() < 1e-5)
-                continue;
-
-            double dji = ji.norm();
-            double djk = jk.norm();
-            double djl = jl.norm();
-            ji /= dji;
-            jk /= djk;
-            jl /= djl;
-
-            Eigen::Vector3d nijk = ji.cross(jk);
-            nijk /= nijk.norm();
-
-            double cosY = (nijk.dot(jl));
-            double sinYSq = 1.0 - cosY * cosY;
-            double sinY = ((sinYSq > 0.0) ? sqrt(sinYSq) : 0.0);
-            double cosTheta = (ji.dot(jk));
-            double sinThetaSq = std::max(1.0 - cosTheta * cosTheta, 1.0e-8);
-            double sinTheta = std::max(((sinThetaSq > 0.0) ? sqrt(sinThetaSq) : 0.0), 1.0e-8);
-
-            double dEdY = -1 * (inversion.fc * (inversion.C1 * cosY - 4 * inversion.C2 * cosY * sinY)) * m_final_factor * m_inversion_scaling;
-
-            Eigen::Vector3d p1 = ji.cross(jk);
-            Eigen::Vector3d p2 = jk.cross(jl);
-            Eigen::Vector3d p3 = jl.cross(ji);
-
-            const double sin_dl = p1.dot(jl) / sinTheta;
-
-            // the wilson angle:
-            const double dll = asin(sin_dl);
-            const double cos_dl = cos(dll);
-
-            Eigen::Vector3d dYdl = (p1 / sinTheta - (jl * sin_dl)) / djl;
-            Eigen::Vector3d dYdi = ((p2 + (((-ji + jk * cosTheta) * sin_dl) / sinTheta)) / dji) / sinTheta;
-            Eigen::Vector3d dYdk = ((p3 + (((-jk + ji * cosTheta) * sin_dl) / sinTheta)) / djk) / sinTheta;
-            Eigen::Vector3d dYdj = -1 * (dYdi + dYdk + dYdl);
-
-            m_gradient(inversion.i, 0) += dEdY * dYdj(0);
-            m_gradient(inversion.i, 1) += dEdY * dYdj(1);
-            m_gradient(inversion.i, 2) += dEdY * dYdj(2);
-
-            m_gradient(inversion.j, 0) += dEdY * dYdi(0);
-            m_gradient(inversion.j, 1) += dEdY * dYdi(1);
-            m_gradient(inversion.j, 2) += dEdY * dYdi(2);
-
-            m_gradient(inversion.k, 0) += dEdY * dYdk(0);
-            m_gradient(inversion.k, 1) += dEdY * dYdk(1);
-            m_gradient(inversion.k, 2) += dEdY * dYdk(2);
-
-            m_gradient(inversion.l, 0) += dEdY * dYdl(0);
-            m_gradient(inversion.l, 1) += dEdY * dYdl(1);
-            m_gradient(inversion.l, 2) += dEdY * dYdl(2);
-        }
-    }
+    m_inversion_energy += BondedKernels::UFFInversions(m_inversion_soa, m_geometry.data(), m_gradient.data(), m_final_factor * m_inversion_scaling, m_calculate_gradient, m_simd);
 }
 
 void ForceFieldThread::CalculateUFFvdWContribution()
@@ -320,13 +199,62 @@ void ForceFieldThread::CalculateUFFvdWContribution()
     }
 }
 
+void ForceFieldThread::CalculateUFFvdWCutoffContribution()
+{
+    /* pairs come from the shared neighbour list, each thread takes its own slice
+     * the switching function smoothly brings energy and gradient to zero between r_on and r_c */
+    const int pairs = m_neighbourlist->Size();
+    const int start = int(std::round(m_pair_begin * pairs));
+    const int end = int(std::round(m_pair_end * pairs));
+
+    const double rc2 = m_vdw_cutoff * m_vdw_cutoff;
+    const double r_on = std::max(m_vdw_cutoff - m_vdw_switch, 0.0);
+    const double ron2 = r_on * r_on;
+    const double denominator = (rc2 - ron2) > 0 ? 1 / ((rc2 - ron2) * (rc2 - ron2) * (rc2 - ron2)) : 0;
+    const double factor = m_final_factor / 100;
+    const auto& atoms = *m_vdw_atoms;
+
+    for (int index = start; index < end; ++index) {
+        const int i = m_neighbourlist->First(index);
+        const int j = m_neighbourlist->Second(index);
+        const double dx = m_geometry(i, 0) - m_geometry(j, 0);
+        const double dy = m_geometry(i, 1) - m_geometry(j, 1);
+        const double dz = m_geometry(i, 2) - m_geometry(j, 2);
+        const double r2 = dx * dx + dy * dy + dz * dz;
+        if (r2 >= rc2)
+            continue;
+
+        const double C_ij = atoms[i].C_i * atoms[j].C_i;
+        const double r0_ij = atoms[i].r0_i * atoms[j].r0_i;
+        const double ij = sqrt(r2) * m_au;
+        const double pow6 = pow((r0_ij / ij), 6);
+
+        const double vdw = C_ij * (-2 * pow6 * m_vdw_scaling) * factor;
+        const double rep = C_ij * (pow6 * pow6 * m_rep_scaling) * factor;
+
+        double switching = 1, dswitching = 0;
+        if (r2 > ron2) {
+            switching = (rc2 - r2) * (rc2 - r2) * (rc2 + 2 * r2 - 3 * ron2) * denominator;
+            dswitching = 12 * (rc2 - r2) * (ron2 - r2) * denominator; // dS/dr divided by r
+        }
+        m_vdw_energy += switching * vdw;
+        m_rep_energy += switching * rep;
+
+        if (m_calculate_gradient) {
+            const double diff = switching * 12 * C_ij * (pow6 * m_vdw_scaling - pow6 * pow6 * m_rep_scaling) / (ij * ij) * factor + (vdw + rep) * dswitching;
+            m_gradient(i, 0) += diff * dx;
+            m_gradient(i, 1) += diff * dy;
+            m_gradient(i, 2) += diff * dz;
+
+            m_gradient(j, 0) -= diff * dx;
+            m_gradient(j, 1) -= diff * dy;
+            m_gradient(j, 2) -= diff * dz;
+        }
+    }
+}
+
 void ForceFieldThread::CalculateQMDFFBondContribution()
 {
-    m_d = 1e-5;
-    double factor = m_final_factor * m_bond_scaling;
-    Eigen::Vector3d dx = { m_d, 0, 0 };
-    Eigen::Vector3d dy = { 0, m_d, 0 };
-    Eigen::Vector3d dz = { 0, 0, m_d };
     for (int index = 0; index < m_uff_bonds.size(); ++index) {
         const auto& bond = m_uff_bonds[index];
 
@@ -335,58 +263,16 @@ void ForceFieldThread::CalculateQMDFFBondContribution()
         Vector ij = i - j;
         double distance = (ij).norm();
 
-        // Matrix derivate;
         double fc = bond.r0_ij;
         const double ratio = bond.r0_ij / distance;
-        m_bond_energy += fc * (1 + pow(ratio, bond.exponent) - 2 * pow(ratio, bond.exponent * 0.5));
+        const double ratio_a = pow(ratio, bond.exponent);
+        const double ratio_a2 = pow(ratio, bond.exponent * 0.5);
+        m_bond_energy += fc * (1 + ratio_a - 2 * ratio_a2);
         if (m_calculate_gradient) {
-
-            double diff = 1 * fc * (-1 * bond.exponent * pow(ratio, bond.exponent - 1) + 2 * bond.exponent * 0.5 * pow(ratio, bond.exponent * 0.5 - 1));
-            /*
-                        Vector ijx = i+ dx - j;
-                        double distancex1 = (ijx).norm();
-                        double ratio = bond.r0_ij / distancex1;
-
-                        double dx_p = fc * (1 + pow(ratio, bond.exponent) - 2 * pow(ratio, bond.exponent * 0.5));
-                        ijx = i - dx - j;
-                        distancex1 = (ijx).norm();
-                        ratio = bond.r0_ij / distancex1;
-                        double dx_m = fc * (1 + pow(ratio, bond.exponent) - 2 * pow(ratio, bond.exponent * 0.5));
-
-
-                        Vector ijy = i+ dy - j;
-                        double distancey1 = (ijy).norm();
-                        ratio = bond.r0_ij / distancey1;
-
-                        double dy_p = fc * (1 + pow(ratio, bond.exponent) - 2 * pow(ratio, bond.exponent * 0.5));
-                        ijy = i - dy - j;
-                        distancey1 = (ijy).norm();
-                        ratio = bond.r0_ij / distancey1;
-                        double dy_m = fc * (1 + pow(ratio, bond.exponent) - 2 * pow(ratio, bond.exponent * 0.5));
-
-
-                        Vector ijz = i+ dz - j;
-                        double distancez1 = (ijz).norm();
-                        ratio = bond.r0_ij / distancez1;
-
-                        double dz_p = fc * (1 + pow(ratio, bond.exponent) - 2 * pow(ratio, bond.exponent * 0.5));
-                        ijz = i - dz - j;
-                        distancez1 = (ijz).norm();
-                        ratio = bond.r0_ij / distancez1;
-                        double dz_m = fc * (1 + pow(ratio, bond.exponent) - 2 * pow(ratio, bond.exponent * 0.5));
-            */
-            // std::cout << (dx_p - dx_m)/(2.0*m_d) << " " << (dy_p - dy_m)/(2.0*m_d) <<" "<< (dz_p - dz_m)/(2.0*m_d) << " :: " << (diff * ij / (distance)).transpose() << std::endl;
-            /*
-            m_gradient(bond.i, 0) += (dx_p - dx_m)/(2*m_d);
-            m_gradient(bond.i, 1) += (dy_p - dy_m)/(2*m_d);
-            m_gradient(bond.i, 2) += (dz_p - dz_m)/(2*m_d);
-
-            m_gradient(bond.j, 0) -= (dx_p - dx_m)/(2*m_d);
-            m_gradient(bond.j, 1) -= (dy_p - dy_m)/(2*m_d);
-            m_gradient(bond.j, 2) -= (dz_p - dz_m)/(2*m_d);
-            */
-            m_gradient.row(bond.i) += diff * ij / (distance);
-            m_gradient.row(bond.j) -= diff * ij / (distance);
+            /* dE/dr = dE/d(r0/r) * d(r0/r)/dr = -fc * a / r * ((r0/r)^a - (r0/r)^(a/2)) */
+            double dEdr = -fc * bond.exponent / distance * (ratio_a - ratio_a2);
+            m_gradient.row(bond.i) += dEdr * ij / distance;
+            m_gradient.row(bond.j) -= dEdr * ij / distance;
         }
     }
 }
@@ -401,38 +287,57 @@ double ForceFieldThread::HarmonicBondStretching()
 
 void ForceFieldThread::CalculateQMDFFAngleContribution()
 {
-    double threshold = 1e-2;
-    Eigen::Vector3d dx = { m_d, 0, 0 };
-    Eigen::Vector3d dy = { 0, m_d, 0 };
-    Eigen::Vector3d dz = { 0, 0, m_d };
+    /* E = fc * damp * (cos(theta) - cos(theta0))^2, for (nearly) linear reference angles
+     * E = fc * damp * (theta - theta0)^2. The damping 1 / ((1 + (r_ij/r0_ij)^4) * (1 + (r_kj/r0_ik)^4))
+     * is only active if both reference distances are given. */
+    const double threshold = 1e-2;
     for (int index = 0; index < m_uff_angles.size(); ++index) {
         const auto& angle = m_uff_angles[index];
 
-        Vector i = m_geometry.row(angle.i);
-        Vector j = m_geometry.row(angle.j);
-        Vector k = m_geometry.row(angle.k);
-        Matrix derivate;
-        double costheta0_ijk = cos(angle.theta0_ijk * pi / 180.0);
-        double costheta = 0;
-        double energy = 0;
-        double dEdTheta = 0;
-
-        if (std::abs(costheta0_ijk + 1) < threshold) {
-            costheta = UFF::AngleBending(i, j, k, derivate, true);
-            energy = angle.fc * (costheta - costheta0_ijk) * (costheta - costheta0_ijk);
-            dEdTheta = 2 * angle.fc * (costheta - costheta0_ijk);
+        Eigen::Vector3d rij = m_geometry.row(angle.i) - m_geometry.row(angle.j);
+        Eigen::Vector3d rkj = m_geometry.row(angle.k) - m_geometry.row(angle.j);
+        const double dij = rij.norm();
+        const double dkj = rkj.norm();
+        Eigen::Vector3d nij = rij / dij;
+        Eigen::Vector3d nkj = rkj / dkj;
+        const double costheta = std::max(-1.0, std::min(1.0, nij.dot(nkj)));
+        const double costheta0 = cos(angle.theta0_ijk);
+        const bool linear = std::abs(costheta0 + 1) < threshold;
+
+        double damp = 1;
+        Eigen::Vector3d ddamp_i = Eigen::Vector3d::Zero(), ddamp_k = Eigen::Vector3d::Zero();
+        if (angle.r0_ij > 0 && angle.r0_ik > 0) {
+            const double fij = 1 + pow(dij / angle.r0_ij, 4);
+            const double fkj = 1 + pow(dkj / angle.r0_ik, 4);
+            damp = 1 / (fij * fkj);
+            ddamp_i = -damp * 4 * pow(dij, 3) / (pow(angle.r0_ij, 4) * fij) * nij;
+            ddamp_k = -damp * 4 * pow(dkj, 3) / (pow(angle.r0_ik, 4) * fkj) * nkj;
+        }
+
+        double bend = 0, dbend_dcos = 0;
+        if (linear) {
+            const double theta = acos(costheta);
+            const double sintheta = std::max(sin(theta), 1e-8);
+            bend = (theta - angle.theta0_ijk) * (theta - angle.theta0_ijk);
+            dbend_dcos = -2 * (theta - angle.theta0_ijk) / sintheta;
         } else {
-            costheta = UFF::AngleBending(i, j, k, derivate, true);
-            energy = angle.fc * (costheta - costheta0_ijk) * (costheta - costheta0_ijk);
-            dEdTheta = 2 * angle.fc * (costheta - costheta0_ijk);
+            bend = (costheta - costheta0) * (costheta - costheta0);
+            dbend_dcos = 2 * (costheta - costheta0);
         }
 
+        const double energy = angle.fc * damp * bend;
+        if (std::isnan(energy))
+            continue;
         m_angle_energy += energy;
-        derivate *= dEdTheta;
+
         if (m_calculate_gradient) {
-            m_gradient.row(angle.i) -= derivate.row(0);
-            m_gradient.row(angle.j) -= derivate.row(1);
-            m_gradient.row(angle.k) -= derivate.row(2);
+            Eigen::Vector3d dcos_i = (nkj - nij * costheta) / dij;
+            Eigen::Vector3d dcos_k = (nij - nkj * costheta) / dkj;
+            Eigen::Vector3d gi = angle.fc * (damp * dbend_dcos * dcos_i + bend * ddamp_i);
+            Eigen::Vector3d gk = angle.fc * (damp * dbend_dcos * dcos_k + bend * ddamp_k);
+            m_gradient.row(angle.i) += gi;
+            m_gradient.row(angle.k) += gk;
+            m_gradient.row(angle.j) -= gi + gk;
         }
     }
 }
@@ -455,25 +360,41 @@ void ForceFieldThread::CalculateESPContribution()
     }
 }
 
-D3Thread::D3Thread(int thread, int threads)
-    : ForceFieldThread(thread, threads)
+void ForceFieldThread::setD3(const json& parameter, const std::vector<int>& atom_types)
 {
-    setAutoDelete(false);
-    m_final_factor = 1 / 2625.15 * 4.19;
-    m_d = 1e-7;
+    m_atom_types = atom_types;
+    m_has_d3 = true;
 #ifdef USE_D3
-    m_d3 = new DFTD3Interface();
+    if (!m_d3)
+        m_d3 = new DFTD3Interface();
+    m_d3->UpdateParametersD3(parameter);
+    m_d3->InitialiseMolecule(m_atom_types);
 #endif
 }
 
-D3Thread::~D3Thread()
+void ForceFieldThread::setH4(const json& parameter, const std::vector<int>& atom_types)
 {
-#ifdef USE_D3
-    delete m_d3;
-#endif
+    m_atom_types = atom_types;
+    if (!m_h4correction)
+        m_h4correction = new hbonds4::H4Correction();
+
+    m_h4correction->set_OH_O(parameter["h4_oh_o"].get<double>());
+    m_h4correction->set_OH_N(parameter["h4_oh_n"].get<double>());
+    m_h4correction->set_NH_O(parameter["h4_nh_o"].get<double>());
+    m_h4correction->set_NH_N(parameter["h4_nh_n"].get<double>());
+
+    m_h4correction->set_WH_O(parameter["h4_wh_o"].get<double>());
+    m_h4correction->set_NH4(parameter["h4_nh4"].get<double>());
+    m_h4correction->set_COO(parameter["h4_coo"].get<double>());
+    m_h4correction->set_HH_Rep_K(parameter["hh_rep_k"].get<double>());
+    m_h4correction->set_HH_Rep_E(parameter["hh_rep_e"].get<double>());
+    m_h4correction->set_HH_Rep_R0(parameter["hh_rep_r0"].get<double>());
+    m_h4correction->allocate(m_atom_types.size());
+    m_h4_begin = 0;
+    m_h4_end = m_atom_types.size();
 }
 
-int D3Thread::execute()
+void ForceFieldThread::CalculateD3Contribution()
 {
 #ifdef USE_D3
     for (int i = 0; i < m_atom_types.size(); ++i) {
@@ -481,59 +402,72 @@ int D3Thread::execute()
     }
 
     if (m_calculate_gradient) {
-        double grad[3 * m_atom_types.size()];
-        m_vdw_energy = m_d3->Calculation(grad);
+        std::vector<double> grad(3 * m_atom_types.size());
+        m_d3_energy = m_d3->Calculation(grad.data());
         for (int i = 0; i < m_atom_types.size(); ++i) {
             m_gradient(i, 0) += grad[3 * i + 0] * au;
             m_gradient(i, 1) += grad[3 * i + 1] * au;
             m_gradient(i, 2) += grad[3 * i + 2] * au;
         }
     } else
-        m_vdw_energy = m_d3->Calculation(0);
+        m_d3_energy = m_d3->Calculation(0);
 #else
     std::cerr << "D3 is not included, sorry for that" << std::endl;
     exit(1);
 #endif
-    return 0;
 }
 
-H4Thread::H4Thread(int thread, int threads)
-    : ForceFieldThread(thread, threads)
+void ForceFieldThread::CalculateH4Contribution()
 {
-    setAutoDelete(false);
-    m_final_factor = 1 / 2625.15 * 4.19;
-    m_d = 1e-7;
-}
-
-H4Thread::~H4Thread()
-{
-}
-
-int H4Thread::execute()
-{
-    hbonds4::atom_t geometry[m_atom_types.size()];
+    /* the H4 and HH corrections are parametrised in kJ/mol */
+    const double factor = 1 / 2625.15 * 4.19;
+    std::vector<hbonds4::atom_t> geometry(m_atom_types.size());
 
     for (int i = 0; i < m_atom_types.size(); ++i) {
         geometry[i].x = m_geometry(i, 0) * m_au;
         geometry[i].y = m_geometry(i, 1) * m_au;
         geometry[i].z = m_geometry(i, 2) * m_au;
         geometry[i].e = m_atom_types[i];
-        m_h4correction.GradientH4()[i].x = 0;
-        m_h4correction.GradientH4()[i].y = 0;
-        m_h4correction.GradientH4()[i].z = 0;
+        m_h4correction->GradientH4()[i].x = 0;
+        m_h4correction->GradientH4()[i].y = 0;
+        m_h4correction->GradientH4()[i].z = 0;
 
-        m_h4correction.GradientHH()[i].x = 0;
-        m_h4correction.GradientHH()[i].y = 0;
-        m_h4correction.GradientHH()[i].z = 0;
+        m_h4correction->GradientHH()[i].x = 0;
+        m_h4correction->GradientHH()[i].y = 0;
+        m_h4correction->GradientHH()[i].z = 0;
     }
 
-    m_vdw_energy = m_h4correction.energy_corr_h4(m_atom_types.size(), geometry) * m_vdw_scaling * m_final_factor;
-    m_rep_energy = m_h4correction.energy_corr_hh_rep(m_atom_types.size(), geometry) * m_rep_scaling * m_final_factor;
+    m_h4_energy = m_h4correction->energy_corr_h4(m_atom_types.size(), geometry.data(), m_h4_begin, m_h4_end) * m_vdw_scaling * factor;
+    m_hh_energy = m_h4correction->energy_corr_hh_rep(m_atom_types.size(), geometry.data(), m_h4_begin, m_h4_end) * m_rep_scaling * factor;
+
+    if (!m_calculate_gradient)
+        return;
 
     for (int i = 0; i < m_atom_types.size(); ++i) {
-        m_gradient(i, 0) += m_final_factor * m_vdw_scaling * m_h4correction.GradientH4()[i].x + m_final_factor * m_rep_scaling * m_h4correction.GradientHH()[i].x;
-        m_gradient(i, 1) += m_final_factor * m_vdw_scaling * m_h4correction.GradientH4()[i].y + m_final_factor * m_rep_scaling * m_h4correction.GradientHH()[i].y;
-        m_gradient(i, 2) += m_final_factor * m_vdw_scaling * m_h4correction.GradientH4()[i].z + m_final_factor * m_rep_scaling * m_h4correction.GradientHH()[i].z;
+        m_gradient(i, 0) += factor * m_vdw_scaling * m_h4correction->GradientH4()[i].x + factor * m_rep_scaling * m_h4correction->GradientHH()[i].x;
+        m_gradient(i, 1) += factor * m_vdw_scaling * m_h4correction->GradientH4()[i].y + factor * m_rep_scaling * m_h4correction->GradientHH()[i].y;
+        m_gradient(i, 2) += factor * m_vdw_scaling * m_h4correction->GradientH4()[i].z + factor * m_rep_scaling * m_h4correction->GradientHH()[i].z;
     }
+}
+
+ForceFieldReductionThread::ForceFieldReductionThread(const std::vector<ForceFieldThread*>* threads, Matrix* gradient, int begin, int end)
+    : m_threads(threads)
+    , m_gradient(gradient)
+    , m_begin(begin)
+    , m_end(end)
+{
+    setAutoDelete(false);
+}
+
+int ForceFieldReductionThread::execute()
+{
+    const int rows = m_end - m_begin;
+    if (rows <= 0)
+        return 0;
+    auto block = m_gradient->middleRows(m_begin, rows);
+    block.setZero();
+    for (const auto* thread : *m_threads)
+        block += thread->Gradient().middleRows(m_begin, rows);
     return 0;
 }
+
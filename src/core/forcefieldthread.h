@@ -21,7 +21,9 @@
 
 #include "src/core/global.h"
 
+#include "forcefield_terms/bondedkernels.h"
 #include "hbonds.h"
+#include "neighbourlist.h"
 
 #include "external/CxxThreadPool/include/CxxThreadPool.h"
 
@@ -36,7 +38,10 @@
 #include "src/core/qmdff_par.h"
 #include "src/core/uff_par.h"
 
+#include <array>
+#include <chrono>
 #include <functional>
+#include <new>
 #include <set>
 #include <vector>
 
@@ -76,18 +81,40 @@ struct vdW {
     double C_ij = 0, r0_ij = 0;
 };
 
+/* per atom square roots of C and r0, pairs are combined on the fly */
+struct vdWAtom {
+    double C_i = 0, r0_i = 0;
+};
+
 struct EQ {
     int type = 1; // 1 = UFF, 2 = QMDFF
     int i = 0, j = 0;
     double q_i = 0, q_j = 0, epsilon = 1;
 };
 
+/* term classes, used for timing and load balancing of the force field threads */
+enum FFTermType {
+    FFBondTerm = 0,
+    FFAngleTerm,
+    FFDihedralTerm,
+    FFInversionTerm,
+    FFvdWTerm,
+    FFEQTerm,
+    FFH4Term,
+    FFD3Term,
+    FFTermTypes
+};
+
 class ForceFieldThread : public CxxThread {
 
 public:
     ForceFieldThread(int thread, int threads);
+    ~ForceFieldThread();
     virtual int execute() override;
     virtual int Type() const { return 1; }
+
+    /*! \brief Remove all bonded and pairwise terms, D3 and H4 are kept */
+    void clearTerms();
     void addBond(const Bond& bonds);
     void addAngle(const Angle& angles);
     void addDihedral(const Dihedral& dihedrals);
@@ -95,24 +122,60 @@ public:
     void addvdW(const vdW& vdWs);
     void addEQ(const EQ& EQs);
 
+    inline void setNeighbourList(const NeighbourList* list, const std::vector<vdWAtom>* atoms, double cutoff, double switch_width)
+    {
+        m_neighbourlist = list;
+        m_vdw_atoms = atoms;
+        m_vdw_cutoff = cutoff;
+        m_vdw_switch = switch_width;
+    }
+
+    /*! \brief Share [begin, end) of the neighbour list pairs, given as fractions since the list changes size */
+    inline void setPairRange(double begin, double end)
+    {
+        m_pair_begin = begin;
+        m_pair_end = end;
+    }
+
+    /*! \brief Point the thread to the shared geometry, no copy is made
+     * the geometry has to outlive the next execute() */
     inline void UpdateGeometry(const Matrix& geometry, bool gradient)
     {
-        m_geometry = geometry;
+        new (&m_geometry) Eigen::Map<const Matrix>(geometry.data(), geometry.rows(), geometry.cols());
         m_calculate_gradient = gradient;
-        m_gradient = Eigen::MatrixXd::Zero(m_geometry.rows(), 3);
     }
 
     inline void setGeometry(const Matrix& geometry, bool gradient)
     {
-        m_geometry = geometry;
-        m_calculate_gradient = gradient;
-        m_gradient = Eigen::MatrixXd::Zero(m_geometry.rows(), 3);
+        UpdateGeometry(geometry, gradient);
     }
 
     inline void setMethod(int method)
     {
         m_method = method;
     }
+
+    /*! \brief Allow the vectorised bonded kernels, if the cpu supports them */
+    inline void setSIMD(bool simd) { m_simd = simd; }
+
+    /*! \brief This thread additionally evaluates the D3 dispersion of the whole molecule */
+    void setD3(const json& parameter, const std::vector<int>& atom_types);
+
+    /*! \brief This thread additionally evaluates the H4 and HH corrections for the atoms [begin, end) */
+    void setH4(const json& parameter, const std::vector<int>& atom_types);
+    inline void setH4Range(int begin, int end)
+    {
+        m_h4_begin = begin;
+        m_h4_end = end;
+    }
+    inline bool hasD3() const { return m_has_d3; }
+    inline bool hasH4() const { return m_h4correction != nullptr; }
+
+    /*! \brief Accumulate the wall time (in microseconds) spent per term class */
+    inline void setTiming(bool timing) { m_timing = timing; }
+    inline const std::array<double, FFTermTypes>& Timings() const { return m_timings; }
+    inline void resetTimings() { m_timings.fill(0); }
+
     double BondEnergy() { return m_bond_energy; }
     double AngleEnergy() { return m_angle_energy; }
     double DihedralEnergy() { return m_dihedral_energy; }
@@ -120,8 +183,11 @@ public:
     double VdWEnergy() { return m_vdw_energy; }
     double RepEnergy() { return m_rep_energy; }
     double EQEnergy() { return m_eq_energy; }
+    double D3Energy() { return m_d3_energy; }
+    double H4Energy() { return m_h4_energy; }
+    double HHEnergy() { return m_hh_energy; }
 
-    Matrix Gradient() const { return m_gradient; }
+    const Matrix& Gradient() const { return m_gradient; }
 
 private:
     void CalculateUFFBondContribution();
@@ -129,12 +195,27 @@ private:
     void CalculateUFFDihedralContribution();
     void CalculateUFFInversionContribution();
     void CalculateUFFvdWContribution();
+    void CalculateUFFvdWCutoffContribution();
 
     void CalculateQMDFFBondContribution();
     void CalculateQMDFFAngleContribution();
     void CalculateQMDFFDihedralContribution();
     void CalculateQMDFFEspContribution();
     void CalculateESPContribution();
+    void CalculateD3Contribution();
+    void CalculateH4Contribution();
+
+    template <typename Function>
+    inline void Timed(int type, Function function)
+    {
+        if (!m_timing) {
+            function();
+            return;
+        }
+        auto start = std::chrono::steady_clock::now();
+        function();
+        m_timings[type] += std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+    }
 
     // double HarmonicBondStretching();
 
@@ -150,13 +231,39 @@ private:
 
     std::vector<Bond> m_uff_bonds;
     std::vector<Angle> m_uff_angles;
-    std::vector<Dihedral> m_uff_dihedrals, m_qmdff_dihedrals;
-    std::vector<Inversion> m_uff_inversions, m_qmdff_inversions;
+    std::vector<Dihedral> m_qmdff_dihedrals;
+    std::vector<Inversion> m_qmdff_inversions;
     std::vector<vdW> m_uff_vdWs;
     std::vector<EQ> m_EQs;
 
+    BondSoA m_bond_soa;
+    AngleSoA m_angle_soa;
+    DihedralSoA m_dihedral_soa;
+    InversionSoA m_inversion_soa;
+
+    const NeighbourList* m_neighbourlist = nullptr;
+    const std::vector<vdWAtom>* m_vdw_atoms = nullptr;
+    double m_vdw_cutoff = 0, m_vdw_switch = 0;
+    double m_pair_begin = 0, m_pair_end = 1;
+
+#ifdef USE_D3
+    DFTD3Interface* m_d3 = nullptr;
+#endif
+    hbonds4::H4Correction* m_h4correction = nullptr;
+    std::vector<int> m_atom_types;
+    int m_h4_begin = 0, m_h4_end = 0;
+    bool m_has_d3 = false;
+    double m_d3_energy = 0, m_h4_energy = 0, m_hh_energy = 0;
+
+    std::array<double, FFTermTypes> m_timings = {};
+    bool m_timing = false;
+
 protected:
-    Matrix m_geometry, m_gradient;
+    /* called at the beginning of execute(), every thread clears its own gradient block */
+    void ResetGradient();
+
+    Eigen::Map<const Matrix> m_geometry;
+    Matrix m_gradient;
     double m_energy = 0, m_bond_energy = 0.0, m_angle_energy = 0.0, m_dihedral_energy = 0.0, m_inversion_energy = 0.0, m_vdw_energy = 0.0, m_rep_energy = 0.0, m_eq_energy = 0.0;
 
     double m_final_factor = 1;
@@ -166,68 +273,22 @@ protected:
     int m_calc_gradient = 1;
     int m_thread = 0, m_threads = 0, m_method = 1;
     bool m_calculate_gradient = true;
+    bool m_simd = true;
 };
 
-class D3Thread : public ForceFieldThread {
-
-public:
-    D3Thread(int thread, int threads);
-    ~D3Thread();
-    virtual int Type() const { return 2; }
-
-    void setParamater(const json& parameter)
-    {
-#ifdef USE_D3
-        m_d3->UpdateParametersD3(parameter);
-#endif
-    }
-
-    void Initialise(const std::vector<int>& atom_types)
-    {
-        m_atom_types = atom_types;
-#ifdef USE_D3
-        m_d3->InitialiseMolecule(m_atom_types);
-#endif
-    }
-    virtual int execute() override;
-
-private:
-#ifdef USE_D3
-    DFTD3Interface* m_d3;
-#endif
-    std::vector<int> m_atom_types;
-};
-
-class H4Thread : public ForceFieldThread {
+/*! \brief Sums the gradient blocks of all force field threads for one range of atoms
+ *
+ * Every ForceFieldThread accumulates into its own gradient block without any
+ * locking, the blocks are then reduced in parallel over disjoint atom ranges.
+ */
+class ForceFieldReductionThread : public CxxThread {
 
 public:
-    H4Thread(int thread, int threads);
-    ~H4Thread();
-    virtual int Type() const { return 3; }
-
-    void setParamater(const json& parameter)
-    {
-        m_h4correction.set_OH_O(parameter["h4_oh_o"].get<double>());
-        m_h4correction.set_OH_N(parameter["h4_oh_n"].get<double>());
-        m_h4correction.set_NH_O(parameter["h4_nh_o"].get<double>());
-        m_h4correction.set_NH_N(parameter["h4_nh_n"].get<double>());
-
-        m_h4correction.set_WH_O(parameter["h4_wh_o"].get<double>());
-        m_h4correction.set_NH4(parameter["h4_nh4"].get<double>());
-        m_h4correction.set_COO(parameter["h4_coo"].get<double>());
-        m_h4correction.set_HH_Rep_K(parameter["hh_rep_k"].get<double>());
-        m_h4correction.set_HH_Rep_E(parameter["hh_rep_e"].get<double>());
-        m_h4correction.set_HH_Rep_R0(parameter["hh_rep_r0"].get<double>());
-    }
-
-    void Initialise(const std::vector<int>& atom_types)
-    {
-        m_atom_types = atom_types;
-        m_h4correction.allocate(m_atom_types.size());
-    }
+    ForceFieldReductionThread(const std::vector<ForceFieldThread*>* threads, Matrix* gradient, int begin, int end);
     virtual int execute() override;
 
 private:
-    hbonds4::H4Correction m_h4correction;
-    std::vector<int> m_atom_types;
+    const std::vector<ForceFieldThread*>* m_threads;
+    Matrix* m_gradient;
+    int m_begin = 0, m_end = 0;
 };
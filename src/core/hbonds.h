@@ -360,7 +360,9 @@ public:
     // H4 correction calculation
     //==============================================================================
 
-    inline double energy_corr_h4(int natom, atom_t* geo)
+    // Only donor/acceptor atoms i in [begin, end) are taken as first partner, so the
+    // correction can be split over several instances, end < 0 means natom
+    inline double energy_corr_h4(int natom, atom_t* geo, int begin = 0, int end = -1)
     {
         double e_corr_sum = 0; // correction energy
         int do_grad = 1;
@@ -416,8 +418,11 @@ public:
         double rdhs, ravgs;
         double sign;
 
+        if (end < 0)
+            end = natom;
+
         // Iterate over donor/acceptor pairs
-        for (i = 0; i < natom; i++) {
+        for (i = begin; i < end; i++) {
             if (geo[i].e == NITROGEN || geo[i].e == OXYGEN) {
                 for (j = 0; j < i; j++) {
                     if (geo[j].e == NITROGEN || geo[j].e == OXYGEN) {
@@ -788,7 +793,7 @@ public:
     // H-H repulsion calculation
     //==============================================================================
 
-    inline double energy_corr_hh_rep(int natom, atom_t* geo)
+    inline double energy_corr_hh_rep(int natom, atom_t* geo, int begin = 0, int end = -1)
     {
         double e_corr_sum = 0; // correction energy
         int i, j; // iteration counters
@@ -798,8 +803,11 @@ public:
         double d_rad;
         double gx, gy, gz;
 
+        if (end < 0)
+            end = natom;
+
         // Iterate over H atoms twice
-        for (i = 0; i < natom; i++) {
+        for (i = begin; i < end; i++) {
             if (geo[i].e == HYDROGEN) {
                 for (j = 0; j < i; j++) {
                     if (geo[j].e == HYDROGEN) {
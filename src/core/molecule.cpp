@@ -19,6 +19,7 @@
  */
 
 #include "elements.h"
+#include "outputbuffer.h"
 
 #include "src/tools/general.h"
 #include "src/tools/geometry.h"
@@ -38,6 +39,7 @@
 #include <istream>
 #include <map>
 #include <sstream>
+#include <unordered_map>
 
 #include "molecule.h"
 
@@ -222,6 +224,7 @@ void Molecule::ImportJson(const json& molecule)
         auto position = Tools::String2DoubleVec(molecule["atom" + std::to_string(i)], "|");
         m_geometry.row(i) = Eigen::Vector3d(position[0], position[1], position[2]); //(std::array<double, 3>({ position[0], position[1], position[2] }));
     }
+    Invalidate();
 }
 void Molecule::Initialise(const int* attyp, const double* coord, const int natoms, const double charge, const int spin)
 {
@@ -239,6 +242,7 @@ void Molecule::Initialise(const int* attyp, const double* coord, const int natom
         m_atoms.push_back(attyp[i]);
         m_mass += Elements::AtomicMass[attyp[i]];
     }
+    Invalidate();
 }
 
 void Molecule::ApplyReorderRule(const std::vector<int>& rule)
@@ -248,6 +252,7 @@ void Molecule::ApplyReorderRule(const std::vector<int>& rule)
         mol.addPair(Atom(i));
     m_geometry = mol.m_geometry;
     m_atoms = mol.m_atoms;
+    Invalidate();
 }
 
 void Molecule::print_geom(bool moreinfo) const
@@ -324,7 +329,7 @@ void Molecule::InitialiseEmptyGeometry(int atoms)
         m_geometry.conservativeResize(m_geometry.rows() +  1, m_geometry.cols());
         m_geometry.row(m_geometry.rows() -  1) = Eigen::Vector3d(vector[0], vector[1], vector[2]);
     }*/
-    m_dirty = true;
+    Invalidate();
 }
 
 bool Molecule::addPair(const std::pair<int, Position>& atom)
@@ -343,7 +348,7 @@ bool Molecule::addPair(const std::pair<int, Position>& atom)
             if (CalculateDistance(i, j) < 1e-6)
                 exist = false;
 
-    m_dirty = true;
+    Invalidate();
 
     return exist;
 }
@@ -630,7 +635,7 @@ void Molecule::setAtom(const std::string& internal, int i)
         m_geometry(i, 1) = y;
         m_geometry(i, 2) = z;
     }
-    m_dirty = true;
+    Invalidate();
 }
 
 void Molecule::setXYZ(const std::string& internal, int i)
@@ -654,14 +659,14 @@ void Molecule::setXYZ(const std::string& internal, int i)
         m_geometry(i, 2) = z;
     }
 
-    m_dirty = true;
+    Invalidate();
 }
 
 void Molecule::clear()
 {
     m_atoms.clear();
     // m_geometry.clear();
-    m_dirty = true;
+    Invalidate();
 }
 
 void Molecule::LoadMolecule(const Molecule& molecule)
@@ -830,7 +835,7 @@ Geometry Molecule::getGeometryByFragment(int fragment, bool protons) const
 
 bool Molecule::setGeometry(const Geometry &geometry)
 {
-    m_dirty = true;
+    Invalidate();
     m_geometry = geometry;
     return true;
 }
@@ -842,6 +847,9 @@ bool Molecule::setGeometryByFragment(const Geometry& geometry, int fragment, boo
 
     std::vector<int> frag = m_fragments[fragment];
     int index = 0;
+    /* the fragments are kept, callers address the other fragments by their index afterwards */
+    m_neighbours_valid = false;
+    m_distances_valid = false;
     if (protons) {
         for (int i : frag) {
             m_geometry(i, 0) = geometry(index, 0);
@@ -865,9 +873,10 @@ bool Molecule::setGeometryByFragment(const Geometry& geometry, int fragment, boo
 std::string Molecule::LowerDistanceMatrix() const
 {
     std::ostringstream stream;
+    const Matrix& distances = Distances();
     for (int i = 0; i < AtomCount(); ++i) {
         for (int j = 0; j <= i; ++j) {
-            stream << std::to_string(CalculateDistance(i, j)) + ",";
+            stream << std::to_string(distances(i, j)) + ",";
         }
         stream << std::endl;
     }
@@ -879,9 +888,11 @@ std::string Molecule::LowerDistanceMatrix() const
 std::vector<float> Molecule::LowerDistanceVector() const
 {
     std::vector<float> vector;
+    const Matrix& distances = Distances();
+    vector.reserve(AtomCount() * (AtomCount() - 1) / 2);
     for (int i = 0; i < AtomCount(); ++i) {
         for (int j = 0; j < i; ++j) {
-            vector.push_back((CalculateDistance(i, j)));
+            vector.push_back(distances(i, j));
         }
     }
     return vector;
@@ -1073,18 +1084,12 @@ std::pair<int, Position> Molecule::Atom(int i) const
 
 void Molecule::writeXYZFile(const std::string& filename) const
 {
-    std::ofstream input;
-    input.open(filename, std::ios::out);
-    input << XYZString();
-    input.close();
+    OutputBuffer::Write(filename, XYZString());
 }
 
 void Molecule::writeXYZFile(const std::string& filename, const  std::vector<int> &order) const
 {
-    std::ofstream input;
-    input.open(filename, std::ios::out);
-    input << XYZString(order);
-    input.close();
+    OutputBuffer::Write(filename, XYZString(order));
 }
 
 std::string Molecule::Header() const
@@ -1161,11 +1166,7 @@ void Molecule::appendXYZFile(const std::string& filename) const
     for (int i = 0; i < m_borders.size(); ++i) {
         output += "X    " + std::to_string(m_borders[i](0)) + "    " + std::to_string(m_borders[i](1)) + "    " + std::to_string(m_borders[i](2)) + "\n";
     }
-    std::ofstream input;
-    input.open(filename, std::ios_base::app);
-    //std::cout << output << std::endl;
-    input << output;
-    input.close();
+    OutputBuffer::Append(filename, output);
 }
 
 void Molecule::appendDipoleFile(const std::string& filename) const
@@ -1176,11 +1177,7 @@ void Molecule::appendDipoleFile(const std::string& filename) const
     for (int i = 0; i < AtomCount(); ++i) {
         output += fmt::format("{}  {:f}    {:f}    {:f}    {:f}\n", Elements::ElementAbbr[m_atoms[i]].c_str(), m_geometry(i, 0), m_geometry(i, 1), m_geometry(i, 2), m_charges[i]);
     }
-    std::ofstream input;
-    input.open(filename, std::ios_base::app);
-    // std::cout << output << std::endl;
-    input << output;
-    input.close();
+    OutputBuffer::Append(filename, output);
 }
 
 std::string Molecule::XYZString() const
@@ -1215,17 +1212,12 @@ std::string Molecule::XYZString(const std::vector<int> &order) const
 std::vector<int> Molecule::BoundHydrogens(int atom, double scaling) const
 {
     std::vector<int> result;
-    if (atom >= AtomCount() || Atom(atom).first == 1)
+    if (atom >= AtomCount() || m_atoms[atom] == 1)
         return result;
 
-    for (int i = 0; i < AtomCount(); ++i) {
-        // std::cout << Atom(i).first << std::endl;
-        if (atom == i || Atom(i).first != 1)
-            continue;
-        double distance = CalculateDistance(i, atom);
-        // std::cout << i << " " << atom << " " << distance << std::endl;
-        if (distance < (Elements::CovalentRadius[Atom(atom).first] + Elements::CovalentRadius[1]) * scaling)
-            result.push_back(i);
+    for (const auto& neighbour : Neighbours(scaling)[atom]) {
+        if (m_atoms[neighbour.first] == 1 && neighbour.second < (Elements::CovalentRadius[m_atoms[atom]] + Elements::CovalentRadius[1]) * scaling)
+            result.push_back(neighbour.first);
     }
     return result;
 }
@@ -1366,6 +1358,75 @@ void Molecule::AnalyseIntermoleculeDistance() const
     }
 }
 
+const std::vector<std::vector<std::pair<int, double>>>& Molecule::Neighbours(double scaling) const
+{
+    if (m_neighbours_valid && scaling <= m_neighbour_scaling)
+        return m_neighbours;
+    /* a larger scaling than before is kept, alternating queries do not rebuild the list every time */
+    if (m_neighbours_valid)
+        scaling = std::max(scaling, m_neighbour_scaling);
+    m_neighbour_scaling = scaling;
+    m_neighbours_valid = true;
+
+    const int atoms = AtomCount();
+    m_neighbours.assign(atoms, std::vector<std::pair<int, double>>());
+    double radius = 0;
+    for (int i = 0; i < atoms; ++i)
+        radius = std::max(radius, Elements::CovalentRadius[m_atoms[i]]);
+    /* no bond is longer than a cell, bonded atoms are in the same or in adjacent cells */
+    const double cell = std::max(2 * radius * scaling * (1 + 1e-9), 1e-3);
+
+    auto key = [](int64_t x, int64_t y, int64_t z) {
+        const int64_t offset = int64_t(1) << 20;
+        return ((x + offset) << 42) | ((y + offset) << 21) | (z + offset);
+    };
+    std::vector<std::array<int64_t, 3>> cells(atoms);
+    std::unordered_map<int64_t, std::vector<int>> grid;
+    grid.reserve(atoms);
+    for (int i = 0; i < atoms; ++i) {
+        for (int j = 0; j < 3; ++j)
+            cells[i][j] = int64_t(std::floor(m_geometry(i, j) / cell));
+        grid[key(cells[i][0], cells[i][1], cells[i][2])].push_back(i);
+    }
+    for (int i = 0; i < atoms; ++i) {
+        const double radius_i = Elements::CovalentRadius[m_atoms[i]];
+        for (int64_t x = cells[i][0] - 1; x <= cells[i][0] + 1; ++x)
+            for (int64_t y = cells[i][1] - 1; y <= cells[i][1] + 1; ++y)
+                for (int64_t z = cells[i][2] - 1; z <= cells[i][2] + 1; ++z) {
+                    auto bucket = grid.find(key(x, y, z));
+                    if (bucket == grid.end())
+                        continue;
+                    for (int j : bucket->second) {
+                        if (j <= i)
+                            continue;
+                        const double distance = CalculateDistance(i, j);
+                        if (distance <= (radius_i + Elements::CovalentRadius[m_atoms[j]]) * scaling) {
+                            m_neighbours[i].push_back(std::pair<int, double>(j, distance));
+                            m_neighbours[j].push_back(std::pair<int, double>(i, distance));
+                        }
+                    }
+                }
+    }
+    for (auto& list : m_neighbours)
+        std::sort(list.begin(), list.end());
+    return m_neighbours;
+}
+
+const Matrix& Molecule::Distances() const
+{
+    if (m_distances_valid)
+        return m_distances;
+    const int atoms = AtomCount();
+    m_distances = Matrix::Zero(atoms, atoms);
+    for (int i = 0; i < atoms; ++i)
+        for (int j = 0; j < i; ++j) {
+            m_distances(i, j) = CalculateDistance(i, j);
+            m_distances(j, i) = m_distances(i, j);
+        }
+    m_distances_valid = true;
+    return m_distances;
+}
+
 std::vector<std::vector<int>> Molecule::GetFragments(double scaling) const
 {
     if (scaling != m_scaling)
@@ -1373,39 +1434,38 @@ std::vector<std::vector<int>> Molecule::GetFragments(double scaling) const
     if (m_fragments.size() > 0 && !m_dirty)
         return m_fragments;
     m_mass_fragments.clear();
+    m_fragment_assignment.clear();
     m_scaling = scaling;
     std::multimap<double, std::vector<int>> ordered_list;
 
-    std::vector<int> fragment, atoms, cached;
-    double mass = 0;
-    for (std::size_t i = 0; i < m_atoms.size(); ++i)
-        atoms.push_back(i);
+    const auto& neighbours = Neighbours(m_scaling);
+    std::vector<char> assigned(m_atoms.size(), 0);
+    std::vector<int> fragment;
 
     m_fragments.clear();
 
-    while (atoms.size()) {
-        fragment.push_back(atoms.at(0));
-        atoms.erase(atoms.begin());
+    /* breadth first over the bond graph, atoms are found in the same order as by scanning all remaining atoms */
+    for (std::size_t seed = 0; seed < m_atoms.size(); ++seed) {
+        if (assigned[seed])
+            continue;
+        double mass = 0;
+        fragment.push_back(seed);
+        assigned[seed] = 1;
         for (std::size_t i = 0; i < fragment.size(); ++i) {
-            for (std::size_t j = 0; j < atoms.size(); ++j) {
-                double distance = CalculateDistance(fragment[i], atoms[j]);
-                //std::cout << "Fragment No: " << m_fragments.size() + 1 << " ("<< fragment.size() <<")  ##  Atom " << fragment[i] << " (Index " << i << ") and Atom " << atoms[j] << " - Distance: " << distance << " Thresh " << (Elements::CovalentRadius[Atom(fragment[i]).first] + Elements::CovalentRadius[Atom(atoms[j]).first]);
-                if (distance < (Elements::CovalentRadius[Atom(fragment[i]).first] + Elements::CovalentRadius[Atom(atoms[j]).first]) * m_scaling) {
-                    //std::cout << " ... taken " << std::endl;
-                    fragment.push_back(atoms.at(j));
-                    mass += Elements::AtomicMass[Atom(atoms.at(j)).first];
-                    atoms.erase(atoms.begin() + j);
-                    --j; // We have to decrease the atom vector counter since it got one element removed and we dont want to skip single elements
-                } //else
-                //   std::cout  << std::endl;
+            const double radius = Elements::CovalentRadius[m_atoms[fragment[i]]];
+            for (const auto& neighbour : neighbours[fragment[i]]) {
+                const int j = neighbour.first;
+                if (assigned[j] || neighbour.second >= (radius + Elements::CovalentRadius[m_atoms[j]]) * m_scaling)
+                    continue;
+                fragment.push_back(j);
+                mass += Elements::AtomicMass[m_atoms[j]];
+                assigned[j] = 1;
             }
         }
         std::sort(fragment.begin(), fragment.end());
-        //m_fragments.push_back(fragment);
         mass *= -1; // I think, that is an easy way to ***
         ordered_list.insert(std::pair<double, std::vector<int>>(mass, fragment));
         fragment.clear();
-        mass = 0;
     }
     for (const auto& entry : ordered_list) {
         //m_mass_fragments.push_back(-1 * entry.first); // *** make the std::map container sort in reverse order :-)
@@ -1414,7 +1474,7 @@ std::vector<std::vector<int>> Molecule::GetFragments(double scaling) const
     for (int i = 0; i < m_fragments.size(); ++i) {
         double mass = 0;
         for (auto atom : m_fragments[i]) {
-            mass += Elements::AtomicMass[Atom(atom).first];
+            mass += Elements::AtomicMass[m_atoms[atom]];
             m_fragment_assignment.insert(std::pair<int, int>(atom, i));
         }
         m_mass_fragments.push_back(mass);
@@ -1426,17 +1486,17 @@ std::vector<std::vector<int>> Molecule::GetFragments(double scaling) const
 
 void Molecule::InitialiseConnectedMass(double scaling, bool protons)
 {
+    const auto& neighbours = Neighbours(scaling);
+    m_connect_mass.clear();
     for (int i = 0; i < AtomCount(); ++i) {
         int mass = 0;
-        auto atom_i = Atom(i);
-        if (!protons && atom_i.first == 1)
+        if (!protons && m_atoms[i] == 1)
             continue;
-        for (int j = i + 1; j < AtomCount(); ++j) {
-            auto atom_j = Atom(j);
-            double distance = CalculateDistance(i, j);
-            if (distance < (Elements::CovalentRadius[atom_i.first] + Elements::CovalentRadius[atom_j.first]) * scaling) {
-                mass += atom_j.first; //Elements::AtomicMass[atom_j.first - 1];
-            }
+        const double radius = Elements::CovalentRadius[m_atoms[i]];
+        for (const auto& neighbour : neighbours[i]) {
+            const int j = neighbour.first;
+            if (j > i && neighbour.second < (radius + Elements::CovalentRadius[m_atoms[j]]) * scaling)
+                mass += m_atoms[j]; //Elements::AtomicMass[atom_j.first - 1];
         }
         m_connect_mass.push_back(mass);
     }
@@ -1535,17 +1595,15 @@ Molecule Molecule::AtomsRemoved(const std::vector<int>& atoms)
 
 std::pair<Matrix, Matrix> Molecule::DistanceMatrix() const
 {
-    Matrix distance = Eigen::MatrixXd::Zero(AtomCount(), AtomCount());
-    Matrix topo = distance;
+    Matrix topo = Eigen::MatrixXd::Zero(AtomCount(), AtomCount());
+    const auto& neighbours = Neighbours(m_scaling);
     for (int i = 0; i < AtomCount(); ++i) {
-        for (int j = 0; j < i; ++j) {
-            distance(i, j) = CalculateDistance(i, j);
-            distance(j, i) = distance(i, j);
-            topo(i, j) = distance(i, j) <= (Elements::CovalentRadius[Atom(i).first] + Elements::CovalentRadius[Atom(j).first]) * m_scaling;
-            topo(j, i) = topo(i, j);
+        for (const auto& neighbour : neighbours[i]) {
+            const int j = neighbour.first;
+            topo(i, j) = neighbour.second <= (Elements::CovalentRadius[m_atoms[i]] + Elements::CovalentRadius[m_atoms[j]]) * m_scaling;
         }
     }
-    return std::pair<Matrix, Matrix>(distance, topo);
+    return std::pair<Matrix, Matrix>(Distances(), topo);
 }
 
 std::vector<double> Molecule::GetBox() const
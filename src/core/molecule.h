@@ -207,6 +207,14 @@ class Molecule
     inline double Ib() const { return m_Ib; }
     inline double Ic() const { return m_Ic; }
 
+    /*! \brief Set previously calculated rotational constants */
+    inline void setRotationalConstants(double Ia, double Ib, double Ic)
+    {
+        m_Ia = Ia;
+        m_Ib = Ib;
+        m_Ic = Ic;
+    }
+
     void AnalyseIntermoleculeDistance() const;
 
     inline void setScaling(double scaling) { m_scaling = scaling; }
@@ -289,6 +297,23 @@ private:
 
     void InitialiseEmptyGeometry(int atoms);
 
+    /*! \brief Neighbours (index, distance) of every atom with d <= (r_i + r_j) * scaling, or more if built for a larger scaling
+     *
+     * Found on a grid with cells of the largest bond length, sorted by index and kept until the geometry changes.
+     */
+    const std::vector<std::vector<std::pair<int, double>>>& Neighbours(double scaling) const;
+
+    /*! \brief All pairwise distances, kept until the geometry changes */
+    const Matrix& Distances() const;
+
+    /*! \brief Atoms or coordinates changed, all cached topology has to be rebuilt */
+    inline void Invalidate()
+    {
+        m_dirty = true;
+        m_neighbours_valid = false;
+        m_distances_valid = false;
+    }
+
     int m_charge = 0, m_spin = 0;
     Position m_dipole;
     Geometry m_geometry;
@@ -304,6 +329,11 @@ private:
     mutable std::vector<double> m_mass_fragments;
     std::vector<std::pair<int, int>> m_bonds;
 
+    mutable std::vector<std::vector<std::pair<int, double>>> m_neighbours;
+    mutable Matrix m_distances;
+    mutable double m_neighbour_scaling = 0;
+    mutable bool m_neighbours_valid = false, m_distances_valid = false;
+
     mutable bool m_dirty = true;
     std::string m_name;
     double m_energy = 0, m_Ia = 0, m_Ib = 0, m_Ic = 0, m_mass = 0, m_hbond_cutoff = 3;
@@ -0,0 +1,129 @@
+/*
+ * < Cell list based Verlet neighbour list for non-bonded terms. >
+ * Copyright (C) 2025 Conrad Hübler <Conrad.Huebler@gmx.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <algorithm>
+#include <cmath>
+
+#include "neighbourlist.h"
+
+void NeighbourList::setCutoff(double cutoff, double skin)
+{
+    m_cutoff = cutoff;
+    m_skin = std::max(skin, 0.0);
+    m_valid = false;
+}
+
+void NeighbourList::setExclusions(const std::vector<std::vector<int>>& exclusions)
+{
+    m_exclusions = exclusions;
+    for (auto& list : m_exclusions)
+        std::sort(list.begin(), list.end());
+    m_valid = false;
+}
+
+bool NeighbourList::isExcluded(int i, int j) const
+{
+    if (i >= m_exclusions.size())
+        return false;
+    return std::binary_search(m_exclusions[i].begin(), m_exclusions[i].end(), j);
+}
+
+bool NeighbourList::Update(const Matrix& geometry)
+{
+    if (m_valid && m_reference.rows() == geometry.rows()) {
+        const double threshold = 0.25 * m_skin * m_skin;
+        bool moved = false;
+        for (int i = 0; i < geometry.rows() && !moved; ++i) {
+            const double dx = geometry(i, 0) - m_reference(i, 0);
+            const double dy = geometry(i, 1) - m_reference(i, 1);
+            const double dz = geometry(i, 2) - m_reference(i, 2);
+            moved = (dx * dx + dy * dy + dz * dz) > threshold;
+        }
+        if (!moved)
+            return false;
+    }
+    Build(geometry);
+    return true;
+}
+
+void NeighbourList::Build(const Matrix& geometry)
+{
+    const int atoms = geometry.rows();
+    m_first.clear();
+    m_second.clear();
+    m_reference = geometry;
+    m_valid = true;
+    m_builds++;
+    if (atoms == 0)
+        return;
+
+    double range = m_cutoff + m_skin;
+    const double range2 = range * range;
+
+    Eigen::RowVector3d min = geometry.colwise().minCoeff();
+    Eigen::RowVector3d max = geometry.colwise().maxCoeff();
+    Eigen::RowVector3d extent = max - min;
+
+    /* the grid must never hold much more cells than atoms, dilute systems get larger cells */
+    double cell = range;
+    int nx = 1, ny = 1, nz = 1;
+    while (true) {
+        nx = std::max(1, int(extent(0) / cell) + 1);
+        ny = std::max(1, int(extent(1) / cell) + 1);
+        nz = std::max(1, int(extent(2) / cell) + 1);
+        if (double(nx) * ny * nz <= 8.0 * atoms + 27)
+            break;
+        cell *= 1.5;
+    }
+
+    m_head.assign(nx * ny * nz, -1);
+    m_next.assign(atoms, -1);
+    std::vector<int> cell_x(atoms), cell_y(atoms), cell_z(atoms);
+
+    for (int i = 0; i < atoms; ++i) {
+        cell_x[i] = std::min(nx - 1, int((geometry(i, 0) - min(0)) / cell));
+        cell_y[i] = std::min(ny - 1, int((geometry(i, 1) - min(1)) / cell));
+        cell_z[i] = std::min(nz - 1, int((geometry(i, 2) - min(2)) / cell));
+        const int index = (cell_z[i] * ny + cell_y[i]) * nx + cell_x[i];
+        m_next[i] = m_head[index];
+        m_head[index] = i;
+    }
+
+    for (int i = 0; i < atoms; ++i) {
+        for (int z = std::max(0, cell_z[i] - 1); z <= std::min(nz - 1, cell_z[i] + 1); ++z) {
+            for (int y = std::max(0, cell_y[i] - 1); y <= std::min(ny - 1, cell_y[i] + 1); ++y) {
+                for (int x = std::max(0, cell_x[i] - 1); x <= std::min(nx - 1, cell_x[i] + 1); ++x) {
+                    for (int j = m_head[(z * ny + y) * nx + x]; j != -1; j = m_next[j]) {
+                        if (j <= i)
+                            continue;
+                        const double dx = geometry(i, 0) - geometry(j, 0);
+                        const double dy = geometry(i, 1) - geometry(j, 1);
+                        const double dz = geometry(i, 2) - geometry(j, 2);
+                        if (dx * dx + dy * dy + dz * dz > range2)
+                            continue;
+                        if (isExcluded(i, j))
+                            continue;
+                        m_first.push_back(i);
+                        m_second.push_back(j);
+                    }
+                }
+            }
+        }
+    }
+}
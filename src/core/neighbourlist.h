@@ -0,0 +1,65 @@
+/*
+ * < Cell list based Verlet neighbour list for non-bonded terms. >
+ * Copyright (C) 2025 Conrad Hübler <Conrad.Huebler@gmx.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#pragma once
+
+#include "src/core/global.h"
+
+#include <vector>
+
+/*! \brief Verlet neighbour list, built from a cell grid
+ *
+ * Pairs (i < j) within cutoff + skin are collected once and reused until
+ * one atom has moved more than half of the skin since the last build.
+ * Excluded pairs (1-2, 1-3, 1-4) are never stored, so memory and build
+ * time scale linearly with the number of atoms.
+ */
+class NeighbourList {
+public:
+    NeighbourList() = default;
+
+    void setCutoff(double cutoff, double skin);
+
+    /*! \brief Excluded partners for each atom, only j > i is taken into account */
+    void setExclusions(const std::vector<std::vector<int>>& exclusions);
+
+    /*! \brief Rebuild the list if necessary, returns true if the list was rebuilt */
+    bool Update(const Matrix& geometry);
+
+    inline void Invalidate() { m_valid = false; }
+
+    inline double Cutoff() const { return m_cutoff; }
+    inline double Skin() const { return m_skin; }
+    inline int Size() const { return m_first.size(); }
+    inline int First(int index) const { return m_first[index]; }
+    inline int Second(int index) const { return m_second[index]; }
+    inline int Builds() const { return m_builds; }
+
+private:
+    void Build(const Matrix& geometry);
+    bool isExcluded(int i, int j) const;
+
+    std::vector<std::vector<int>> m_exclusions;
+    std::vector<int> m_first, m_second;
+    std::vector<int> m_head, m_next;
+    Matrix m_reference;
+    double m_cutoff = 0, m_skin = 2;
+    int m_builds = 0;
+    bool m_valid = false;
+};
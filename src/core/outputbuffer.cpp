@@ -0,0 +1,116 @@
+/*
+ * < Buffered output through persistent file handles. >
+ * Copyright (C) 2025 Conrad Hübler <Conrad.Huebler@gmx.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "outputbuffer.h"
+
+OutputBuffer& OutputBuffer::Instance()
+{
+    static OutputBuffer buffer;
+    return buffer;
+}
+
+OutputBuffer::~OutputBuffer()
+{
+    for (auto& handle : m_handles) {
+        Drain(handle.second);
+        delete handle.second;
+    }
+}
+
+OutputBuffer::Handle* OutputBuffer::Open(const std::string& filename)
+{
+    auto handle = m_handles.find(filename);
+    if (handle != m_handles.end())
+        return handle->second;
+    if (m_handles.size() >= m_max_handles)
+        CloseIdle();
+    Handle* result = new Handle;
+    result->stream.open(filename, std::ios_base::app);
+    result->written = std::chrono::steady_clock::now();
+    m_handles[filename] = result;
+    return result;
+}
+
+void OutputBuffer::Drain(Handle* handle)
+{
+    if (handle->buffer.size()) {
+        handle->stream.write(handle->buffer.data(), handle->buffer.size());
+        handle->buffer.clear();
+    }
+    handle->stream.flush();
+    handle->written = std::chrono::steady_clock::now();
+}
+
+/* too many open files, all are written and closed, the active ones are opened again on demand */
+void OutputBuffer::CloseIdle()
+{
+    for (auto& handle : m_handles) {
+        Drain(handle.second);
+        delete handle.second;
+    }
+    m_handles.clear();
+}
+
+void OutputBuffer::Append(const std::string& filename, const std::string& data)
+{
+    OutputBuffer& instance = Instance();
+    std::lock_guard<std::mutex> lock(instance.m_mutex);
+    Handle* handle = instance.Open(filename);
+    handle->buffer += data;
+    if (handle->buffer.size() >= instance.m_bytes || std::chrono::steady_clock::now() - handle->written >= instance.m_seconds)
+        instance.Drain(handle);
+}
+
+void OutputBuffer::Write(const std::string& filename, const std::string& data)
+{
+    OutputBuffer& instance = Instance();
+    std::lock_guard<std::mutex> lock(instance.m_mutex);
+    auto handle = instance.m_handles.find(filename);
+    if (handle != instance.m_handles.end()) {
+        delete handle->second;
+        instance.m_handles.erase(handle);
+    }
+    std::ofstream file(filename, std::ios_base::out | std::ios_base::trunc);
+    file << data;
+}
+
+void OutputBuffer::Flush(const std::string& filename)
+{
+    OutputBuffer& instance = Instance();
+    std::lock_guard<std::mutex> lock(instance.m_mutex);
+    auto handle = instance.m_handles.find(filename);
+    if (handle != instance.m_handles.end())
+        instance.Drain(handle->second);
+}
+
+void OutputBuffer::FlushAll()
+{
+    OutputBuffer& instance = Instance();
+    std::lock_guard<std::mutex> lock(instance.m_mutex);
+    for (auto& handle : instance.m_handles)
+        instance.Drain(handle.second);
+}
+
+void OutputBuffer::setLimits(std::size_t bytes, double seconds)
+{
+    OutputBuffer& instance = Instance();
+    std::lock_guard<std::mutex> lock(instance.m_mutex);
+    instance.m_bytes = bytes;
+    instance.m_seconds = std::chrono::duration<double>(seconds);
+}
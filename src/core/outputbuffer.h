@@ -0,0 +1,76 @@
+/*
+ * < Buffered output through persistent file handles. >
+ * Copyright (C) 2025 Conrad Hübler <Conrad.Huebler@gmx.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+/*! \brief Process wide service for files that are appended record by record
+ *
+ * Every file keeps one open handle, appended data is collected in memory and
+ * written if the buffer of the file exceeds the size limit or its last write is
+ * older than the time limit. Everything is written by FlushAll (restart files,
+ * stop file, end of the program). Files that are read again in the same run
+ * have to be flushed first, FileIterator and Files::LoadFile do this.
+ * All functions are thread safe.
+ */
+class OutputBuffer {
+public:
+    /*! \brief Append data to the file, the file is created if necessary */
+    static void Append(const std::string& filename, const std::string& data);
+
+    /*! \brief Replace the content of the file, pending data of the file is dropped */
+    static void Write(const std::string& filename, const std::string& data);
+
+    /*! \brief Truncate the file, same as Write with empty data */
+    static inline void Truncate(const std::string& filename) { Write(filename, std::string()); }
+
+    static void Flush(const std::string& filename);
+    static void FlushAll();
+
+    /*! \brief Buffer size (bytes) and age (seconds) that trigger a write, 0 writes every record immediately */
+    static void setLimits(std::size_t bytes, double seconds);
+
+private:
+    struct Handle {
+        std::ofstream stream;
+        std::string buffer;
+        std::chrono::steady_clock::time_point written;
+    };
+
+    OutputBuffer() = default;
+    ~OutputBuffer();
+
+    static OutputBuffer& Instance();
+
+    Handle* Open(const std::string& filename);
+    void Drain(Handle* handle);
+    void CloseIdle();
+
+    std::mutex m_mutex;
+    std::unordered_map<std::string, Handle*> m_handles;
+    std::size_t m_bytes = 1 << 20;
+    std::chrono::duration<double> m_seconds = std::chrono::duration<double>(2.0);
+    std::size_t m_max_handles = 64;
+};
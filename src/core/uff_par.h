@@ -374,5 +374,8 @@ const json UFFParameterJson{
     { "verbose", false },
     { "rings", false },
     { "threads", 1 },
-    { "gradient", 0 }
+    { "gradient", 0 },
+    { "simd", true },
+    { "balance_calibration", 3 },
+    { "gradient_check", false }
 };
@@ -1095,12 +1095,10 @@ int main(int argc, char **argv) {
             int stride = std::stoi(argv[3]);
 
             FileIterator file(argv[2]);
-            int index = 1;
+            file.setSlice(stride - 1, -1, stride);
             while (!file.AtEnd()) {
                 Molecule mol = file.Next();
-                if (index % stride == 0)
-                    mol.appendXYZFile(std::string("blob.xyz"));
-                index++;
+                mol.appendXYZFile(std::string("blob.xyz"));
             }
         } else {
             bool centered = false;
@@ -35,6 +35,7 @@
 
 #include "src/core/elements.h"
 #include "src/core/molecule.h"
+#include "src/core/outputbuffer.h"
 // #include "src/core/fileiterator.h"
 
 #include "src/tools/general.h"
@@ -259,6 +260,7 @@ inline Mol Mol22Mol(const std::string& filename)
 
 inline Molecule LoadFile(const std::string& filename)
 {
+    OutputBuffer::Flush(filename);
     if (std::string(filename).find(".xyz") != std::string::npos || std::string(filename).find(".trj") != std::string::npos)
         return Molecule(XYZ2Mol(filename));
     else if (std::string(filename).find(".mol2") != std::string::npos)
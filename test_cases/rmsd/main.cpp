@@ -20,16 +20,21 @@
 #include "src/core/molecule.h"
 
 #include "src/capabilities/rmsd.h"
+#include "src/capabilities/rmsdbatch.h"
+#include "src/capabilities/rmsd_functions.h"
 
 #include "src/tools/general.h"
 
+#include <algorithm>
+#include <cmath>
 #include <iostream>
 #include <string>
+#include <vector>
 
 #include "json.hpp"
 using json = nlohmann::json;
 
-int main(int argc, char** argv)
+int Standard()
 {
     int threads = MaxThreads();
 
@@ -51,3 +56,127 @@ int main(int argc, char** argv)
         return -1;
     }
 }
+
+/* Linear, two atom and identical structures have a degenerate largest QCP eigenvalue,
+ * RMSD and rotation have to match the SVD reference. */
+int Degenerate()
+{
+    const Eigen::Matrix3d rotation = Eigen::AngleAxisd(2.1, Eigen::Vector3d(1, -2, 0.5).normalized()).toRotationMatrix();
+    std::vector<std::pair<std::string, Geometry>> cases;
+
+    Geometry linear(3, 3);
+    linear << -1.16, 0, 0, 0, 0, 0, 1.16, 0, 0;
+    cases.push_back({ "linear", linear });
+    Geometry diatomic(2, 3);
+    diatomic << 0.37, 0.1, -0.2, -0.37, -0.1, 0.2;
+    cases.push_back({ "two atoms", diatomic });
+    cases.push_back({ "identical", Molecule("input_aa.xyz").getGeometry() });
+
+    double error = 0;
+    for (const auto& c : cases) {
+        const Geometry reference = c.second.rowwise() - c.second.colwise().mean();
+        for (double noise : { 0.0, 1e-7, 1e-4 }) {
+            Geometry target = reference * rotation;
+            for (int i = 0; i < target.rows(); ++i)
+                for (int j = 0; j < 3; ++j)
+                    target(i, j) += noise * std::sin(7.0 * i + 3.0 * j + 1);
+            target = target.rowwise() - target.colwise().mean();
+
+            const double expected = RMSDFunctions::SVDRMSD(reference, target);
+            const double qcp = RMSDFunctions::QCPRMSD(reference, target);
+            const double rotated = std::sqrt((reference - target * RMSDFunctions::BestFitRotation(reference, target)).squaredNorm() / double(reference.rows()));
+
+            Molecule m1, m2;
+            for (int i = 0; i < reference.rows(); ++i) {
+                m1.addPair({ 6, reference.row(i).transpose() });
+                m2.addPair({ 6, target.row(i).transpose() });
+            }
+            json controller = RMSDJson;
+            controller["noreorder"] = true;
+            RMSDDriver driver(controller, true);
+            driver.setReference(m1);
+            driver.setTarget(m2);
+            driver.start();
+
+            const double deviation = std::max({ std::abs(qcp - expected), std::abs(rotated - expected), std::abs(driver.RMSD() - expected) });
+            std::cout << c.first << " (noise " << noise << "): " << deviation << std::endl;
+            error = std::max(error, deviation);
+        }
+    }
+    if (error < 1e-6) {
+        std::cout << "RMSD of degenerate structures passed (" << error << ")." << std::endl;
+        return EXIT_SUCCESS;
+    } else {
+        std::cout << "RMSD of degenerate structures failed (" << error << ")." << std::endl;
+        return EXIT_FAILURE;
+    }
+}
+
+/* RMSDBatch against RMSDDriver (no reordering) for RMSD and gradient, including identical and linear structures */
+int Batch()
+{
+    const Molecule query("input_aa.xyz");
+    const Eigen::Matrix3d rotation = Eigen::AngleAxisd(0.8, Eigen::Vector3d(0.3, 1, -1).normalized()).toRotationMatrix();
+
+    std::vector<Molecule> stored = { Molecule("input_ab.xyz"), query };
+    Molecule rotated(query);
+    rotated.setGeometry(query.getGeometry() * rotation);
+    stored.push_back(rotated);
+    Molecule perturbed(rotated);
+    Geometry geometry = perturbed.getGeometry();
+    for (int i = 0; i < geometry.rows(); ++i)
+        geometry(i, i % 3) += 1e-3 * std::cos(1.0 * i);
+    perturbed.setGeometry(geometry);
+    stored.push_back(perturbed);
+
+    RMSDBatch batch;
+    for (const auto& molecule : stored)
+        batch.addGeometry(molecule.getGeometry());
+    std::vector<double> rmsd;
+    std::vector<Geometry> gradients;
+    batch.Calculate(query.getGeometry(), rmsd, &gradients);
+
+    json controller = RMSDJson;
+    controller["noreorder"] = true;
+    double error = 0;
+    for (int i = 0; i < stored.size(); ++i) {
+        RMSDDriver driver(controller, true);
+        driver.setReference(query);
+        driver.setTarget(stored[i]);
+        driver.start();
+        double deviation = std::max(std::abs(rmsd[i] - driver.RMSD()), std::abs(batch.RMSD(query.getGeometry(), i) - driver.RMSD()));
+        if (driver.RMSD() > 1e-6)
+            deviation = std::max(deviation, (gradients[i] - driver.Gradient()).cwiseAbs().maxCoeff());
+        std::cout << "structure " << i << ": " << deviation << std::endl;
+        error = std::max(error, deviation);
+    }
+
+    Geometry linear(3, 3);
+    linear << -1.16, 0, 0, 0, 0, 0, 1.16, 0, 0;
+    RMSDBatch degenerate;
+    degenerate.addGeometry(linear * rotation);
+    degenerate.addGeometry(linear);
+    degenerate.Calculate(linear, rmsd, &gradients);
+    for (double value : rmsd)
+        error = std::max(error, std::abs(value));
+    std::cout << "linear: " << std::max(std::abs(rmsd[0]), std::abs(rmsd[1])) << std::endl;
+
+    if (error < 1e-6) {
+        std::cout << "RMSD batch passed (" << error << ")." << std::endl;
+        return EXIT_SUCCESS;
+    } else {
+        std::cout << "RMSD batch failed (" << error << ")." << std::endl;
+        return EXIT_FAILURE;
+    }
+}
+
+int main(int argc, char** argv)
+{
+    if (argc == 1)
+        return Standard();
+    if (std::string(argv[1]).compare("degenerate") == 0)
+        return Degenerate();
+    else if (std::string(argv[1]).compare("batch") == 0)
+        return Batch();
+    return EXIT_FAILURE;
+}
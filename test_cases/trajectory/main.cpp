@@ -0,0 +1,76 @@
+/*
+ * <Binary trajectory test application within curcuma.>
+ * Copyright (C) 2025 Conrad Hübler <Conrad.Huebler@gmx.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "src/core/binarytrajectory.h"
+#include "src/core/fileiterator.h"
+#include "src/core/molecule.h"
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <string>
+#include <vector>
+
+/* writes two structures as .ctrj and reads them back, the largest coordinate error has to stay below tolerance */
+int RoundTrip(const std::string& format, double tolerance)
+{
+    std::vector<Molecule> molecules = { Molecule("input_aa.xyz"), Molecule("input_ab.xyz") };
+    molecules[0].setEnergy(-1.5);
+    molecules[1].setEnergy(-2.25);
+
+    const std::string filename = "trajectory_" + format + ".ctrj";
+    {
+        BinaryTrajectoryWriter writer(filename, format);
+        for (const auto& molecule : molecules)
+            writer.Write(molecule, writer.Frames());
+    }
+
+    FileIterator file(filename, true);
+    int frame = 0;
+    double error = 0;
+    bool passed = file.FrameCount() == molecules.size();
+    while (passed && !file.AtEnd()) {
+        Molecule molecule = file.Next();
+        const Molecule& original = molecules[frame++];
+        passed = molecule.Atoms() == original.Atoms() && std::abs(molecule.Energy() - original.Energy()) < 1e-12;
+        if (passed)
+            error = std::max(error, (molecule.getGeometry() - original.getGeometry()).cwiseAbs().maxCoeff());
+    }
+    passed = passed && frame == molecules.size() && error < tolerance;
+    if (passed) {
+        std::cout << "Binary trajectory (" << format << ") passed (" << error << ")." << std::endl;
+        return EXIT_SUCCESS;
+    } else {
+        std::cout << "Binary trajectory (" << format << ") failed (" << error << ")." << std::endl;
+        return EXIT_FAILURE;
+    }
+}
+
+int main(int argc, char** argv)
+{
+    if (argc == 1)
+        return EXIT_FAILURE;
+    if (std::string(argv[1]).compare("float32") == 0)
+        return RoundTrip("float32", 1e-5);
+    else if (std::string(argv[1]).compare("float64") == 0)
+        return RoundTrip("float64", 1e-12);
+    else if (std::string(argv[1]).compare("compressed") == 0)
+        return RoundTrip("compressed", 1e-3);
+    return EXIT_FAILURE;
+}